@@ -0,0 +1,77 @@
+#include "include/arena.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+
+static ArenaChunk* new_chunk(size_t size, ArenaChunk* next) {
+  ArenaChunk* chunk = malloc(sizeof(ArenaChunk) + size);
+  if (chunk == NULL) {
+    fprintf(stderr, "Memory allocation failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  chunk->next = next;
+  chunk->size = size;
+  chunk->used = 0;
+  return chunk;
+}
+
+Arena* new_arena() {
+  Arena* arena = malloc(sizeof(Arena));
+  arena->chunks = new_chunk(ARENA_CHUNK_SIZE, NULL);
+  arena->allocated = 0;
+  return arena;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+  return arena_alloc_aligned(arena, size, ARENA_ALIGN);
+}
+
+void* arena_alloc_aligned(Arena* arena, size_t size, size_t align) {
+  if (align < ARENA_ALIGN)
+    align = ARENA_ALIGN;
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  ArenaChunk* chunk = arena->chunks;
+  uintptr_t base = (uintptr_t)chunk->data;
+  size_t offset = ((base + chunk->used + align - 1) & ~(align - 1)) - base;
+  if (offset + size > chunk->size) {
+    if (size + align > ARENA_CHUNK_SIZE / 4) {
+      // big blocks get a chunk of their own behind the current one, so the
+      // space left in the current chunk is not wasted
+      chunk->next = new_chunk(size + align, chunk->next);
+      chunk = chunk->next;
+    } else {
+      chunk = new_chunk(ARENA_CHUNK_SIZE, chunk);
+      arena->chunks = chunk;
+    }
+    base = (uintptr_t)chunk->data;
+    offset = ((base + chunk->used + align - 1) & ~(align - 1)) - base;
+  }
+  chunk->used = offset + size;
+  arena->allocated += size;
+  return chunk->data + offset;
+}
+
+void arena_merge(Arena* into, Arena* from) {
+  // spliced behind the current chunk, which keeps being filled
+  ArenaChunk* last = from->chunks;
+  while (last->next != NULL) {
+    last = last->next;
+  }
+  last->next = into->chunks->next;
+  into->chunks->next = from->chunks;
+  into->allocated += from->allocated;
+  free(from);
+}
+
+void free_arena(Arena* arena) {
+  ArenaChunk* chunk = arena->chunks;
+  while (chunk != NULL) {
+    ArenaChunk* next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  free(arena);
+}
@@ -0,0 +1,101 @@
+#include "include/bytecode.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// grow a table of the chunk to hold one more item
+#define GROW(array, count)                                        \
+  do {                                                            \
+    if (((count) & ((count)-1)) == 0) {                           \
+      int capacity = (count) < 8 ? 8 : (count)*2;                 \
+      (array) = realloc((array), sizeof(*(array)) * capacity);    \
+    }                                                             \
+  } while (0)
+
+#define INDEX_TABLE_SIZE 16
+
+Chunk* new_chunk() {
+  return calloc(1, sizeof(Chunk));
+}
+
+void free_chunk(Chunk* chunk) {
+  free(chunk->code);
+  free(chunk->constants);
+  free(chunk->names);
+  if (chunk->constant_indices != NULL)
+    hash_table_destroy(chunk->constant_indices);
+  if (chunk->name_indices != NULL)
+    hash_table_destroy(chunk->name_indices);
+  free(chunk->declarations);
+  free(chunk);
+}
+
+void write_byte(Chunk* chunk, uint8_t byte) {
+  if (chunk->count == chunk->capacity) {
+    chunk->capacity = chunk->capacity < 64 ? 64 : chunk->capacity * 2;
+    chunk->code = realloc(chunk->code, chunk->capacity);
+  }
+  chunk->code[chunk->count++] = byte;
+}
+
+void write_short(Chunk* chunk, uint16_t value) {
+  uint8_t bytes[2];
+  memcpy(bytes, &value, sizeof(value));
+  write_byte(chunk, bytes[0]);
+  write_byte(chunk, bytes[1]);
+}
+
+void write_int(Chunk* chunk, uint32_t value) {
+  uint8_t bytes[4];
+  memcpy(bytes, &value, sizeof(value));
+  for (int i = 0; i < 4; i++) {
+    write_byte(chunk, bytes[i]);
+  }
+}
+
+// the index stored under `key` in `*table`, else -1
+static int find_index(hash_table** table, const char* key, size_t length) {
+  if (*table == NULL)
+    *table = hash_table_create(INDEX_TABLE_SIZE, NULL);
+  return (int)(intptr_t)hash_table_lookup_n(*table, key, length) - 1;
+}
+
+int add_constant(Chunk* chunk, int constant, Value value) {
+  // a literal repeated in a body shares its entry
+  char key[9];
+  snprintf(key, sizeof(key), "%08x", (unsigned)constant);
+  int index = find_index(&chunk->constant_indices, key, 8);
+  if (index >= 0)
+    return index;
+  GROW(chunk->constants, chunk->num_constants);
+  chunk->constants[chunk->num_constants] = value;
+  hash_table_insert_n(chunk->constant_indices, key, 8,
+                      (void*)(intptr_t)(chunk->num_constants + 1));
+  return chunk->num_constants++;
+}
+
+int add_name(Chunk* chunk, Token* token, int slot) {
+  // a name used again with the same slot shares its entry; one a syntax
+  // error left without a token is keyed by its slot alone
+  const char* text = token != NULL ? token->start : "";
+  int text_length = token != NULL ? token->length : 0;
+  int length = snprintf(NULL, 0, "%d:%.*s", slot, text_length, text);
+  char* key = malloc(length + 1);
+  snprintf(key, length + 1, "%d:%.*s", slot, text_length, text);
+  int index = find_index(&chunk->name_indices, key, length);
+  if (index < 0) {
+    GROW(chunk->names, chunk->num_names);
+    chunk->names[chunk->num_names] = (Name){token, slot};
+    index = chunk->num_names++;
+    hash_table_insert_n(chunk->name_indices, key, length,
+                        (void*)(intptr_t)(index + 1));
+  }
+  free(key);
+  return index;
+}
+
+int add_declaration(Chunk* chunk, Statement* declaration) {
+  GROW(chunk->declarations, chunk->num_declarations);
+  chunk->declarations[chunk->num_declarations] = declaration;
+  return chunk->num_declarations++;
+}
@@ -0,0 +1,237 @@
+#include "include/cache.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "include/flat_ast.h"
+
+#define CACHE_MAGIC 0x43584f4c  // "LOXC"
+#define CACHE_VERSION 2
+
+// A cache file is this header, the flat AST image, the constants, each a
+// type byte followed by 8 bytes of a number or a 4-byte length and the
+// bytes of a string, and last a copy of the source. Everything is in host
+// byte order. A file is only used for the very source it was made from,
+// the key just names it. The image is validated as it is read, the
+// checksum catches corruption that still makes a well-formed image.
+typedef struct CacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint64_t source_length;
+  uint32_t num_constants;
+  uint32_t image_size;
+  // of everything after the header
+  uint64_t checksum;
+} CacheHeader;
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+// 64-bit FNV-1a
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t length) {
+  const unsigned char* bytes = data;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ bytes[i]) * FNV_PRIME;
+  }
+  return hash;
+}
+
+uint64_t cache_key(Source* source) {
+  return hash_bytes(FNV_OFFSET, source->data, source->length);
+}
+
+static char* cache_path(const char* dir, uint64_t key) {
+  char* path = malloc(strlen(dir) + 32);
+  sprintf(path, "%s/%016llx.loxc", dir, (unsigned long long)key);
+  return path;
+}
+
+// Add the constants of a cache file to the pool and return the pool index
+// of each, NULL when they are truncated or malformed.
+static int* load_constants(const uint8_t* data,
+                           size_t size,
+                           uint32_t count,
+                           ConstantPool* constants) {
+  int* map = malloc(sizeof(int) * (count + 1));
+  size_t at = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    uint8_t type = at < size ? data[at++] : 0xff;
+    if (type == C_NUMBER && size - at >= sizeof(double)) {
+      double number;
+      memcpy(&number, data + at, sizeof(number));
+      at += sizeof(number);
+      map[i] = add_number_constant(constants, number);
+    } else if (type == C_STRING && size - at >= sizeof(uint32_t)) {
+      uint32_t length;
+      memcpy(&length, data + at, sizeof(length));
+      at += sizeof(length);
+      if (length > size - at)
+        break;
+      map[i] = add_string_constant(constants, (const char*)data + at, length);
+      at += length;
+    } else {
+      break;
+    }
+    if (i + 1 == count)
+      return map;
+  }
+  if (count == 0)
+    return map;
+  free(map);
+  return NULL;
+}
+
+Statement** load_cached_program(const char* dir,
+                                uint64_t key,
+                                Source* source,
+                                ConstantPool* constants,
+                                Arena* arena) {
+  char* path = cache_path(dir, key);
+  int fd = open(path, O_RDONLY);
+  free(path);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  void* data = MAP_FAILED;
+  // only files this user wrote and nobody else may change are trusted
+  if (fstat(fd, &st) == 0 && st.st_uid == getuid() &&
+      (st.st_mode & (S_IWGRP | S_IWOTH)) == 0 &&
+      (size_t)st.st_size >= sizeof(CacheHeader)) {
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (data == MAP_FAILED)
+    return NULL;
+
+  size_t size = st.st_size;
+  const CacheHeader* header = data;
+  Statement** program = NULL;
+  size_t payload_size = size - sizeof(CacheHeader);
+  if (header->magic == CACHE_MAGIC && header->version == CACHE_VERSION &&
+      header->key == key && header->source_length == source->length &&
+      header->image_size <= payload_size &&
+      source->length <= payload_size - header->image_size &&
+      memcmp((const uint8_t*)data + size - source->length, source->data,
+             source->length) == 0 &&
+      header->checksum ==
+          hash_bytes(FNV_OFFSET, (const uint8_t*)data + sizeof(CacheHeader),
+                     size - sizeof(CacheHeader))) {
+    const uint8_t* image = (const uint8_t*)data + sizeof(CacheHeader);
+    FlatAst* ast = map_flat_ast(image, header->image_size);
+    if (ast != NULL && ast->num_constants == header->num_constants &&
+        ast->source_length == source->length) {
+      size_t at = sizeof(CacheHeader) + header->image_size;
+      int* map =
+          load_constants((const uint8_t*)data + at, size - source->length - at,
+                         header->num_constants, constants);
+      if (map != NULL) {
+        program = inflate_ast(ast, arena, source->data, map);
+        free(map);
+      }
+    }
+    if (ast != NULL)
+      free_flat_ast(ast);
+  }
+  munmap(data, size);
+  return program;
+}
+
+// Renumber the literals of `ast` to index only the constants they use,
+// which are returned as pool indices in `used`.
+static uint32_t compact_constants(FlatAst* ast,
+                                  ConstantPool* constants,
+                                  int* used) {
+  int* local = malloc(sizeof(int) * (constants->count + 1));
+  memset(local, -1, sizeof(int) * (constants->count + 1));
+  uint32_t count = 0;
+  for (uint32_t id = 1; id < ast->num_nodes; id++) {
+    if (ast->kinds[id] != E_Literal || ast->b[id] == (uint32_t)-1)
+      continue;
+    uint32_t index = ast->b[id];
+    if (local[index] < 0) {
+      local[index] = count;
+      used[count++] = index;
+    }
+    ast->b[id] = local[index];
+  }
+  free(local);
+  ast->num_constants = count;
+  return count;
+}
+
+static bool write_constants(FILE* file,
+                            ConstantPool* constants,
+                            int* used,
+                            uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    Constant* constant = &constants->constants[used[i]];
+    uint8_t type = constant->type;
+    if (fwrite(&type, 1, 1, file) != 1)
+      return false;
+    if (constant->type == C_NUMBER) {
+      if (fwrite(&constant->number, sizeof(double), 1, file) != 1)
+        return false;
+    } else {
+      uint32_t length = strlen(constant->string);
+      if (fwrite(&length, sizeof(length), 1, file) != 1 ||
+          fwrite(constant->string, 1, length, file) != length)
+        return false;
+    }
+  }
+  return true;
+}
+
+void store_cached_program(const char* dir,
+                          uint64_t key,
+                          Source* source,
+                          Statement** program,
+                          ConstantPool* constants) {
+  if (source->length > UINT32_MAX)
+    return;
+  if (mkdir(dir, 0700) != 0 && errno != EEXIST)
+    return;
+
+  FlatAst* ast = flatten_ast(program, source->data, source->length);
+  int* used = malloc(sizeof(int) * (constants->count + 1));
+  uint32_t count = compact_constants(ast, constants, used);
+
+  // the payload is assembled in memory first for its checksum
+  char* payload = NULL;
+  size_t payload_size = 0;
+  FILE* stream = open_memstream(&payload, &payload_size);
+  bool ok = stream != NULL && write_flat_ast(ast, stream) &&
+            write_constants(stream, constants, used, count) &&
+            fwrite(source->data, 1, source->length, stream) == source->length;
+  if (stream != NULL)
+    ok = fclose(stream) == 0 && ok;
+  CacheHeader header = {CACHE_MAGIC,
+                        CACHE_VERSION,
+                        key,
+                        source->length,
+                        count,
+                        flat_ast_image_size(ast),
+                        hash_bytes(FNV_OFFSET, payload, payload_size)};
+
+  // written aside and renamed, so a reader never maps a partial file
+  char* path = cache_path(dir, key);
+  char* temp = malloc(strlen(path) + 32);
+  sprintf(temp, "%s.%d.tmp", path, (int)getpid());
+  FILE* file = ok ? fopen(temp, "wb") : NULL;
+  if (file != NULL) {
+    ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+         fwrite(payload, 1, payload_size, file) == payload_size;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temp, path) != 0)
+      unlink(temp);
+  }
+  free(payload);
+  free(temp);
+  free(path);
+  free(used);
+  free_flat_ast(ast);
+}
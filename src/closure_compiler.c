@@ -0,0 +1,737 @@
+#include "include/closure_compiler.h"
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/interpreter.h"
+#include "include/log.h"
+
+typedef struct Node Node;
+
+// Run a node in the frame `env`. An expression gives its value, a statement
+// EMPTY_VAL once it is done, or the value of the return it ran.
+typedef Value (*NodeFn)(Node* node, Env* env);
+
+// A node runs through the function of its kind, operator and the operands
+// known when it was compiled, which find their slots, constants and names
+// in its payload instead of the tokens of the AST.
+struct Node {
+  NodeFn run;
+  union {
+    Value constant;
+    // an expression the node runs before it does its own work
+    Node* operand;
+    // a local `depth` frames up, a global when the depth is -1
+    struct {
+      Node* value;
+      int depth;
+      int slot;
+    } local;
+    struct {
+      Token* name;
+      Node* value;
+      int slot;
+    } global;
+    // `right` is NULL when the right operand is the number `constant`
+    struct {
+      Node* left;
+      Node* right;
+      Value constant;
+    } binary;
+    struct {
+      Node* callee;
+      Node** args;
+      int num_args;
+    } call;
+    struct {
+      Node* object;
+      Token* name;
+      Node** args;
+      int num_args;
+    } invoke;
+    struct {
+      Node* object;
+      Token* name;
+      Node* value;
+    } property;
+    struct {
+      Token* method;
+      int depth;
+    } super;
+    struct {
+      Node* condition;
+      Node* then_branch;
+      Node* else_branch;
+    } branch;
+    // a block, or the body of a function with `arity` parameters
+    struct {
+      Node** stmts;
+      int num_stmts;
+      int num_slots;
+      int arity;
+      bool captured;
+    } block;
+    StatementFunction* function;
+    struct {
+      StatementClass* declaration;
+      Node* superclass;
+    } class;
+  } as;
+};
+
+// nodes of every program and body compiled so far, freed with the engine
+static Arena* nodes = NULL;
+// where a stack overflow abandons the program
+static jmp_buf overflow;
+
+static Node* compile_expr(Expr* expr);
+static Node* compile_statement(Statement* stmt, bool top_level);
+static Value call_value(Value callee, Node** args, int num_args, Env* env);
+
+void free_closure_compiler() {
+  if (nodes != NULL) {
+    free_arena(nodes);
+    nodes = NULL;
+  }
+}
+
+static Node* new_node(NodeFn run) {
+  Node* node = arena_new(nodes, Node);
+  node->run = run;
+  return node;
+}
+
+#define RUN(node, env) ((node)->run((node), (env)))
+
+static Value run_constant(Node* node, Env* env) {
+  (void)env;
+  return node->as.constant;
+}
+
+static Value run_local(Node* node, Env* env) {
+  return env->slots[node->as.local.slot];
+}
+
+static Value run_enclosing(Node* node, Env* env) {
+  return env->enclosing->slots[node->as.local.slot];
+}
+
+static Value run_upper(Node* node, Env* env) {
+  return find_declare_env(env, node->as.local.depth)
+      ->slots[node->as.local.slot];
+}
+
+static Value run_global(Node* node, Env* env) {
+  (void)env;
+  Token* name = node->as.global.name;
+  return read_global(&node->as.global.slot, name->start, name->length);
+}
+
+static Value run_set_local(Node* node, Env* env) {
+  return env->slots[node->as.local.slot] = RUN(node->as.local.value, env);
+}
+
+static Value run_set_upper(Node* node, Env* env) {
+  Value value = RUN(node->as.local.value, env);
+  find_declare_env(env, node->as.local.depth)->slots[node->as.local.slot] =
+      value;
+  return value;
+}
+
+static Value run_set_global(Node* node, Env* env) {
+  Value value = RUN(node->as.global.value, env);
+  Token* name = node->as.global.name;
+  assign_global(&node->as.global.slot, name->start, name->length, value);
+  return value;
+}
+
+// The variant of an operator for a number on the right is picked when it
+// is a literal. Numbers take the fast path, anything else the operator of
+// the runtime.
+#define BINARY_NODES(name, op, make, token)                                \
+  static Value run_##name(Node* node, Env* env) {                          \
+    Value left = RUN(node->as.binary.left, env);                           \
+    Value right = RUN(node->as.binary.right, env);                         \
+    if (IS_NUMBER(left) && IS_NUMBER(right))                               \
+      return make(AS_NUMBER(left) op AS_NUMBER(right));                    \
+    return binary_values(token, left, right);                              \
+  }                                                                        \
+  static Value run_##name##_constant(Node* node, Env* env) {               \
+    Value left = RUN(node->as.binary.left, env);                           \
+    if (IS_NUMBER(left))                                                   \
+      return make(AS_NUMBER(left) op AS_NUMBER(node->as.binary.constant)); \
+    return binary_values(token, left, node->as.binary.constant);           \
+  }
+
+BINARY_NODES(add, +, NUMBER_VAL, PLUS)
+BINARY_NODES(subtract, -, NUMBER_VAL, MINUS)
+BINARY_NODES(multiply, *, NUMBER_VAL, STAR)
+BINARY_NODES(divide, /, NUMBER_VAL, SLASH)
+BINARY_NODES(less, <, BOOL_VAL, LESS)
+BINARY_NODES(less_equal, <=, BOOL_VAL, LESS_EQUAL)
+BINARY_NODES(greater, >, BOOL_VAL, GREATER)
+BINARY_NODES(greater_equal, >=, BOOL_VAL, GREATER_EQUAL)
+BINARY_NODES(equal, ==, BOOL_VAL, EQUAL_EQUAL)
+BINARY_NODES(not_equal, !=, BOOL_VAL, BANG_EQUAL)
+
+#undef BINARY_NODES
+
+static Value run_negate(Node* node, Env* env) {
+  Value value = RUN(node->as.operand, env);
+  if (IS_NUMBER(value)) {
+    return NUMBER_VAL(-AS_NUMBER(value));
+  }
+  return negate_value(value);
+}
+
+static Value run_not(Node* node, Env* env) {
+  return BOOL_VAL(!is_truthy(RUN(node->as.operand, env)));
+}
+
+static Value run_and(Node* node, Env* env) {
+  Value left = RUN(node->as.binary.left, env);
+  if (!is_logical_truthy(left))
+    return left;
+  return RUN(node->as.binary.right, env);
+}
+
+static Value run_or(Node* node, Env* env) {
+  Value left = RUN(node->as.binary.left, env);
+  if (is_logical_truthy(left))
+    return left;
+  return RUN(node->as.binary.right, env);
+}
+
+static Value run_get(Node* node, Env* env) {
+  return get_property(RUN(node->as.property.object, env),
+                      node->as.property.name);
+}
+
+// the value is not run when the object has no fields
+static Value run_set(Node* node, Env* env) {
+  Value object = RUN(node->as.property.object, env);
+  if (!IS_INSTANCE(object)) {
+    log_error("Only instances have fields.");
+    return NIL_VAL;
+  }
+  Value value = RUN(node->as.property.value, env);
+  return set_property(object, node->as.property.name, value);
+}
+
+static Value run_super(Node* node, Env* env) {
+  // the scope of 'this' is right inside the one of 'super'
+  Value superclass = find_declare_env(env, node->as.super.depth)->slots[0];
+  Value instance = find_declare_env(env, node->as.super.depth - 1)->slots[0];
+  return super_method(superclass, instance, node->as.super.method);
+}
+
+static Value run_function(Node* node, Env* env) {
+  return new_function_obj(node->as.function, env, false);
+}
+
+static Value run_class(Node* node, Env* env) {
+  Node* superclass = node->as.class.superclass;
+  return new_class(node->as.class.declaration,
+                   superclass != NULL ? RUN(superclass, env) : NIL_VAL, env);
+}
+
+// the arguments of a call that is not made, for what they do
+static void run_arguments(Node** args, int num_args, Env* env) {
+  for (int i = 0; i < num_args; i++) {
+    RUN(args[i], env);
+  }
+}
+
+static Node* compile_body(StatementFunction* declaration);
+static Value run_statements(Node* node, Env* env);
+
+// Call `function` with 'this' bound to `instance` unless it is EMPTY_VAL.
+// The arguments are run straight into the parameter slots of its frame,
+// frames pushed meanwhile are popped before it.
+static Value call_function(Function* function,
+                           Value instance,
+                           Node** args,
+                           int num_args,
+                           Env* env) {
+  if (function->native != NULL) {
+    run_arguments(args, num_args, env);
+    if (num_args != 0) {
+      log_error("Expected 0 arguments but got %d.", num_args);
+      return NIL_VAL;
+    }
+    return function->native();
+  }
+  StatementBlock* declared = function_body(function->declaration);
+  if (declared->node == NULL) {
+    declared->node = compile_body(function->declaration);
+  }
+  Node* body = declared->node;
+  if (num_args != body->as.block.arity) {
+    run_arguments(args, num_args, env);
+    log_error("Expected %d arguments but got %d.", body->as.block.arity,
+              num_args);
+    return NIL_VAL;
+  }
+  // the nodes recurse on the C stack
+  if (stack_exhausted()) {
+    log_error("Stack overflow.");
+    longjmp(overflow, 1);
+  }
+
+  bool captured = body->as.block.captured;
+  Env* closure = function->closure;
+  Env* this_env = NULL;
+  if (instance != EMPTY_VAL) {
+    this_env = push_frame(closure, 1, captured);
+    env_define(this_env, "this", strlen("this"), instance);
+    closure = this_env;
+  }
+  Env* frame = push_frame(closure, body->as.block.num_slots, captured);
+  for (int i = 0; i < num_args; i++) {
+    frame->slots[i] = RUN(args[i], env);
+  }
+  frame->count = num_args;
+
+  Value result = run_statements(body, frame);
+  pop_frame(frame, captured);
+  if (this_env != NULL) {
+    pop_frame(this_env, captured);
+  }
+
+  // an initializer gives its instance, whatever it returns
+  if (function->is_initializer) {
+    return closure->slots[0];
+  }
+  return result != EMPTY_VAL ? result : NIL_VAL;
+}
+
+// The call of a class is a new instance, which only its own initializer
+// runs on, along with the arguments.
+static Value call_value(Value callee, Node** args, int num_args, Env* env) {
+  if (IS_FUNCTION(callee)) {
+    return call_function(AS_FUNCTION(callee), EMPTY_VAL, args, num_args, env);
+  }
+  if (IS_CLASS(callee)) {
+    Class* class = AS_CLASS(callee);
+    Value instance = INSTANCE_VAL(new_instance(class));
+    Function* initializer = hash_table_lookup(class->methods, "init");
+    if (initializer != NULL) {
+      call_function(initializer, instance, args, num_args, env);
+    }
+    return instance;
+  }
+  log_error("Can only call functions and classes.");
+  return NIL_VAL;
+}
+
+static Value run_call(Node* node, Env* env) {
+  return call_value(RUN(node->as.call.callee, env), node->as.call.args,
+                    node->as.call.num_args, env);
+}
+
+// obj.method(...) runs the method without binding it to obj first
+static Value run_invoke(Node* node, Env* env) {
+  Value object = RUN(node->as.invoke.object, env);
+  Token* name = node->as.invoke.name;
+  if (IS_INSTANCE(object) &&
+      hash_table_lookup_n(AS_INSTANCE(object)->fields, name->start,
+                          name->length) == NULL) {
+    Function* method = find_method(AS_INSTANCE(object)->class, name);
+    if (method != NULL) {
+      return call_function(method, object, node->as.invoke.args,
+                           node->as.invoke.num_args, env);
+    }
+  }
+  return call_value(get_property(object, name), node->as.invoke.args,
+                    node->as.invoke.num_args, env);
+}
+
+static Value run_expression(Node* node, Env* env) {
+  RUN(node->as.operand, env);
+  return EMPTY_VAL;
+}
+
+static Value run_print(Node* node, Env* env) {
+  print_value(RUN(node->as.operand, env));
+  return EMPTY_VAL;
+}
+
+static Value run_define_local(Node* node, Env* env) {
+  Value value = RUN(node->as.operand, env);
+  if (env->count < env->num_slots) {
+    env->slots[env->count++] = value;
+  }
+  return EMPTY_VAL;
+}
+
+static Value run_define_global(Node* node, Env* env) {
+  Value value = RUN(node->as.global.value, env);
+  Token* name = node->as.global.name;
+  define_global(&node->as.global.slot, name->start, name->length, value);
+  return EMPTY_VAL;
+}
+
+// the statements of a block without a frame, or of a function body in the
+// frame of its call, up to a return
+static Value run_statements(Node* node, Env* env) {
+  Node** stmts = node->as.block.stmts;
+  for (int i = 0; i < node->as.block.num_stmts; i++) {
+    Value result = RUN(stmts[i], env);
+    if (result != EMPTY_VAL)
+      return result;
+  }
+  return EMPTY_VAL;
+}
+
+static Value run_block(Node* node, Env* env) {
+  bool captured = node->as.block.captured;
+  Env* frame = push_frame(env, node->as.block.num_slots, captured);
+  Value result = run_statements(node, frame);
+  pop_frame(frame, captured);
+  return result;
+}
+
+static Value run_if(Node* node, Env* env) {
+  if (is_truthy(RUN(node->as.branch.condition, env)))
+    return RUN(node->as.branch.then_branch, env);
+  return EMPTY_VAL;
+}
+
+static Value run_if_else(Node* node, Env* env) {
+  if (is_truthy(RUN(node->as.branch.condition, env)))
+    return RUN(node->as.branch.then_branch, env);
+  return RUN(node->as.branch.else_branch, env);
+}
+
+static Value run_while(Node* node, Env* env) {
+  while (is_truthy(RUN(node->as.branch.condition, env))) {
+    Value result = RUN(node->as.branch.then_branch, env);
+    if (result != EMPTY_VAL)
+      return result;
+  }
+  return EMPTY_VAL;
+}
+
+static Value run_return(Node* node, Env* env) {
+  return RUN(node->as.operand, env);
+}
+
+static Node* compile_constant(Value value) {
+  Node* node = new_node(run_constant);
+  node->as.constant = value;
+  return node;
+}
+
+static Node* compile_operand(NodeFn run, Node* operand) {
+  Node* node = new_node(run);
+  node->as.operand = operand;
+  return node;
+}
+
+// Read a variable the resolver found `depth` frames up, or a global when
+// the depth is -1, and assign `value` to it unless that is NULL.
+static Node* compile_variable(Token* name, int depth, int slot, Node* value) {
+  Node* node;
+  if (depth < 0) {
+    node = new_node(value != NULL ? run_set_global : run_global);
+    node->as.global.name = name;
+    node->as.global.value = value;
+    node->as.global.slot = slot;
+    return node;
+  }
+  if (value != NULL) {
+    node = new_node(depth == 0 ? run_set_local : run_set_upper);
+  } else {
+    node = new_node(depth == 0   ? run_local
+                    : depth == 1 ? run_enclosing
+                                 : run_upper);
+  }
+  node->as.local.value = value;
+  node->as.local.depth = depth;
+  node->as.local.slot = slot;
+  return node;
+}
+
+static NodeFn binary_fn(TokenType op, bool constant) {
+#define BINARY_CASE(token, name) \
+  case token:                    \
+    return constant ? run_##name##_constant : run_##name;
+  switch (op) {
+    BINARY_CASE(PLUS, add)
+    BINARY_CASE(MINUS, subtract)
+    BINARY_CASE(STAR, multiply)
+    BINARY_CASE(SLASH, divide)
+    BINARY_CASE(LESS, less)
+    BINARY_CASE(LESS_EQUAL, less_equal)
+    BINARY_CASE(GREATER, greater)
+    BINARY_CASE(GREATER_EQUAL, greater_equal)
+    BINARY_CASE(EQUAL_EQUAL, equal)
+    default:
+      return constant ? run_not_equal_constant : run_not_equal;
+  }
+#undef BINARY_CASE
+}
+
+static bool is_number_literal(Expr* expr) {
+  return expr != NULL && expr->type == E_Literal &&
+         expr->as.literal.type == NUMBER;
+}
+
+static Node* compile_binary(ExprBinary* binary) {
+  bool constant = is_number_literal(binary->right);
+  Node* node = new_node(binary_fn(binary->op->type, constant));
+  node->as.binary.left = compile_expr(binary->left);
+  if (constant) {
+    node->as.binary.right = NULL;
+    node->as.binary.constant = eval_literal(binary->right);
+  } else {
+    node->as.binary.right = compile_expr(binary->right);
+  }
+  return node;
+}
+
+static Node** compile_arguments(Expr** args, int* num_args) {
+  *num_args = 0;
+  while (args[*num_args] != NULL) {
+    (*num_args)++;
+  }
+  Node** nodes_of_args = arena_alloc(nodes, sizeof(Node*) * (*num_args + 1));
+  for (int i = 0; i < *num_args; i++) {
+    nodes_of_args[i] = compile_expr(args[i]);
+  }
+  return nodes_of_args;
+}
+
+static Node* compile_call(ExprCall* call) {
+  Node* node;
+  if (call->callee->type == E_Get) {
+    node = new_node(run_invoke);
+    node->as.invoke.object = compile_expr(call->callee->as.get.object);
+    node->as.invoke.name = call->callee->as.get.name;
+    node->as.invoke.args =
+        compile_arguments(call->arguments, &node->as.invoke.num_args);
+    return node;
+  }
+  node = new_node(run_call);
+  node->as.call.callee = compile_expr(call->callee);
+  node->as.call.args =
+      compile_arguments(call->arguments, &node->as.call.num_args);
+  return node;
+}
+
+static Node* compile_expr(Expr* expr) {
+  // a missing initializer or return value, or a parse error
+  if (expr == NULL)
+    return compile_constant(NIL_VAL);
+  switch (expr->type) {
+    case E_Literal:
+      return compile_constant(eval_literal(expr));
+    case E_Grouping:
+      return compile_expr(expr->as.grouping.expression);
+    // nodes the tree walker specialized compile like their generic kind
+    case E_NegateNumber:
+    case E_Not:
+    case E_Unary:
+      // a negative number is a literal of its own
+      if (expr->as.unary.op->type == MINUS &&
+          is_number_literal(expr->as.unary.right)) {
+        Value number = eval_literal(expr->as.unary.right);
+        return compile_constant(NUMBER_VAL(-AS_NUMBER(number)));
+      }
+      return compile_operand(
+          expr->as.unary.op->type == MINUS ? run_negate : run_not,
+          compile_expr(expr->as.unary.right));
+    case E_AddNumbers:
+    case E_SubtractNumbers:
+    case E_MultiplyNumbers:
+    case E_DivideNumbers:
+    case E_LessNumbers:
+    case E_LessEqualNumbers:
+    case E_GreaterNumbers:
+    case E_GreaterEqualNumbers:
+    case E_EqualNumbers:
+    case E_NotEqualNumbers:
+    case E_Binary:
+      return compile_binary(&expr->as.binary);
+    case E_Logical: {
+      Node* node =
+          new_node(expr->as.logical.op->type == OR ? run_or : run_and);
+      node->as.binary.left = compile_expr(expr->as.logical.left);
+      node->as.binary.right = compile_expr(expr->as.logical.right);
+      return node;
+    }
+    case E_Variable: {
+      ExprVariable* variable = &expr->as.variable;
+      return compile_variable(variable->name, variable->depth, variable->slot,
+                              NULL);
+    }
+    case E_Assign: {
+      ExprAssign* assign = &expr->as.assign;
+      return compile_variable(assign->name, assign->depth, assign->slot,
+                              compile_expr(assign->value));
+    }
+    case E_Call:
+      return compile_call(&expr->as.call);
+    case E_Get: {
+      Node* node = new_node(run_get);
+      node->as.property.object = compile_expr(expr->as.get.object);
+      node->as.property.name = expr->as.get.name;
+      return node;
+    }
+    case E_Set: {
+      Node* node = new_node(run_set);
+      node->as.property.object = compile_expr(expr->as.set.object);
+      node->as.property.name = expr->as.set.name;
+      node->as.property.value = compile_expr(expr->as.set.value);
+      return node;
+    }
+    case E_This: {
+      // 'this' is slot 0 of its scope, a global outside of a class, which
+      // the resolver reported
+      int depth = expr->as.this.depth;
+      return compile_variable(expr->as.this.keyword, depth,
+                              depth < 0 ? -1 : 0, NULL);
+    }
+    case E_Super: {
+      ExprSuper* super = &expr->as.super;
+      // outside of a subclass, which the resolver reported
+      if (super->depth < 0)
+        return compile_variable(super->keyword, -1, -1, NULL);
+      Node* node = new_node(run_super);
+      node->as.super.method = super->method;
+      node->as.super.depth = super->depth;
+      return node;
+    }
+  }
+  return compile_constant(NIL_VAL);
+}
+
+// Bind `value` to a declared name, a global at the top level of a program
+// outside of any block.
+static Node* compile_define(Token* name, Node* value, bool top_level) {
+  if (!top_level)
+    return compile_operand(run_define_local, value);
+  Node* node = new_node(run_define_global);
+  node->as.global.name = name;
+  node->as.global.value = value;
+  node->as.global.slot = -1;
+  return node;
+}
+
+static Node* compile_statements(NodeFn run,
+                                Statement** stmts,
+                                bool top_level) {
+  Node* node = new_node(run);
+  int num_stmts = 0;
+  while (stmts[num_stmts] != NULL) {
+    num_stmts++;
+  }
+  node->as.block.stmts = arena_alloc(nodes, sizeof(Node*) * (num_stmts + 1));
+  for (int i = 0; i < num_stmts; i++) {
+    node->as.block.stmts[i] = compile_statement(stmts[i], top_level);
+  }
+  node->as.block.num_stmts = num_stmts;
+  node->as.block.num_slots = 0;
+  node->as.block.arity = 0;
+  node->as.block.captured = false;
+  return node;
+}
+
+static Node* compile_block(StatementBlock* block, bool top_level) {
+  // the resolver gave no scope to a block declaring nothing
+  if (block->num_slots == 0)
+    return compile_statements(run_statements, block->stmts, top_level);
+  Node* node = compile_statements(run_block, block->stmts, false);
+  node->as.block.num_slots = block->num_slots;
+  node->as.block.captured = block->captured;
+  return node;
+}
+
+static Node* compile_statement(Statement* stmt, bool top_level) {
+  switch (stmt->type) {
+    case STATEMENT_EXPRESSION:
+      return compile_operand(run_expression, compile_expr(stmt->as.expr.expr));
+    case STATEMENT_PRINT:
+      return compile_operand(run_print, compile_expr(stmt->as.print.expr));
+    case STATEMENT_VAR:
+      // a parse error, which the resolver skipped too
+      if (stmt->as.var.name == NULL)
+        break;
+      return compile_define(stmt->as.var.name,
+                            compile_expr(stmt->as.var.initializer), top_level);
+    case STATEMENT_BLOCK:
+      return compile_block(&stmt->as.block, top_level);
+    case STATEMENT_IF: {
+      StatementIf* if_stmt = &stmt->as.if_stmt;
+      Node* node =
+          new_node(if_stmt->else_branch != NULL ? run_if_else : run_if);
+      node->as.branch.condition = compile_expr(if_stmt->condition);
+      node->as.branch.then_branch =
+          compile_statement(if_stmt->then_branch, top_level);
+      node->as.branch.else_branch =
+          if_stmt->else_branch != NULL
+              ? compile_statement(if_stmt->else_branch, top_level)
+              : NULL;
+      return node;
+    }
+    case STATEMENT_WHILE: {
+      Node* node = new_node(run_while);
+      node->as.branch.condition = compile_expr(stmt->as.while_stmt.condition);
+      node->as.branch.then_branch =
+          compile_statement(stmt->as.while_stmt.body, top_level);
+      node->as.branch.else_branch = NULL;
+      return node;
+    }
+    case STATEMENT_FUNCTION: {
+      Node* function = new_node(run_function);
+      function->as.function = &stmt->as.function;
+      return compile_define(stmt->as.function.name, function, top_level);
+    }
+    case STATEMENT_CLASS: {
+      StatementClass* class = &stmt->as.class;
+      Node* node = new_node(run_class);
+      node->as.class.declaration = class;
+      node->as.class.superclass =
+          class->superclass != NULL ? compile_expr(class->superclass) : NULL;
+      return compile_define(class->name, node, top_level);
+    }
+    case STATEMENT_RETURN:
+      return compile_operand(run_return,
+                             compile_expr(stmt->as.return_stmt.value));
+    default:
+      break;
+  }
+  // a statement that does nothing
+  return compile_operand(run_expression, compile_constant(NIL_VAL));
+}
+
+// the body of a function, once its deferred body was parsed, for the frame
+// its call pushes
+static Node* compile_body(StatementFunction* declaration) {
+  StatementBlock* block = &declaration->body->as.block;
+  Node* body = compile_statements(run_statements, block->stmts, false);
+  while (declaration->params[body->as.block.arity] != NULL) {
+    body->as.block.arity++;
+  }
+  body->as.block.num_slots = block->num_slots;
+  body->as.block.captured = block->captured;
+  return body;
+}
+
+void interpret_closures(Statement** statements, Arena* arena) {
+  keep_arena(arena);
+  if (nodes == NULL) {
+    nodes = new_arena();
+  }
+  Node* program = compile_statements(run_statements, statements, true);
+  mark_stack_base();
+  if (setjmp(overflow) != 0) {
+    reset_frames();
+    return;
+  }
+  Env* env = global_environment();
+  // a return outside of any function, which the resolver reported, only
+  // ends the statement it is in
+  for (int i = 0; i < program->as.block.num_stmts; i++) {
+    RUN(program->as.block.stmts[i], env);
+  }
+}
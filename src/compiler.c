@@ -0,0 +1,455 @@
+#include "include/compiler.h"
+#include <stdlib.h>
+#include <string.h>
+#include "include/interpreter.h"
+#include "include/log.h"
+
+// table indices, slots, depths and counts of arguments are shorts
+#define MAX_OPERAND UINT16_MAX
+// what a compile error says when an operand does not fit
+#define TOO_MANY_CONSTANTS "Too many constants in one chunk."
+#define TOO_MANY_NAMES "Too many names in one chunk."
+#define TOO_MANY_DECLARATIONS "Too many functions and classes in one chunk."
+#define TOO_MANY_LOCALS "Too many local variables in one scope."
+#define TOO_MANY_SCOPES "Too many nested scopes."
+
+typedef struct Compiler {
+  Chunk* chunk;
+  // the top level of a program, where a declaration outside of any block
+  // defines a global
+  bool top_level;
+  // the captured flags of the block frames open in the body, innermost
+  // last, for a return to pop them
+  bool* scopes;
+  int num_scopes;
+  int scope_capacity;
+  // set once an error was reported
+  bool had_error;
+  // values on the stack where the code being emitted runs
+  int stack_depth;
+} Compiler;
+
+// how many values each instruction pushes, less the ones it pops; a call
+// also pops its arguments, a jump that keeps its operand pops it when it
+// falls through
+static const int stack_effects[] = {
+    [OP_CONSTANT] = 1,       [OP_NIL] = 1,          [OP_TRUE] = 1,
+    [OP_FALSE] = 1,          [OP_POP] = -1,         [OP_GET_LOCAL] = 1,
+    [OP_GET_UPPER] = 1,      [OP_DEFINE_LOCAL] = -1, [OP_GET_GLOBAL] = 1,
+    [OP_DEFINE_GLOBAL] = -1, [OP_SET_PROPERTY] = -1, [OP_GET_SUPER] = 1,
+    [OP_EQUAL] = -1,         [OP_NOT_EQUAL] = -1,   [OP_GREATER] = -1,
+    [OP_GREATER_EQUAL] = -1, [OP_LESS] = -1,        [OP_LESS_EQUAL] = -1,
+    [OP_ADD] = -1,           [OP_SUBTRACT] = -1,    [OP_MULTIPLY] = -1,
+    [OP_DIVIDE] = -1,        [OP_PRINT] = -1,       [OP_JUMP_IF_FALSE] = -1,
+    [OP_AND] = -1,           [OP_OR] = -1,          [OP_CLOSURE] = 1,
+    [OP_RETURN] = -1,
+};
+
+static void compile_statements(Compiler* compiler, Statement** stmts);
+static void compile_expr(Compiler* compiler, Expr* expr);
+static void emit_op(Compiler* compiler, OpCode op);
+
+// only the first error of a body is reported, the chunk is dropped anyway
+#define compile_error(compiler, ...) \
+  do {                               \
+    if (!(compiler)->had_error)      \
+      log_error(__VA_ARGS__);        \
+    (compiler)->had_error = true;    \
+  } while (0)
+
+static void init_compiler(Compiler* compiler, bool top_level) {
+  memset(compiler, 0, sizeof(*compiler));
+  compiler->chunk = new_chunk();
+  compiler->top_level = top_level;
+}
+
+// the chunk compiled, NULL after an error
+static Chunk* finish_compiler(Compiler* compiler) {
+  emit_op(compiler, OP_NIL);
+  emit_op(compiler, OP_RETURN);
+  free(compiler->scopes);
+  if (compiler->had_error) {
+    free_chunk(compiler->chunk);
+    return NULL;
+  }
+  return compiler->chunk;
+}
+
+static void emit_byte(Compiler* compiler, uint8_t byte) {
+  write_byte(compiler->chunk, byte);
+}
+
+static void adjust_stack(Compiler* compiler, int effect) {
+  compiler->stack_depth += effect;
+  if (compiler->stack_depth > compiler->chunk->max_stack)
+    compiler->chunk->max_stack = compiler->stack_depth;
+}
+
+// an instruction, counted towards the stack the chunk needs
+static void emit_op(Compiler* compiler, OpCode op) {
+  emit_byte(compiler, op);
+  adjust_stack(compiler, stack_effects[op]);
+}
+
+// a short operand, reporting `overflow` when it does not fit in one
+static void emit_short(Compiler* compiler, int operand, const char* overflow) {
+  if (operand > MAX_OPERAND) {
+    compile_error(compiler, "%s", overflow);
+    operand = 0;
+  }
+  write_short(compiler->chunk, operand);
+}
+
+static void emit_op_short(Compiler* compiler,
+                          OpCode op,
+                          int operand,
+                          const char* overflow) {
+  emit_op(compiler, op);
+  emit_short(compiler, operand, overflow);
+}
+
+static void emit_op_name(Compiler* compiler, OpCode op, Token* name, int slot) {
+  emit_op_short(compiler, op, add_name(compiler->chunk, name, slot),
+                TOO_MANY_NAMES);
+}
+
+// a forward jump whose offset is patched once its target is emitted
+static int emit_jump(Compiler* compiler, OpCode op) {
+  emit_op(compiler, op);
+  write_int(compiler->chunk, 0);
+  return compiler->chunk->count - 4;
+}
+
+static void patch_jump(Compiler* compiler, int at) {
+  uint32_t offset = compiler->chunk->count - at - 4;
+  memcpy(compiler->chunk->code + at, &offset, sizeof(offset));
+}
+
+static void emit_loop(Compiler* compiler, int start) {
+  emit_op(compiler, OP_LOOP);
+  write_int(compiler->chunk, compiler->chunk->count - start + 4);
+}
+
+// Read or write a variable the resolver found `depth` frames up, or a
+// global when the depth is -1.
+static void emit_variable(Compiler* compiler,
+                          OpCode global_op,
+                          OpCode local_op,
+                          OpCode upper_op,
+                          Token* name,
+                          int depth,
+                          int slot) {
+  if (depth < 0) {
+    emit_op_name(compiler, global_op, name, slot);
+  } else if (depth == 0) {
+    emit_op_short(compiler, local_op, slot, TOO_MANY_LOCALS);
+  } else {
+    emit_op_short(compiler, upper_op, depth, TOO_MANY_SCOPES);
+    emit_short(compiler, slot, TOO_MANY_LOCALS);
+  }
+}
+
+// bind the value on top of the stack to a declared name
+static void emit_define(Compiler* compiler, Token* name) {
+  if (compiler->top_level && compiler->num_scopes == 0) {
+    emit_op_name(compiler, OP_DEFINE_GLOBAL, name, -1);
+  } else {
+    emit_op(compiler, OP_DEFINE_LOCAL);
+  }
+}
+
+static void compile_block(Compiler* compiler, StatementBlock* block) {
+  // the resolver gave no scope to a block declaring nothing
+  if (block->num_slots == 0) {
+    compile_statements(compiler, block->stmts);
+    return;
+  }
+  emit_op_short(compiler, OP_PUSH_SCOPE, block->num_slots, TOO_MANY_LOCALS);
+  emit_byte(compiler, block->captured);
+  if (compiler->num_scopes == compiler->scope_capacity) {
+    compiler->scope_capacity =
+        compiler->scope_capacity < 16 ? 16 : compiler->scope_capacity * 2;
+    compiler->scopes =
+        realloc(compiler->scopes, sizeof(bool) * compiler->scope_capacity);
+  }
+  compiler->scopes[compiler->num_scopes++] = block->captured;
+  compile_statements(compiler, block->stmts);
+  compiler->num_scopes--;
+  emit_op(compiler, OP_POP_SCOPE);
+  emit_byte(compiler, block->captured);
+}
+
+static void compile_return(Compiler* compiler, StatementReturn* stmt) {
+  compile_expr(compiler, stmt->value);
+  // a return outside of any function, which the resolver reported
+  if (compiler->top_level) {
+    emit_op(compiler, OP_POP);
+    return;
+  }
+  for (int i = compiler->num_scopes - 1; i >= 0; i--) {
+    emit_op(compiler, OP_POP_SCOPE);
+    emit_byte(compiler, compiler->scopes[i]);
+  }
+  emit_op(compiler, OP_RETURN);
+}
+
+static void compile_statement(Compiler* compiler, Statement* stmt) {
+  switch (stmt->type) {
+    case STATEMENT_EXPRESSION:
+      compile_expr(compiler, stmt->as.expr.expr);
+      emit_op(compiler, OP_POP);
+      break;
+    case STATEMENT_PRINT:
+      compile_expr(compiler, stmt->as.print.expr);
+      emit_op(compiler, OP_PRINT);
+      break;
+    case STATEMENT_VAR:
+      // a parse error, which the resolver skipped too
+      if (stmt->as.var.name == NULL)
+        break;
+      compile_expr(compiler, stmt->as.var.initializer);
+      emit_define(compiler, stmt->as.var.name);
+      break;
+    case STATEMENT_BLOCK:
+      compile_block(compiler, &stmt->as.block);
+      break;
+    case STATEMENT_IF: {
+      compile_expr(compiler, stmt->as.if_stmt.condition);
+      int skip_then = emit_jump(compiler, OP_JUMP_IF_FALSE);
+      compile_statement(compiler, stmt->as.if_stmt.then_branch);
+      if (stmt->as.if_stmt.else_branch != NULL) {
+        int skip_else = emit_jump(compiler, OP_JUMP);
+        patch_jump(compiler, skip_then);
+        compile_statement(compiler, stmt->as.if_stmt.else_branch);
+        patch_jump(compiler, skip_else);
+      } else {
+        patch_jump(compiler, skip_then);
+      }
+      break;
+    }
+    case STATEMENT_WHILE: {
+      int start = compiler->chunk->count;
+      compile_expr(compiler, stmt->as.while_stmt.condition);
+      int exit = emit_jump(compiler, OP_JUMP_IF_FALSE);
+      compile_statement(compiler, stmt->as.while_stmt.body);
+      emit_loop(compiler, start);
+      patch_jump(compiler, exit);
+      break;
+    }
+    case STATEMENT_FUNCTION:
+      emit_op_short(compiler, OP_CLOSURE,
+                    add_declaration(compiler->chunk, stmt),
+                    TOO_MANY_DECLARATIONS);
+      emit_define(compiler, stmt->as.function.name);
+      break;
+    case STATEMENT_CLASS:
+      if (stmt->as.class.superclass != NULL) {
+        compile_expr(compiler, stmt->as.class.superclass);
+      } else {
+        emit_op(compiler, OP_NIL);
+      }
+      emit_op_short(compiler, OP_CLASS, add_declaration(compiler->chunk, stmt),
+                    TOO_MANY_DECLARATIONS);
+      emit_define(compiler, stmt->as.class.name);
+      break;
+    case STATEMENT_RETURN:
+      compile_return(compiler, &stmt->as.return_stmt);
+      break;
+    default:
+      break;
+  }
+}
+
+static void compile_statements(Compiler* compiler, Statement** stmts) {
+  for (int i = 0; stmts[i] != NULL; i++) {
+    compile_statement(compiler, stmts[i]);
+  }
+}
+
+static OpCode binary_op(TokenType op) {
+  switch (op) {
+    case BANG_EQUAL:
+      return OP_NOT_EQUAL;
+    case EQUAL_EQUAL:
+      return OP_EQUAL;
+    case GREATER:
+      return OP_GREATER;
+    case GREATER_EQUAL:
+      return OP_GREATER_EQUAL;
+    case LESS:
+      return OP_LESS;
+    case LESS_EQUAL:
+      return OP_LESS_EQUAL;
+    case MINUS:
+      return OP_SUBTRACT;
+    case PLUS:
+      return OP_ADD;
+    case SLASH:
+      return OP_DIVIDE;
+    default:
+      return OP_MULTIPLY;
+  }
+}
+
+static void compile_literal(Compiler* compiler, Expr* expr) {
+  switch (expr->as.literal.type) {
+    case TRUE:
+      emit_op(compiler, OP_TRUE);
+      break;
+    case FALSE:
+      emit_op(compiler, OP_FALSE);
+      break;
+    case NUMBER:
+    case STRING:
+      emit_op_short(compiler, OP_CONSTANT,
+                    add_constant(compiler->chunk, expr->as.literal.constant,
+                                 eval_literal(expr)),
+                    TOO_MANY_CONSTANTS);
+      break;
+    default:
+      emit_op(compiler, OP_NIL);
+      break;
+  }
+}
+
+// obj.method(...) is a single instruction, which runs the method without
+// binding it to obj first
+static void compile_call(Compiler* compiler, ExprCall* call) {
+  Expr** args = call->arguments;
+  int num_args = 0;
+  while (args[num_args] != NULL) {
+    num_args++;
+  }
+  if (call->callee->type == E_Get) {
+    compile_expr(compiler, call->callee->as.get.object);
+  } else {
+    compile_expr(compiler, call->callee);
+  }
+  for (int i = 0; i < num_args; i++) {
+    compile_expr(compiler, args[i]);
+  }
+  // the arity is checked when the call runs, as the tree walker does
+  if (num_args > MAX_OPERAND) {
+    compile_error(compiler, "Too many arguments.");
+  }
+  if (call->callee->type == E_Get) {
+    Token* name = call->callee->as.get.name;
+    emit_op_name(compiler, OP_INVOKE, name, -1);
+  } else {
+    emit_op(compiler, OP_CALL);
+  }
+  write_short(compiler->chunk, num_args);
+  adjust_stack(compiler, -num_args);
+}
+
+static void compile_expr(Compiler* compiler, Expr* expr) {
+  // a missing initializer or return value, or a parse error
+  if (expr == NULL) {
+    emit_op(compiler, OP_NIL);
+    return;
+  }
+  switch (expr->type) {
+    case E_Literal:
+      compile_literal(compiler, expr);
+      break;
+    case E_Grouping:
+      compile_expr(compiler, expr->as.grouping.expression);
+      break;
+    // nodes the tree walker specialized compile like their generic kind
+    case E_NegateNumber:
+    case E_Not:
+    case E_Unary:
+      compile_expr(compiler, expr->as.unary.right);
+      emit_op(compiler, expr->as.unary.op->type == MINUS ? OP_NEGATE : OP_NOT);
+      break;
+    case E_AddNumbers:
+    case E_SubtractNumbers:
+    case E_MultiplyNumbers:
+    case E_DivideNumbers:
+    case E_LessNumbers:
+    case E_LessEqualNumbers:
+    case E_GreaterNumbers:
+    case E_GreaterEqualNumbers:
+    case E_EqualNumbers:
+    case E_NotEqualNumbers:
+    case E_Binary:
+      compile_expr(compiler, expr->as.binary.left);
+      compile_expr(compiler, expr->as.binary.right);
+      emit_op(compiler, binary_op(expr->as.binary.op->type));
+      break;
+    case E_Logical: {
+      compile_expr(compiler, expr->as.logical.left);
+      int end = emit_jump(compiler,
+                          expr->as.logical.op->type == OR ? OP_OR : OP_AND);
+      compile_expr(compiler, expr->as.logical.right);
+      patch_jump(compiler, end);
+      break;
+    }
+    case E_Variable: {
+      ExprVariable* variable = &expr->as.variable;
+      emit_variable(compiler, OP_GET_GLOBAL, OP_GET_LOCAL, OP_GET_UPPER,
+                    variable->name, variable->depth, variable->slot);
+      break;
+    }
+    case E_Assign: {
+      ExprAssign* assign = &expr->as.assign;
+      compile_expr(compiler, assign->value);
+      emit_variable(compiler, OP_SET_GLOBAL, OP_SET_LOCAL, OP_SET_UPPER,
+                    assign->name, assign->depth, assign->slot);
+      break;
+    }
+    case E_Call:
+      compile_call(compiler, &expr->as.call);
+      break;
+    case E_Get:
+      compile_expr(compiler, expr->as.get.object);
+      emit_op_name(compiler, OP_GET_PROPERTY, expr->as.get.name, -1);
+      break;
+    case E_Set: {
+      // the value is not evaluated when the object has no fields
+      compile_expr(compiler, expr->as.set.object);
+      int skip = emit_jump(compiler, OP_CHECK_FIELDS);
+      compile_expr(compiler, expr->as.set.value);
+      emit_op_name(compiler, OP_SET_PROPERTY, expr->as.set.name, -1);
+      patch_jump(compiler, skip);
+      break;
+    }
+    case E_This: {
+      // 'this' is slot 0 of its scope, a global outside of a class, which
+      // the resolver reported
+      int depth = expr->as.this.depth;
+      emit_variable(compiler, OP_GET_GLOBAL, OP_GET_LOCAL, OP_GET_UPPER,
+                    expr->as.this.keyword, depth, depth < 0 ? -1 : 0);
+      break;
+    }
+    case E_Super: {
+      ExprSuper* super = &expr->as.super;
+      // outside of a subclass, which the resolver reported
+      if (super->depth < 0) {
+        emit_op_name(compiler, OP_GET_GLOBAL, super->keyword, -1);
+        break;
+      }
+      emit_op_short(compiler, OP_GET_SUPER, super->depth, TOO_MANY_SCOPES);
+      emit_short(compiler, add_name(compiler->chunk, super->method, -1),
+                 TOO_MANY_NAMES);
+      break;
+    }
+  }
+}
+
+Chunk* compile_program(Statement** statements) {
+  Compiler compiler;
+  init_compiler(&compiler, true);
+  compile_statements(&compiler, statements);
+  return finish_compiler(&compiler);
+}
+
+Chunk* compile_function(StatementFunction* declaration) {
+  Compiler compiler;
+  init_compiler(&compiler, false);
+  while (declaration->params[compiler.chunk->arity] != NULL) {
+    compiler.chunk->arity++;
+  }
+  compile_statements(&compiler, declaration->body->as.block.stmts);
+  return finish_compiler(&compiler);
+}
@@ -0,0 +1,71 @@
+#include "include/constant.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// buckets to start with, the tables grow with the pool
+#define CONSTANT_TABLE_SIZE 1024
+
+static int push_constant(ConstantPool* pool, Constant constant);
+
+ConstantPool* new_constant_pool() {
+  ConstantPool* pool = calloc(1, sizeof(ConstantPool));
+  pool->strings = hash_table_create(CONSTANT_TABLE_SIZE, NULL);
+  pool->numbers = hash_table_create(CONSTANT_TABLE_SIZE, NULL);
+  return pool;
+}
+
+void free_constant_pool(ConstantPool* pool) {
+  for (int i = 0; i < pool->count; i++) {
+    free(pool->constants[i].string);
+  }
+  free(pool->constants);
+  hash_table_destroy(pool->strings);
+  hash_table_destroy(pool->numbers);
+  free(pool);
+}
+
+int add_number_constant(ConstantPool* pool, double number) {
+  // the table compares keys as strings, so the bits are spelled out in hex
+  uint64_t bits;
+  memcpy(&bits, &number, sizeof(bits));
+  char key[17];
+  snprintf(key, sizeof(key), "%016llx", (unsigned long long)bits);
+
+  intptr_t found = (intptr_t)hash_table_lookup_n(pool->numbers, key, 16);
+  if (found != 0)
+    return (int)found - 1;
+  Constant constant = {C_NUMBER, number, NULL};
+  int index = push_constant(pool, constant);
+  hash_table_insert_n(pool->numbers, key, 16, (void*)(intptr_t)(index + 1));
+  return index;
+}
+
+int add_string_constant(ConstantPool* pool, const char* start, int length) {
+  intptr_t found = (intptr_t)hash_table_lookup_n(pool->strings, start, length);
+  if (found != 0)
+    return (int)found - 1;
+  char* string = malloc(length + 1);
+  memcpy(string, start, length);
+  string[length] = '\0';
+  Constant constant = {C_STRING, 0, string};
+  int index = push_constant(pool, constant);
+  hash_table_insert_n(pool->strings, start, length,
+                      (void*)(intptr_t)(index + 1));
+  return index;
+}
+
+static int push_constant(ConstantPool* pool, Constant constant) {
+  if (pool->count == pool->capacity) {
+    pool->capacity = pool->capacity < 64 ? 64 : pool->capacity * 2;
+    pool->constants =
+        realloc(pool->constants, sizeof(Constant) * pool->capacity);
+    if (pool->constants == NULL) {
+      fprintf(stderr, "Memory allocation failed.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  pool->constants[pool->count] = constant;
+  return pool->count++;
+}
@@ -0,0 +1,838 @@
+#include "include/flat_ast.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FLAT_MAGIC 0x54414c46  // "FLAT"
+#define FLAT_VERSION 5
+#define FLAT_HEADER_WORDS 8
+
+// what each operand of a node kind holds, checked when an image is read
+enum OperandRole {
+  R_NONE,
+  R_EXPR,
+  R_STMT,
+  R_TOKEN,
+  R_EXPRS,
+  R_STMTS,
+  R_TOKENS,
+  R_INT,
+};
+
+typedef struct KindInfo {
+  bool valid;
+  uint8_t roles[3];
+} KindInfo;
+
+static const KindInfo kind_info[FLAT_STATEMENT + STATEMENT_DEFERRED + 1] = {
+    [E_Binary] = {true, {R_EXPR, R_TOKEN, R_EXPR}},
+    [E_Call] = {true, {R_EXPR, R_TOKEN, R_EXPRS}},
+    [E_Unary] = {true, {R_TOKEN, R_EXPR, R_NONE}},
+    [E_Grouping] = {true, {R_EXPR, R_NONE, R_NONE}},
+    [E_Literal] = {true, {R_INT, R_INT, R_NONE}},
+    [E_Variable] = {true, {R_TOKEN, R_INT, R_INT}},
+    [E_Assign] = {true, {R_TOKEN, R_EXPR, R_INT}},
+    [E_Logical] = {true, {R_EXPR, R_TOKEN, R_EXPR}},
+    [E_Get] = {true, {R_EXPR, R_TOKEN, R_NONE}},
+    [E_Set] = {true, {R_EXPR, R_TOKEN, R_EXPR}},
+    [E_This] = {true, {R_TOKEN, R_INT, R_NONE}},
+    [E_Super] = {true, {R_TOKEN, R_TOKEN, R_INT}},
+    [FLAT_STATEMENT + STATEMENT_EXPRESSION] = {true, {R_EXPR, R_NONE, R_NONE}},
+    [FLAT_STATEMENT + STATEMENT_PRINT] = {true, {R_EXPR, R_NONE, R_NONE}},
+    [FLAT_STATEMENT + STATEMENT_VAR] = {true, {R_TOKEN, R_EXPR, R_NONE}},
+    [FLAT_STATEMENT + STATEMENT_BLOCK] = {true, {R_STMTS, R_INT, R_INT}},
+    [FLAT_STATEMENT + STATEMENT_IF] = {true, {R_EXPR, R_STMT, R_STMT}},
+    [FLAT_STATEMENT + STATEMENT_WHILE] = {true, {R_EXPR, R_STMT, R_NONE}},
+    [FLAT_STATEMENT + STATEMENT_FUNCTION] = {true, {R_TOKEN, R_TOKENS, R_STMT}},
+    [FLAT_STATEMENT + STATEMENT_RETURN] = {true, {R_TOKEN, R_EXPR, R_NONE}},
+    [FLAT_STATEMENT + STATEMENT_CLASS] = {true, {R_TOKEN, R_STMTS, R_EXPR}},
+    [FLAT_STATEMENT + STATEMENT_DEFERRED] = {true, {R_INT, R_INT, R_INT}},
+};
+
+#define NUM_KINDS (sizeof(kind_info) / sizeof(kind_info[0]))
+
+// An assignment has one operand for both its depth and slot: the depth plus
+// one in the high half, so a global is 0, and the slot in the low half. The
+// resolver keeps slots below MAX_SLOTS, nesting keeps depths far below it.
+#define PACK_LOCAL(depth, slot) \
+  ((uint32_t)((depth) + 1) << 16 | (uint32_t)(slot))
+#define UNPACK_DEPTH(packed) ((int)((packed) >> 16) - 1)
+#define UNPACK_SLOT(packed) ((int)((packed)&0xffff))
+
+// The slot of a global depends on the names the process interned before it,
+// so it is not stored and is interned again on first use.
+#define STORED_SLOT(depth, slot) ((depth) < 0 ? 0 : (slot))
+#define LOADED_SLOT(depth, slot) ((depth) < 0 ? -1 : (int)(slot))
+
+static FlatAst* new_flat_ast() {
+  FlatAst* ast = calloc(1, sizeof(FlatAst));
+  return ast;
+}
+
+// grow `*array` of `size`-byte items to hold `needed` items
+static void* grow(void* array, uint32_t* capacity, uint32_t needed,
+                  size_t size) {
+  if (needed <= *capacity)
+    return array;
+  uint32_t new_capacity = *capacity < 64 ? 64 : *capacity;
+  while (new_capacity < needed) {
+    new_capacity *= 2;
+  }
+  array = realloc(array, new_capacity * size);
+  if (array == NULL) {
+    fprintf(stderr, "Memory allocation failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  *capacity = new_capacity;
+  return array;
+}
+
+static void reserve_nodes(FlatAst* ast, uint32_t needed) {
+  uint32_t capacity = ast->node_capacity;
+  ast->kinds = grow(ast->kinds, &capacity, needed, sizeof(uint8_t));
+  capacity = ast->node_capacity;
+  ast->a = grow(ast->a, &capacity, needed, sizeof(uint32_t));
+  capacity = ast->node_capacity;
+  ast->b = grow(ast->b, &capacity, needed, sizeof(uint32_t));
+  capacity = ast->node_capacity;
+  ast->c = grow(ast->c, &capacity, needed, sizeof(uint32_t));
+  ast->node_capacity = capacity;
+}
+
+static void reserve_tokens(FlatAst* ast, uint32_t needed) {
+  uint32_t capacity = ast->token_capacity;
+  ast->token_types = grow(ast->token_types, &capacity, needed, sizeof(uint8_t));
+  capacity = ast->token_capacity;
+  ast->token_starts =
+      grow(ast->token_starts, &capacity, needed, sizeof(uint32_t));
+  capacity = ast->token_capacity;
+  ast->token_lengths =
+      grow(ast->token_lengths, &capacity, needed, sizeof(uint32_t));
+  capacity = ast->token_capacity;
+  ast->token_lines = grow(ast->token_lines, &capacity, needed, sizeof(uint32_t));
+  ast->token_capacity = capacity;
+}
+
+static NodeId add_node(FlatAst* ast,
+                       int kind,
+                       uint32_t a,
+                       uint32_t b,
+                       uint32_t c) {
+  reserve_nodes(ast, ast->num_nodes + 1);
+  NodeId id = ast->num_nodes++;
+  ast->kinds[id] = kind;
+  ast->a[id] = a;
+  ast->b[id] = b;
+  ast->c[id] = c;
+  return id;
+}
+
+static uint32_t add_token(FlatAst* ast, Token* token, const char* source) {
+  if (token == NULL)
+    return 0;
+  reserve_tokens(ast, ast->num_tokens + 1);
+  uint32_t id = ast->num_tokens++;
+  ast->token_types[id] = token->type;
+  ast->token_starts[id] = token->start - source;
+  ast->token_lengths[id] = token->length;
+  ast->token_lines[id] = token->line;
+  return id;
+}
+
+// append a list, its items are already flattened
+static uint32_t add_list(FlatAst* ast, uint32_t* items, uint32_t count) {
+  ast->lists = grow(ast->lists, &ast->list_capacity,
+                    ast->num_list_items + count + 1, sizeof(uint32_t));
+  uint32_t offset = ast->num_list_items;
+  ast->lists[offset] = count;
+  memcpy(ast->lists + offset + 1, items, count * sizeof(uint32_t));
+  ast->num_list_items += count + 1;
+  return offset;
+}
+
+static NodeId flatten_expr(FlatAst* ast, Expr* expr, const char* source);
+
+static NodeId flatten_stmt(FlatAst* ast, Statement* stmt, const char* source);
+
+static uint32_t flatten_exprs(FlatAst* ast, Expr** exprs, const char* source) {
+  uint32_t count = 0;
+  while (exprs[count] != NULL) {
+    count++;
+  }
+  uint32_t* items = malloc(sizeof(uint32_t) * (count + 1));
+  for (uint32_t i = 0; i < count; i++) {
+    items[i] = flatten_expr(ast, exprs[i], source);
+  }
+  uint32_t offset = add_list(ast, items, count);
+  free(items);
+  return offset;
+}
+
+static uint32_t flatten_stmts(FlatAst* ast,
+                              Statement** stmts,
+                              const char* source) {
+  uint32_t count = 0;
+  while (stmts[count] != NULL) {
+    count++;
+  }
+  uint32_t* items = malloc(sizeof(uint32_t) * (count + 1));
+  for (uint32_t i = 0; i < count; i++) {
+    items[i] = flatten_stmt(ast, stmts[i], source);
+  }
+  uint32_t offset = add_list(ast, items, count);
+  free(items);
+  return offset;
+}
+
+static uint32_t flatten_tokens(FlatAst* ast,
+                               Token** tokens,
+                               const char* source) {
+  uint32_t count = 0;
+  while (tokens[count] != NULL) {
+    count++;
+  }
+  uint32_t* items = malloc(sizeof(uint32_t) * (count + 1));
+  for (uint32_t i = 0; i < count; i++) {
+    items[i] = add_token(ast, tokens[i], source);
+  }
+  uint32_t offset = add_list(ast, items, count);
+  free(items);
+  return offset;
+}
+
+static NodeId flatten_expr(FlatAst* ast, Expr* expr, const char* source) {
+  if (expr == NULL)
+    return 0;
+  uint32_t a = 0, b = 0, c = 0;
+  switch (expr->type) {
+    case E_Binary:
+      a = flatten_expr(ast, expr->as.binary.left, source);
+      b = add_token(ast, expr->as.binary.op, source);
+      c = flatten_expr(ast, expr->as.binary.right, source);
+      break;
+    case E_Logical:
+      a = flatten_expr(ast, expr->as.logical.left, source);
+      b = add_token(ast, expr->as.logical.op, source);
+      c = flatten_expr(ast, expr->as.logical.right, source);
+      break;
+    case E_Call:
+      a = flatten_expr(ast, expr->as.call.callee, source);
+      b = add_token(ast, expr->as.call.paren, source);
+      c = flatten_exprs(ast, expr->as.call.arguments, source);
+      break;
+    case E_Unary:
+      a = add_token(ast, expr->as.unary.op, source);
+      b = flatten_expr(ast, expr->as.unary.right, source);
+      break;
+    case E_Grouping:
+      a = flatten_expr(ast, expr->as.grouping.expression, source);
+      break;
+    case E_Literal:
+      a = expr->as.literal.type;
+      b = (uint32_t)expr->as.literal.constant;
+      if (expr->as.literal.constant >= (int)ast->num_constants)
+        ast->num_constants = expr->as.literal.constant + 1;
+      break;
+    case E_Variable:
+      a = add_token(ast, expr->as.variable.name, source);
+      b = (uint32_t)expr->as.variable.depth;
+      c = STORED_SLOT(expr->as.variable.depth, expr->as.variable.slot);
+      break;
+    case E_Assign:
+      a = add_token(ast, expr->as.assign.name, source);
+      b = flatten_expr(ast, expr->as.assign.value, source);
+      c = PACK_LOCAL(expr->as.assign.depth,
+                     STORED_SLOT(expr->as.assign.depth, expr->as.assign.slot));
+      break;
+    case E_Get:
+      a = flatten_expr(ast, expr->as.get.object, source);
+      b = add_token(ast, expr->as.get.name, source);
+      break;
+    case E_Set:
+      a = flatten_expr(ast, expr->as.set.object, source);
+      b = add_token(ast, expr->as.set.name, source);
+      c = flatten_expr(ast, expr->as.set.value, source);
+      break;
+    case E_This:
+      a = add_token(ast, expr->as.this.keyword, source);
+      b = (uint32_t)expr->as.this.depth;
+      break;
+    case E_Super:
+      a = add_token(ast, expr->as.super.keyword, source);
+      b = add_token(ast, expr->as.super.method, source);
+      c = (uint32_t)expr->as.super.depth;
+      break;
+    default:
+      // specialized kinds only appear as a program runs, after flattening
+      break;
+  }
+  return add_node(ast, expr->type, a, b, c);
+}
+
+static NodeId flatten_stmt(FlatAst* ast, Statement* stmt, const char* source) {
+  if (stmt == NULL)
+    return 0;
+  uint32_t a = 0, b = 0, c = 0;
+  switch (stmt->type) {
+    case STATEMENT_EXPRESSION:
+      a = flatten_expr(ast, stmt->as.expr.expr, source);
+      break;
+    case STATEMENT_PRINT:
+      a = flatten_expr(ast, stmt->as.print.expr, source);
+      break;
+    case STATEMENT_VAR:
+      a = add_token(ast, stmt->as.var.name, source);
+      b = flatten_expr(ast, stmt->as.var.initializer, source);
+      break;
+    case STATEMENT_BLOCK:
+      a = flatten_stmts(ast, stmt->as.block.stmts, source);
+      b = stmt->as.block.num_slots;
+      c = stmt->as.block.captured;
+      break;
+    case STATEMENT_IF:
+      a = flatten_expr(ast, stmt->as.if_stmt.condition, source);
+      b = flatten_stmt(ast, stmt->as.if_stmt.then_branch, source);
+      c = flatten_stmt(ast, stmt->as.if_stmt.else_branch, source);
+      break;
+    case STATEMENT_WHILE:
+      a = flatten_expr(ast, stmt->as.while_stmt.condition, source);
+      b = flatten_stmt(ast, stmt->as.while_stmt.body, source);
+      break;
+    case STATEMENT_FUNCTION:
+      a = add_token(ast, stmt->as.function.name, source);
+      b = flatten_tokens(ast, stmt->as.function.params, source);
+      c = flatten_stmt(ast, stmt->as.function.body, source);
+      break;
+    case STATEMENT_RETURN:
+      a = add_token(ast, stmt->as.return_stmt.keyword, source);
+      b = flatten_expr(ast, stmt->as.return_stmt.value, source);
+      break;
+    case STATEMENT_CLASS:
+      a = add_token(ast, stmt->as.class.name, source);
+      b = flatten_stmts(ast, stmt->as.class.methods, source);
+      c = flatten_expr(ast, stmt->as.class.superclass, source);
+      break;
+    case STATEMENT_DEFERRED:
+      // the body as a source range, its kind in the low bits of the line
+      a = stmt->as.deferred.start - source;
+      b = stmt->as.deferred.length;
+      c = (uint32_t)stmt->as.deferred.line << 2 | stmt->as.deferred.kind;
+      break;
+  }
+  return add_node(ast, FLAT_STATEMENT + stmt->type, a, b, c);
+}
+
+FlatAst* flatten_ast(Statement** program, const char* source, size_t length) {
+  FlatAst* ast = new_flat_ast();
+  ast->source_length = length;
+  // ID 0 of nodes and tokens is NULL
+  add_node(ast, 0, 0, 0, 0);
+  reserve_tokens(ast, 1);
+  ast->token_types[0] = 0;
+  ast->token_starts[0] = 0;
+  ast->token_lengths[0] = 0;
+  ast->token_lines[0] = 0;
+  ast->num_tokens = 1;
+  ast->root = flatten_stmts(ast, program, source);
+  return ast;
+}
+
+typedef struct Inflater {
+  FlatAst* ast;
+  Arena* arena;
+  const char* source;
+  const int* constants;
+} Inflater;
+
+static Expr* inflate_expr(Inflater* in, NodeId id);
+
+static Statement* inflate_stmt(Inflater* in, NodeId id);
+
+// an index into the image's constants, as an index into the pool
+static int inflate_constant(Inflater* in, uint32_t index) {
+  if (index == (uint32_t)-1 || in->constants == NULL)
+    return (int)index;
+  return in->constants[index];
+}
+
+static Token* inflate_token(Inflater* in, uint32_t id) {
+  if (id == 0)
+    return NULL;
+  FlatAst* ast = in->ast;
+  Token* token = arena_new(in->arena, Token);
+  token->type = ast->token_types[id];
+  token->start = in->source + ast->token_starts[id];
+  token->length = ast->token_lengths[id];
+  token->line = ast->token_lines[id];
+  token->number = 0;
+  return token;
+}
+
+// a NULL-terminated array of the list's items, `role` says what they are
+static void** inflate_list(Inflater* in, uint32_t offset, int role) {
+  uint32_t count = in->ast->lists[offset];
+  uint32_t* ids = in->ast->lists + offset + 1;
+  void** items = arena_alloc(in->arena, sizeof(void*) * (count + 1));
+  for (uint32_t i = 0; i < count; i++) {
+    if (role == R_EXPRS)
+      items[i] = inflate_expr(in, ids[i]);
+    else if (role == R_STMTS)
+      items[i] = inflate_stmt(in, ids[i]);
+    else
+      items[i] = inflate_token(in, ids[i]);
+  }
+  items[count] = NULL;
+  return items;
+}
+
+static Expr* inflate_expr(Inflater* in, NodeId id) {
+  if (id == 0)
+    return NULL;
+  FlatAst* ast = in->ast;
+  uint32_t a = ast->a[id], b = ast->b[id], c = ast->c[id];
+  Expr* expr = arena_new(in->arena, Expr);
+  expr->type = ast->kinds[id];
+  switch (expr->type) {
+    case E_Binary:
+      expr->as.binary.left = inflate_expr(in, a);
+      expr->as.binary.op = inflate_token(in, b);
+      expr->as.binary.right = inflate_expr(in, c);
+      break;
+    case E_Logical:
+      expr->as.logical.left = inflate_expr(in, a);
+      expr->as.logical.op = inflate_token(in, b);
+      expr->as.logical.right = inflate_expr(in, c);
+      break;
+    case E_Call:
+      expr->as.call.callee = inflate_expr(in, a);
+      expr->as.call.paren = inflate_token(in, b);
+      expr->as.call.arguments = (Expr**)inflate_list(in, c, R_EXPRS);
+      break;
+    case E_Unary:
+      expr->as.unary.op = inflate_token(in, a);
+      expr->as.unary.right = inflate_expr(in, b);
+      break;
+    case E_Grouping:
+      expr->as.grouping.expression = inflate_expr(in, a);
+      break;
+    case E_Literal:
+      expr->as.literal.type = a;
+      expr->as.literal.constant = inflate_constant(in, b);
+      expr->as.literal.value = EMPTY_VAL;
+      break;
+    case E_Variable:
+      expr->as.variable.name = inflate_token(in, a);
+      expr->as.variable.depth = (int)b;
+      expr->as.variable.slot = LOADED_SLOT(expr->as.variable.depth, c);
+      break;
+    case E_Assign:
+      expr->as.assign.name = inflate_token(in, a);
+      expr->as.assign.value = inflate_expr(in, b);
+      expr->as.assign.depth = UNPACK_DEPTH(c);
+      expr->as.assign.slot =
+          LOADED_SLOT(expr->as.assign.depth, UNPACK_SLOT(c));
+      break;
+    case E_Get:
+      expr->as.get.object = inflate_expr(in, a);
+      expr->as.get.name = inflate_token(in, b);
+      break;
+    case E_Set:
+      expr->as.set.object = inflate_expr(in, a);
+      expr->as.set.name = inflate_token(in, b);
+      expr->as.set.value = inflate_expr(in, c);
+      break;
+    case E_This:
+      expr->as.this.keyword = inflate_token(in, a);
+      expr->as.this.depth = (int)b;
+      break;
+    case E_Super:
+      expr->as.super.keyword = inflate_token(in, a);
+      expr->as.super.method = inflate_token(in, b);
+      expr->as.super.depth = (int)c;
+      break;
+    default:
+      // the specialized kinds are not valid in an image
+      break;
+  }
+  return expr;
+}
+
+static Statement* inflate_stmt(Inflater* in, NodeId id) {
+  if (id == 0)
+    return NULL;
+  FlatAst* ast = in->ast;
+  uint32_t a = ast->a[id], b = ast->b[id], c = ast->c[id];
+  Statement* stmt = arena_new(in->arena, Statement);
+  stmt->type = ast->kinds[id] - FLAT_STATEMENT;
+  switch (stmt->type) {
+    case STATEMENT_EXPRESSION:
+      stmt->as.expr.expr = inflate_expr(in, a);
+      break;
+    case STATEMENT_PRINT:
+      stmt->as.print.expr = inflate_expr(in, a);
+      break;
+    case STATEMENT_VAR:
+      stmt->as.var.name = inflate_token(in, a);
+      stmt->as.var.initializer = inflate_expr(in, b);
+      break;
+    case STATEMENT_BLOCK:
+      stmt->as.block.stmts = (Statement**)inflate_list(in, a, R_STMTS);
+      stmt->as.block.num_slots = (int)b;
+      stmt->as.block.captured = c != 0;
+      stmt->as.block.chunk = NULL;
+      break;
+    case STATEMENT_IF:
+      stmt->as.if_stmt.condition = inflate_expr(in, a);
+      stmt->as.if_stmt.then_branch = inflate_stmt(in, b);
+      stmt->as.if_stmt.else_branch = inflate_stmt(in, c);
+      break;
+    case STATEMENT_WHILE:
+      stmt->as.while_stmt.condition = inflate_expr(in, a);
+      stmt->as.while_stmt.body = inflate_stmt(in, b);
+      break;
+    case STATEMENT_FUNCTION:
+      stmt->as.function.name = inflate_token(in, a);
+      stmt->as.function.params = (Token**)inflate_list(in, b, R_TOKENS);
+      stmt->as.function.body = inflate_stmt(in, c);
+      break;
+    case STATEMENT_RETURN:
+      stmt->as.return_stmt.keyword = inflate_token(in, a);
+      stmt->as.return_stmt.value = inflate_expr(in, b);
+      break;
+    case STATEMENT_CLASS:
+      stmt->as.class.name = inflate_token(in, a);
+      stmt->as.class.methods = (Statement**)inflate_list(in, b, R_STMTS);
+      stmt->as.class.superclass = inflate_expr(in, c);
+      break;
+    case STATEMENT_DEFERRED:
+      stmt->as.deferred.start = in->source + a;
+      stmt->as.deferred.length = b;
+      stmt->as.deferred.line = c >> 2;
+      stmt->as.deferred.kind = c & 3;
+      break;
+  }
+  return stmt;
+}
+
+Statement** inflate_ast(FlatAst* ast,
+                        Arena* arena,
+                        const char* source,
+                        const int* constants) {
+  Inflater in = {ast, arena, source, constants};
+  return (Statement**)inflate_list(&in, ast->root, R_STMTS);
+}
+
+void free_flat_ast(FlatAst* ast) {
+  if (ast->mapped) {
+    free(ast);
+    return;
+  }
+  free(ast->kinds);
+  free(ast->a);
+  free(ast->b);
+  free(ast->c);
+  free(ast->token_types);
+  free(ast->token_starts);
+  free(ast->token_lengths);
+  free(ast->token_lines);
+  free(ast->lists);
+  free(ast);
+}
+
+size_t flat_ast_size(FlatAst* ast) {
+  return ast->num_nodes * (sizeof(uint8_t) + 3 * sizeof(uint32_t)) +
+         ast->num_tokens * (sizeof(uint8_t) + 3 * sizeof(uint32_t)) +
+         ast->num_list_items * sizeof(uint32_t);
+}
+
+// The image is a header of FLAT_HEADER_WORDS words followed by the word
+// arrays and then the byte arrays, in host byte order. Every word array
+// starts 4-byte aligned if the image does, so a mapped image is used in
+// place.
+bool write_flat_ast(FlatAst* ast, FILE* file) {
+  uint32_t header[FLAT_HEADER_WORDS] = {
+      FLAT_MAGIC,          FLAT_VERSION,   ast->num_nodes,
+      ast->num_tokens,     ast->num_list_items, ast->root,
+      ast->source_length,  ast->num_constants};
+  uint32_t nodes = ast->num_nodes, tokens = ast->num_tokens;
+  return fwrite(header, sizeof(header), 1, file) == 1 &&
+         fwrite(ast->a, sizeof(uint32_t), nodes, file) == nodes &&
+         fwrite(ast->b, sizeof(uint32_t), nodes, file) == nodes &&
+         fwrite(ast->c, sizeof(uint32_t), nodes, file) == nodes &&
+         fwrite(ast->token_starts, sizeof(uint32_t), tokens, file) ==
+             tokens &&
+         fwrite(ast->token_lengths, sizeof(uint32_t), tokens, file) ==
+             tokens &&
+         fwrite(ast->token_lines, sizeof(uint32_t), tokens, file) ==
+             tokens &&
+         fwrite(ast->lists, sizeof(uint32_t), ast->num_list_items, file) ==
+             ast->num_list_items &&
+         fwrite(ast->kinds, sizeof(uint8_t), nodes, file) == nodes &&
+         fwrite(ast->token_types, sizeof(uint8_t), tokens, file) == tokens;
+}
+
+size_t flat_ast_image_size(FlatAst* ast) {
+  return FLAT_HEADER_WORDS * sizeof(uint32_t) +
+         ((size_t)ast->num_nodes * 3 + (size_t)ast->num_tokens * 3 +
+          ast->num_list_items) *
+             sizeof(uint32_t) +
+         ast->num_nodes + ast->num_tokens;
+}
+
+static bool valid_list(FlatAst* ast, uint32_t offset) {
+  return offset < ast->num_list_items &&
+         ast->lists[offset] < ast->num_list_items - offset;
+}
+
+// node `x` may be referenced as `role` from node `id`
+static bool valid_ref(FlatAst* ast, uint32_t x, int role, uint32_t id) {
+  switch (role) {
+    case R_TOKEN:
+    case R_TOKENS:
+      return x < ast->num_tokens;
+    case R_EXPR:
+    case R_EXPRS:
+      return x == 0 || (x < id && ast->kinds[x] < FLAT_STATEMENT);
+    case R_STMT:
+    case R_STMTS:
+      return x == 0 || (x < id && ast->kinds[x] >= FLAT_STATEMENT);
+    default:
+      return true;
+  }
+}
+
+// literals of the types the parser makes, constants within the image's
+static bool valid_literal(FlatAst* ast, uint32_t type, uint32_t constant) {
+  switch (type) {
+    case NUMBER:
+    case STRING:
+      return constant < ast->num_constants;
+    case TRUE:
+    case FALSE:
+    case NIL:
+      return constant == (uint32_t)-1;
+    default:
+      return false;
+  }
+}
+
+// a scope open where a node of an image runs, as the resolver opened it
+typedef struct OpenScope {
+  struct OpenScope* enclosing;
+  uint32_t num_slots;
+} OpenScope;
+
+static OpenScope open_scope(OpenScope* enclosing, uint32_t num_slots) {
+  return (OpenScope){enclosing, num_slots};
+}
+
+// a global, or a slot of a scope open around the node
+static bool valid_local(OpenScope* scope, uint32_t depth, uint32_t slot) {
+  if (depth == (uint32_t)-1)
+    return true;
+  for (uint32_t i = 0; i < depth && scope != NULL; i++)
+    scope = scope->enclosing;
+  return scope != NULL && slot < scope->num_slots;
+}
+
+static bool valid_scopes_stmt(FlatAst* ast, NodeId id, OpenScope* scope);
+
+static bool valid_scopes_expr(FlatAst* ast, NodeId id, OpenScope* scope) {
+  if (id == 0)
+    return true;
+  uint32_t a = ast->a[id], b = ast->b[id], c = ast->c[id];
+  switch (ast->kinds[id]) {
+    case E_Binary:
+    case E_Logical:
+      return valid_scopes_expr(ast, a, scope) &&
+             valid_scopes_expr(ast, c, scope);
+    case E_Call:
+      for (uint32_t j = 0; j < ast->lists[c]; j++) {
+        if (!valid_scopes_expr(ast, ast->lists[c + 1 + j], scope))
+          return false;
+      }
+      return valid_scopes_expr(ast, a, scope);
+    case E_Unary:
+      return valid_scopes_expr(ast, b, scope);
+    case E_Grouping:
+    case E_Get:
+      return valid_scopes_expr(ast, a, scope);
+    case E_Set:
+      return valid_scopes_expr(ast, a, scope) &&
+             valid_scopes_expr(ast, c, scope);
+    case E_Variable:
+      return valid_local(scope, b, c);
+    case E_This:
+      return valid_local(scope, b, 0);
+    case E_Assign:
+      return valid_local(scope, (uint32_t)UNPACK_DEPTH(c), UNPACK_SLOT(c)) &&
+             valid_scopes_expr(ast, b, scope);
+    case E_Super:
+      // 'this' is in the scope right inside the one of 'super'
+      return c == (uint32_t)-1 ||
+             (c >= 1 && valid_local(scope, c, 0) &&
+              valid_local(scope, c - 1, 0));
+    default:
+      return true;
+  }
+}
+
+static bool valid_scopes_stmts(FlatAst* ast,
+                               uint32_t offset,
+                               OpenScope* scope) {
+  for (uint32_t j = 0; j < ast->lists[offset]; j++) {
+    if (!valid_scopes_stmt(ast, ast->lists[offset + 1 + j], scope))
+      return false;
+  }
+  return true;
+}
+
+// The body of a function is a block, or one left to parse on the first
+// call. Its statements share one scope with the parameters, so it has a
+// slot for each of them.
+static bool valid_function(FlatAst* ast, NodeId id, OpenScope* scope) {
+  NodeId body = ast->c[id];
+  if (body == 0 || ast->kinds[id] != FLAT_STATEMENT + STATEMENT_FUNCTION)
+    return false;
+  if (ast->kinds[body] == FLAT_STATEMENT + STATEMENT_DEFERRED)
+    return true;
+  uint32_t num_slots = ast->b[body];
+  if (ast->kinds[body] != FLAT_STATEMENT + STATEMENT_BLOCK ||
+      num_slots > MAX_SLOTS || num_slots < ast->lists[ast->b[id]])
+    return false;
+  OpenScope inner = open_scope(scope, num_slots);
+  return valid_scopes_stmts(ast, ast->a[body], &inner);
+}
+
+static bool valid_scopes_stmt(FlatAst* ast, NodeId id, OpenScope* scope) {
+  if (id == 0)
+    return true;
+  uint32_t a = ast->a[id], b = ast->b[id], c = ast->c[id];
+  switch (ast->kinds[id] - FLAT_STATEMENT) {
+    case STATEMENT_EXPRESSION:
+    case STATEMENT_PRINT:
+      return valid_scopes_expr(ast, a, scope);
+    case STATEMENT_VAR:
+    case STATEMENT_RETURN:
+      return valid_scopes_expr(ast, b, scope);
+    case STATEMENT_BLOCK: {
+      // a block that declares nothing runs in the enclosing scope
+      if (b == 0)
+        return valid_scopes_stmts(ast, a, scope);
+      if (b > MAX_SLOTS)
+        return false;
+      OpenScope inner = open_scope(scope, b);
+      return valid_scopes_stmts(ast, a, &inner);
+    }
+    case STATEMENT_IF:
+      return valid_scopes_expr(ast, a, scope) &&
+             valid_scopes_stmt(ast, b, scope) &&
+             valid_scopes_stmt(ast, c, scope);
+    case STATEMENT_WHILE:
+      return valid_scopes_expr(ast, a, scope) &&
+             valid_scopes_stmt(ast, b, scope);
+    case STATEMENT_FUNCTION:
+      return valid_function(ast, id, scope);
+    case STATEMENT_CLASS: {
+      if (!valid_scopes_expr(ast, c, scope))
+        return false;
+      // methods see a scope of 'this', in a subclass inside one of 'super'
+      OpenScope super_scope = open_scope(scope, 1);
+      OpenScope this_scope = open_scope(c != 0 ? &super_scope : scope, 1);
+      for (uint32_t j = 0; j < ast->lists[b]; j++) {
+        if (!valid_function(ast, ast->lists[b + 1 + j], &this_scope))
+          return false;
+      }
+      return true;
+    }
+    default:
+      return true;
+  }
+}
+
+// Every ID must be in range and refer to the expected kind of thing, so a
+// corrupt image cannot make inflate_ast read out of bounds. Children are
+// flattened before their parents, so node IDs must also point backwards,
+// which rules out cycles. The depths and slots the resolver gave must name
+// slots of scopes open where their nodes run, and no scope may have more
+// than MAX_SLOTS, so the program cannot walk off the environments either.
+static bool validate(FlatAst* ast) {
+  if (ast->num_nodes == 0 || ast->num_tokens == 0 ||
+      !valid_list(ast, ast->root))
+    return false;
+  for (uint32_t t = 1; t < ast->num_tokens; t++) {
+    if (ast->token_starts[t] > ast->source_length ||
+        ast->token_lengths[t] > ast->source_length - ast->token_starts[t])
+      return false;
+  }
+  for (uint32_t id = 1; id < ast->num_nodes; id++) {
+    uint8_t kind = ast->kinds[id];
+    if (kind >= NUM_KINDS || !kind_info[kind].valid)
+      return false;
+    uint32_t operands[3] = {ast->a[id], ast->b[id], ast->c[id]};
+    if (kind == E_Literal && !valid_literal(ast, operands[0], operands[1]))
+      return false;
+    if (kind == FLAT_STATEMENT + STATEMENT_DEFERRED &&
+        (operands[0] > ast->source_length ||
+         operands[1] > ast->source_length - operands[0] ||
+         (operands[2] & 3) > DEFERRED_SUBCLASS_METHOD))
+      return false;
+    for (int i = 0; i < 3; i++) {
+      int role = kind_info[kind].roles[i];
+      uint32_t x = operands[i];
+      if (role == R_EXPRS || role == R_STMTS || role == R_TOKENS) {
+        if (!valid_list(ast, x))
+          return false;
+        for (uint32_t j = 0; j < ast->lists[x]; j++) {
+          uint32_t item = ast->lists[x + 1 + j];
+          if (item == 0 || !valid_ref(ast, item, role, id))
+            return false;
+        }
+      } else if (!valid_ref(ast, x, role, id)) {
+        return false;
+      }
+    }
+  }
+  for (uint32_t j = 0; j < ast->lists[ast->root]; j++) {
+    uint32_t item = ast->lists[ast->root + 1 + j];
+    if (item == 0 || !valid_ref(ast, item, R_STMTS, ast->num_nodes))
+      return false;
+  }
+  return valid_scopes_stmts(ast, ast->root, NULL);
+}
+
+FlatAst* map_flat_ast(const void* data, size_t size) {
+  const uint32_t* header = data;
+  if (size < FLAT_HEADER_WORDS * sizeof(uint32_t) ||
+      (uintptr_t)data % sizeof(uint32_t) != 0 || header[0] != FLAT_MAGIC ||
+      header[1] != FLAT_VERSION)
+    return NULL;
+  FlatAst* ast = new_flat_ast();
+  ast->mapped = true;
+  ast->num_nodes = ast->node_capacity = header[2];
+  ast->num_tokens = ast->token_capacity = header[3];
+  ast->num_list_items = ast->list_capacity = header[4];
+  ast->root = header[5];
+  ast->source_length = header[6];
+  ast->num_constants = header[7];
+  if (flat_ast_image_size(ast) > size) {
+    free(ast);
+    return NULL;
+  }
+
+  const uint32_t* words = header + FLAT_HEADER_WORDS;
+  uint32_t nodes = ast->num_nodes, tokens = ast->num_tokens;
+  ast->a = (uint32_t*)words;
+  ast->b = ast->a + nodes;
+  ast->c = ast->b + nodes;
+  ast->token_starts = ast->c + nodes;
+  ast->token_lengths = ast->token_starts + tokens;
+  ast->token_lines = ast->token_lengths + tokens;
+  ast->lists = ast->token_lines + tokens;
+  ast->kinds = (uint8_t*)(ast->lists + ast->num_list_items);
+  ast->token_types = ast->kinds + nodes;
+  if (!validate(ast)) {
+    free(ast);
+    return NULL;
+  }
+  return ast;
+}
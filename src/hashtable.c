@@ -10,33 +10,61 @@
 typedef struct entry {
   char* key;
   void* object;
+  // of the key, kept to move the entry when the table grows
+  uint64_t hash;
   struct entry* next;
 } entry;
 
 typedef struct _hash_table {
   uint32_t size;
+  // entries stored, the table doubles once there are more than buckets
+  uint32_t count;
   hashfunction* hash;
   entry** elements;
 } hash_table;
 
-static size_t hash_table_index(hash_table* ht, const char* key) {
-  size_t result = (ht->hash(key) % ht->size);
+static size_t hash_table_index(hash_table* ht, const char* key, size_t len) {
+  size_t result = (ht->hash(key, len) % ht->size);
   return result;
 }
 
-uint64_t djb2_hash(const char* str) {
+// double the buckets and move every entry to its new chain
+static void hash_table_grow(hash_table* ht) {
+  uint32_t size = ht->size * 2;
+  entry** elements = calloc(sizeof(entry*), size);
+  for (uint32_t i = 0; i < ht->size; i++) {
+    entry* e = ht->elements[i];
+    while (e != NULL) {
+      entry* next = e->next;
+      size_t index = e->hash % size;
+      e->next = elements[index];
+      elements[index] = e;
+      e = next;
+    }
+  }
+  free(ht->elements);
+  ht->elements = elements;
+  ht->size = size;
+}
+
+// compare a stored key with a slice that is not NUL-terminated
+static bool key_equals(const char* stored, const char* key, size_t len) {
+  return strncmp(stored, key, len) == 0 && stored[len] == '\0';
+}
+
+uint64_t djb2_hash(const char* str, size_t len) {
   // http://www.cse.yorku.ca/~oz/hash.html
   unsigned int hash = 5381;
-  int c;
-  while ((c = *str++)) {
-    hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+  for (size_t i = 0; i < len; i++) {
+    hash = ((hash << 5) + hash) + str[i]; /* hash * 33 + c */
   }
   return hash;
 }
 
 hash_table* hash_table_create(uint32_t size, hashfunction* hf) {
   hash_table* ht = malloc(sizeof(*ht));
-  ht->size = size;
+  ht->size = size > 0 ? size : 1;
+  ht->count = 0;
   if (hf != NULL) {
     ht->hash = hf;
   } else {
@@ -48,9 +76,15 @@ hash_table* hash_table_create(uint32_t size, hashfunction* hf) {
 };
 
 void hash_table_destroy(hash_table* ht) {
-  // what to do about individual elements
+  // the objects belong to the caller, only the entries and keys are freed
   for (uint32_t i = 0; i < ht->size; i++) {
-    free(ht->elements[i]);
+    entry* e = ht->elements[i];
+    while (e != NULL) {
+      entry* next = e->next;
+      free(e->key);
+      free(e);
+      e = next;
+    }
   }
   free(ht->elements);
   free(ht);
@@ -75,33 +109,56 @@ void hash_table_print(hash_table* ht) {
 };
 
 bool hash_table_insert(hash_table* ht, const char* key, void* obj) {
-  if (key == NULL || obj == NULL || ht == NULL)
+  if (key == NULL)
     return false;
-  size_t index = hash_table_index(ht, key);
+  return hash_table_insert_n(ht, key, strlen(key), obj);
+};
 
-  if (hash_table_lookup(ht, key) != NULL)
+bool hash_table_insert_n(hash_table* ht,
+                         const char* key,
+                         size_t len,
+                         void* obj) {
+  if (key == NULL || obj == NULL || ht == NULL)
+    return false;
+  if (hash_table_lookup_n(ht, key, len) != NULL)
     return false;
+  if (ht->count >= ht->size)
+    hash_table_grow(ht);
+  uint64_t hash = ht->hash(key, len);
+  size_t index = hash % ht->size;
 
   // create a new entry
   entry* e = malloc(sizeof(*e));
   e->object = obj;
+  e->hash = hash;
   // NOTE: do not make assumption key is relly string.
-  e->key = malloc(strlen(key) + 1);
-  strcpy(e->key, key);
+  e->key = malloc(len + 1);
+  memcpy(e->key, key, len);
+  e->key[len] = '\0';
 
   // insert entry
   e->next = ht->elements[index];
   ht->elements[index] = e;
+  ht->count++;
   return true;
 };
 
 bool hash_table_update(hash_table* ht, const char* key, void* obj) {
+  if (key == NULL)
+    return false;
+  return hash_table_update_n(ht, key, strlen(key), obj);
+};
+
+bool hash_table_update_n(hash_table* ht,
+                         const char* key,
+                         size_t len,
+                         void* obj) {
   if (key == NULL || obj == NULL || ht == NULL)
     return false;
-  size_t index = hash_table_index(ht, key);
+  size_t index = hash_table_index(ht, key, len);
 
   entry* tmp = ht->elements[index];
-  while (tmp != NULL && strcmp(tmp->key, key) != 0) {
+  while (tmp != NULL && !key_equals(tmp->key, key, len)) {
     tmp = tmp->next;
   }
   if (tmp == NULL)
@@ -111,23 +168,38 @@ bool hash_table_update(hash_table* ht, const char* key, void* obj) {
 };
 
 bool hash_table_upsert(hash_table* ht, const char* key, void* obj) {
+  if (key == NULL)
+    return false;
+  return hash_table_upsert_n(ht, key, strlen(key), obj);
+};
+
+bool hash_table_upsert_n(hash_table* ht,
+                         const char* key,
+                         size_t len,
+                         void* obj) {
   if (key == NULL || obj == NULL || ht == NULL)
     return false;
-  entry* tmp = hash_table_lookup(ht, key);
+  entry* tmp = hash_table_lookup_n(ht, key, len);
   if (tmp == NULL) {
-    return hash_table_insert(ht, key, obj);
+    return hash_table_insert_n(ht, key, len, obj);
   } else {
-    return hash_table_update(ht, key, obj);
+    return hash_table_update_n(ht, key, len, obj);
   }
 };
 
 void* hash_table_lookup(hash_table* ht, const char* key) {
+  if (key == NULL)
+    return NULL;
+  return hash_table_lookup_n(ht, key, strlen(key));
+};
+
+void* hash_table_lookup_n(hash_table* ht, const char* key, size_t len) {
   if (key == NULL || ht == NULL)
     return NULL;
-  size_t index = hash_table_index(ht, key);
+  size_t index = hash_table_index(ht, key, len);
 
   entry* tmp = ht->elements[index];
-  while (tmp != NULL && strcmp(tmp->key, key) != 0) {
+  while (tmp != NULL && !key_equals(tmp->key, key, len)) {
     tmp = tmp->next;
   }
   if (tmp == NULL)
@@ -138,7 +210,7 @@ void* hash_table_lookup(hash_table* ht, const char* key) {
 bool hash_table_delete(hash_table* ht, const char* key) {
   if (key == NULL || ht == NULL)
     return false;
-  size_t index = hash_table_index(ht, key);
+  size_t index = hash_table_index(ht, key, strlen(key));
 
   entry* tmp = ht->elements[index];
   entry* prev = NULL;
@@ -156,6 +228,8 @@ bool hash_table_delete(hash_table* ht, const char* key) {
     prev->next = tmp->next;
   }
   // free(tmp->object);
+  free(tmp->key);
   free(tmp);
+  ht->count--;
   return true;
 };
\ No newline at end of file
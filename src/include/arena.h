@@ -0,0 +1,37 @@
+#ifndef LOX_ARENA_H
+#define LOX_ARENA_H
+#include <stddef.h>
+
+// Bump-pointer allocator: memory is carved out of large chunks and only
+// released all at once with free_arena.
+typedef struct ArenaChunk {
+  struct ArenaChunk* next;
+  size_t size;
+  size_t used;
+  _Alignas(16) char data[];
+} ArenaChunk;
+
+typedef struct Arena {
+  // the chunk being filled, older chunks follow through `next`
+  ArenaChunk* chunks;
+  size_t allocated;
+} Arena;
+
+Arena* new_arena();
+
+// uninitialized memory aligned for any type, exits when out of memory
+void* arena_alloc(Arena* arena, size_t size);
+
+// same with a stricter alignment, a power of two
+void* arena_alloc_aligned(Arena* arena, size_t size, size_t align);
+
+#define arena_new(arena, type) \
+  ((type*)arena_alloc_aligned((arena), sizeof(type), _Alignof(type)))
+
+// move the chunks of `from` into `into` and free `from`, what was allocated
+// from either stays valid as long as `into`
+void arena_merge(Arena* into, Arena* from);
+
+void free_arena(Arena* arena);
+
+#endif  // LOX_ARENA_H
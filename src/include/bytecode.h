@@ -0,0 +1,104 @@
+#ifndef LOX_BYTECODE_H
+#define LOX_BYTECODE_H
+#include <stdint.h>
+#include "expression.h"
+#include "hashtable.h"
+#include "value.h"
+
+// Instructions of the VM, an opcode byte followed by its operands. A short
+// is 2 bytes in host byte order, indices into the tables of the chunk,
+// slots and counts are shorts. Jumps are unsigned 4-byte offsets from the
+// end of the jump, so any body can be jumped over.
+#define OPCODES(X)                                                         \
+  X(OP_CONSTANT)       /* constant: push it */                            \
+  X(OP_NIL)                                                                \
+  X(OP_TRUE)                                                               \
+  X(OP_FALSE)                                                              \
+  X(OP_POP)                                                                \
+  X(OP_GET_LOCAL)      /* slot: of the current frame */                   \
+  X(OP_SET_LOCAL)                                                          \
+  X(OP_GET_UPPER)      /* depth, slot: of a frame `depth` up */           \
+  X(OP_SET_UPPER)                                                          \
+  X(OP_DEFINE_LOCAL)   /* pop into the next slot of the current frame */  \
+  X(OP_GET_GLOBAL)     /* name */                                          \
+  X(OP_SET_GLOBAL)                                                         \
+  X(OP_DEFINE_GLOBAL)                                                      \
+  X(OP_GET_PROPERTY)   /* name */                                          \
+  X(OP_CHECK_FIELDS)   /* offset: unless an instance, nil and jump */     \
+  X(OP_SET_PROPERTY)                                                       \
+  X(OP_GET_SUPER)      /* depth, name: bind a method of 'super' */        \
+  X(OP_EQUAL)                                                              \
+  X(OP_NOT_EQUAL)                                                          \
+  X(OP_GREATER)                                                            \
+  X(OP_GREATER_EQUAL)                                                      \
+  X(OP_LESS)                                                               \
+  X(OP_LESS_EQUAL)                                                         \
+  X(OP_ADD)                                                                \
+  X(OP_SUBTRACT)                                                           \
+  X(OP_MULTIPLY)                                                           \
+  X(OP_DIVIDE)                                                             \
+  X(OP_NOT)                                                                \
+  X(OP_NEGATE)                                                             \
+  X(OP_PRINT)                                                              \
+  X(OP_JUMP)           /* offset */                                        \
+  X(OP_JUMP_IF_FALSE)  /* offset: pop, jump unless true */                \
+  X(OP_LOOP)           /* offset: backwards */                             \
+  X(OP_AND)            /* offset: jump if falsey, else pop */             \
+  X(OP_OR)             /* offset: jump if truthy, else pop */             \
+  X(OP_CALL)           /* count of arguments */                            \
+  X(OP_INVOKE)         /* name, count: call a method of the object */     \
+  X(OP_CLOSURE)        /* declaration: a function closing over the frame */ \
+  X(OP_CLASS)          /* declaration: pop the superclass, push the class */ \
+  X(OP_PUSH_SCOPE)     /* slots, captured: push a block's frame */        \
+  X(OP_POP_SCOPE)      /* captured */                                      \
+  X(OP_RETURN)
+
+#define OPCODE_ENUM(op) op,
+typedef enum OpCode { OPCODES(OPCODE_ENUM) } OpCode;
+#undef OPCODE_ENUM
+
+// a name used by an instruction, globals keep the slot they are interned
+// to, -1 until first used
+typedef struct Name {
+  Token* token;
+  int slot;
+} Name;
+
+// The compiled body of a function, or of a whole program. Tokens and
+// declarations point into the AST, which outlives its chunks.
+typedef struct Chunk {
+  uint8_t* code;
+  int count;
+  int capacity;
+  Value* constants;
+  int num_constants;
+  Name* names;
+  int num_names;
+  // the entries of the two tables above by their key, plus one, so each
+  // is added once; NULL until the first entry
+  hash_table* constant_indices;
+  hash_table* name_indices;
+  // functions and classes declared in the body, as Statement*
+  Statement** declarations;
+  int num_declarations;
+  // parameters of a function, 0 for a program
+  int arity;
+  // the most values the code keeps on the stack at once
+  int max_stack;
+} Chunk;
+
+Chunk* new_chunk();
+void free_chunk(Chunk* chunk);
+
+void write_byte(Chunk* chunk, uint8_t byte);
+void write_short(Chunk* chunk, uint16_t value);
+void write_int(Chunk* chunk, uint32_t value);
+
+// Each adds an entry to a table of the chunk and returns its index. A
+// constant is keyed by its index in the ConstantPool, a name by its text
+// and slot, and one added before returns the index it got then.
+int add_constant(Chunk* chunk, int constant, Value value);
+int add_name(Chunk* chunk, Token* token, int slot);
+int add_declaration(Chunk* chunk, Statement* declaration);
+
+#endif  // LOX_BYTECODE_H
@@ -0,0 +1,33 @@
+#ifndef LOX_CACHE_H
+#define LOX_CACHE_H
+#include <stdint.h>
+#include "arena.h"
+#include "constant.h"
+#include "expression.h"
+#include "source.h"
+
+// Resolved programs are cached on disk, one file per source named after the
+// hash of its contents. A file holds the program as a flat AST image, the
+// constants its literals refer to and the source itself, which a hit must
+// match byte for byte. A hit skips lexing, parsing and resolving.
+
+// key of a source's entry
+uint64_t cache_key(Source* source);
+
+// The cached program of `source`, NULL on a miss or an unusable file. Its
+// tree is built in `arena` and its constants are added to `constants`.
+Statement** load_cached_program(const char* dir,
+                                uint64_t key,
+                                Source* source,
+                                ConstantPool* constants,
+                                Arena* arena);
+
+// Cache a parsed and resolved program. Failures are silent, the cache only
+// saves time.
+void store_cached_program(const char* dir,
+                          uint64_t key,
+                          Source* source,
+                          Statement** program,
+                          ConstantPool* constants);
+
+#endif  // LOX_CACHE_H
@@ -0,0 +1,15 @@
+#ifndef LOX_CLOSURE_COMPILER_H
+#define LOX_CLOSURE_COMPILER_H
+#include "arena.h"
+#include "expression.h"
+
+// Compile a program to a tree of nodes that each run through a function
+// picked for them up front, and run it. Like the VM it runs on the runtime
+// of the tree walker and takes over the arena like interpret. Function
+// bodies are compiled by their first call.
+void interpret_closures(Statement* statements[], Arena* arena);
+
+// free the nodes compiled so far, along with free_interpreter
+void free_closure_compiler();
+
+#endif  // LOX_CLOSURE_COMPILER_H
@@ -0,0 +1,14 @@
+#ifndef LOX_COMPILER_H
+#define LOX_COMPILER_H
+#include "bytecode.h"
+#include "expression.h"
+
+// Compile a resolved program into the chunk the VM runs at the top level.
+// Locals keep the frames and slots the resolver gave them. Returns NULL
+// when the program does not fit the bytecode, which was reported.
+Chunk* compile_program(Statement** statements);
+
+// compile the body of a function, once its deferred body was parsed
+Chunk* compile_function(StatementFunction* declaration);
+
+#endif  // LOX_COMPILER_H
@@ -0,0 +1,37 @@
+#ifndef LOX_CONSTANT_H
+#define LOX_CONSTANT_H
+#include "hashtable.h"
+
+typedef enum ConstantType {
+  C_NUMBER,
+  C_STRING,
+} ConstantType;
+
+typedef struct Constant {
+  ConstantType type;
+  double number;
+  // NUL-terminated, owned by the pool
+  char* string;
+} Constant;
+
+// Number and string literals of a program, each distinct value is stored
+// once and literals refer to it by index.
+typedef struct ConstantPool {
+  Constant* constants;
+  int count;
+  int capacity;
+  // value -> index + 1, numbers are keyed by their bit pattern in hex
+  hash_table* strings;
+  hash_table* numbers;
+} ConstantPool;
+
+ConstantPool* new_constant_pool();
+
+void free_constant_pool(ConstantPool* pool);
+
+// index of the constant with this value, added when it is new
+int add_number_constant(ConstantPool* pool, double number);
+
+int add_string_constant(ConstantPool* pool, const char* start, int length);
+
+#endif  // LOX_CONSTANT_H
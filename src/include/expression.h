@@ -2,6 +2,7 @@
 #define LOX_EXPR_H
 #include <stdbool.h>
 #include "token.h"
+#include "value.h"
 
 /** grammar of expressions
         expression     → literal
@@ -30,27 +31,24 @@ typedef enum ExprType {
   E_Set,
   E_This,
   E_Super,
+  // Binary and unary nodes the interpreter specialized for the operand
+  // types it saw, with the payload of E_Binary or E_Unary. Nodes are only
+  // rewritten into these as they run, after resolving and flattening.
+  E_AddNumbers,
+  E_SubtractNumbers,
+  E_MultiplyNumbers,
+  E_DivideNumbers,
+  E_LessNumbers,
+  E_LessEqualNumbers,
+  E_GreaterNumbers,
+  E_GreaterEqualNumbers,
+  E_EqualNumbers,
+  E_NotEqualNumbers,
+  E_NegateNumber,
+  E_Not,
 } ExprType;
 
-typedef union UnTaggedExpr {
-  struct ExprBinary* binary;
-  struct ExprCall* call;
-  struct ExprUnary* unary;
-  struct ExprLiteral* literal;
-  struct ExprGet* get;
-  struct ExprSet* set;
-  struct ExprThis* this;
-  struct ExprSuper* super;
-  struct ExprGrouping* grouping;
-  struct ExprVariable* variable;
-  struct ExprAssign* assign;
-  struct ExprLogical* logical;
-} UnTaggedExpr;
-
-typedef struct Expr {
-  ExprType type;
-  union UnTaggedExpr* u_expr;
-} Expr;
+typedef struct Expr Expr;
 
 typedef struct ExprUnary {
   Token* op;
@@ -63,9 +61,16 @@ typedef struct ExprCall {
   Expr** arguments;
 } ExprCall;
 
+// locals one scope can declare, so a depth and a slot pack into 32 bits
+#define MAX_SLOTS 65536
+
+// A local is found `depth` environments up, in its `slot` there. Depth -1
+// is a global and `slot` its index among the globals, or -1 until its name
+// is first interned.
 typedef struct ExprVariable {
   Token* name;
   int depth;
+  int slot;
 } ExprVariable;
 
 typedef struct ExprGet {
@@ -79,6 +84,7 @@ typedef struct ExprSet {
   Expr* value;
 } ExprSet;
 
+// 'this' and 'super' each have a scope of their own, in slot 0
 typedef struct ExprThis {
   Token* keyword;
   int depth;
@@ -95,7 +101,13 @@ typedef struct ExprGrouping {
 } ExprGrouping;
 
 typedef struct ExprLiteral {
-  Token* value;
+  // TRUE, FALSE, NIL, NUMBER or STRING
+  TokenType type;
+  // index in the program's ConstantPool for NUMBER and STRING, else -1
+  int constant;
+  // made by the first evaluation and shared by every later one, EMPTY_VAL
+  // until then
+  Value value;
 } ExprLiteral;
 
 typedef struct ExprBinary {
@@ -108,6 +120,7 @@ typedef struct ExprAssign {
   Token* name;
   struct Expr* value;
   int depth;
+  int slot;
 } ExprAssign;
 
 typedef struct ExprLogical {
@@ -116,6 +129,29 @@ typedef struct ExprLogical {
   struct Expr* right;
 } ExprLogical;
 
+// A node is one allocation, the payload of its variant is stored inline
+// after the tag. Every payload fits in three words, so a node is 32 bytes
+// and aligned to never straddle a cache line.
+struct Expr {
+  _Alignas(32) ExprType type;
+  union {
+    ExprBinary binary;
+    ExprCall call;
+    ExprUnary unary;
+    ExprLiteral literal;
+    ExprGet get;
+    ExprSet set;
+    ExprThis this;
+    ExprSuper super;
+    ExprGrouping grouping;
+    ExprVariable variable;
+    ExprAssign assign;
+    ExprLogical logical;
+  } as;
+};
+
+_Static_assert(sizeof(Expr) == 32, "Expr payloads must fit in three words");
+
 typedef enum StatementType {
   STATEMENT_EXPRESSION,
   STATEMENT_PRINT,
@@ -125,9 +161,13 @@ typedef enum StatementType {
   STATEMENT_WHILE,
   STATEMENT_FUNCTION,
   STATEMENT_RETURN,
-  STATEMENT_CLASS
+  STATEMENT_CLASS,
+  // a function body skipped by a lazy parse, parsed on the first call
+  STATEMENT_DEFERRED
 } StatementType;
 
+typedef struct Statement Statement;
+
 typedef struct StatementExpression {
   Expr* expr;
 } StatementExpression;
@@ -143,6 +183,18 @@ typedef struct StatementVar {
 
 typedef struct StatementBlock {
   struct Statement** stmts;
+  // locals declared in the block, the frame size of a function body,
+  // whose parameters come first. A block with none has no frame and runs
+  // in the enclosing one.
+  int num_slots;
+  // a closure may use its environment after the block or call is done
+  bool captured;
+  // a function body compiled by its first call, to bytecode for the VM or
+  // to nodes for the closure engine, else NULL
+  union {
+    struct Chunk* chunk;
+    struct Node* node;
+  };
 } StatementBlock;
 
 typedef struct StatementIf {
@@ -173,21 +225,40 @@ typedef struct StatementClass {
   Expr* superclass;
 } StatementClass;
 
-typedef union UnTaggedStatement {
-  struct StatementExpression* expr;
-  struct StatementPrint* print;
-  struct StatementVar* var;
-  struct StatementBlock* block;
-  struct StatementIf* if_stmt;
-  struct StatementFunction* function;
-  struct StatementWhile* while_stmt;
-  struct StatementReturn* return_stmt;
-  struct StatementClass* class;
-} UnTaggedStatement;
-
-typedef struct Statement {
-  StatementType type;
-  union UnTaggedStatement* u_stmt;
-} Statement;
+// where a deferred body was declared, which decides the scopes it is
+// resolved in
+typedef enum DeferredKind {
+  DEFERRED_FUNCTION,
+  DEFERRED_METHOD,
+  DEFERRED_SUBCLASS_METHOD,
+} DeferredKind;
+
+typedef struct StatementDeferred {
+  // source of the body, from its '{' through the matching '}'
+  const char* start;
+  int length;
+  int line;
+  DeferredKind kind;
+} StatementDeferred;
+
+// same layout as Expr: the tag followed by the inline payload, 32 bytes
+struct Statement {
+  _Alignas(32) StatementType type;
+  union {
+    StatementExpression expr;
+    StatementPrint print;
+    StatementVar var;
+    StatementBlock block;
+    StatementIf if_stmt;
+    StatementFunction function;
+    StatementWhile while_stmt;
+    StatementReturn return_stmt;
+    StatementClass class;
+    StatementDeferred deferred;
+  } as;
+};
+
+_Static_assert(sizeof(Statement) == 32,
+               "Statement payloads must fit in three words");
 
 #endif
\ No newline at end of file
@@ -0,0 +1,77 @@
+#ifndef LOX_FLAT_AST_H
+#define LOX_FLAT_AST_H
+#include <stdint.h>
+#include <stdio.h>
+#include "arena.h"
+#include "expression.h"
+
+// A program as flat arrays indexed by 32-bit IDs instead of a pointer tree.
+// Nothing in it is an address, tokens refer to the source by offset, so it
+// can be written to disk and read back without fixups.
+//
+// Node i has kind kinds[i] and up to three operands a[i], b[i] and c[i].
+// Depending on the kind an operand is a node ID, a token ID, a list offset
+// or a plain integer (literal type, constant index, resolved depth or
+// slot). ID 0 of nodes and tokens stands for NULL. A list is lists[offset],
+// its length, followed by that many IDs.
+typedef uint32_t NodeId;
+
+// node kinds: expressions keep their ExprType, statements follow
+#define FLAT_STATEMENT 32
+
+typedef struct FlatAst {
+  uint32_t num_nodes;
+  uint32_t node_capacity;
+  uint8_t* kinds;
+  uint32_t* a;
+  uint32_t* b;
+  uint32_t* c;
+
+  uint32_t num_tokens;
+  uint32_t token_capacity;
+  uint8_t* token_types;
+  uint32_t* token_starts;
+  uint32_t* token_lengths;
+  uint32_t* token_lines;
+
+  uint32_t num_list_items;
+  uint32_t list_capacity;
+  uint32_t* lists;
+
+  // list of the top-level statements
+  uint32_t root;
+  // size of the source the tokens index into
+  uint32_t source_length;
+  // literals index constants below this
+  uint32_t num_constants;
+  // the arrays point into an image owned by the caller, see map_flat_ast
+  bool mapped;
+} FlatAst;
+
+// flatten a parsed and resolved program, its tokens point into `source`
+FlatAst* flatten_ast(Statement** program, const char* source, size_t length);
+
+// Rebuild the pointer tree in `arena`, with tokens pointing into `source`.
+// `constants` maps the literals' constant indices to pool indices, NULL
+// when they already are pool indices.
+Statement** inflate_ast(FlatAst* ast,
+                        Arena* arena,
+                        const char* source,
+                        const int* constants);
+
+void free_flat_ast(FlatAst* ast);
+
+// bytes used by the arrays
+size_t flat_ast_size(FlatAst* ast);
+
+// write the binary image of the arrays, false on an I/O error
+bool write_flat_ast(FlatAst* ast, FILE* file);
+
+// bytes write_flat_ast writes
+size_t flat_ast_image_size(FlatAst* ast);
+
+// Use an image in place, `data` must be 4-byte aligned and outlive the
+// result. NULL when the image is malformed or from another version.
+FlatAst* map_flat_ast(const void* data, size_t size);
+
+#endif  // LOX_FLAT_AST_H
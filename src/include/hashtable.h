@@ -5,7 +5,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 
-typedef uint64_t(hashfunction)(const char*);
+typedef uint64_t(hashfunction)(const char*, size_t);
 typedef struct _hash_table hash_table;
 
 hash_table* hash_table_create(uint32_t size, hashfunction* hf);
@@ -16,4 +16,20 @@ bool hash_table_update(hash_table* ht, const char* key, void* obj);
 bool hash_table_upsert(hash_table* ht, const char* key, void* obj);
 void* hash_table_lookup(hash_table* ht, const char* key);
 bool hash_table_delete(hash_table* ht, const char* key);
+
+// variants keyed by a (pointer, length) slice that need no NUL terminator,
+// used to look up names straight from the source buffer
+bool hash_table_insert_n(hash_table* ht,
+                         const char* key,
+                         size_t len,
+                         void* obj);
+bool hash_table_update_n(hash_table* ht,
+                         const char* key,
+                         size_t len,
+                         void* obj);
+bool hash_table_upsert_n(hash_table* ht,
+                         const char* key,
+                         size_t len,
+                         void* obj);
+void* hash_table_lookup_n(hash_table* ht, const char* key, size_t len);
 #endif  //!__HASHTABLE__H__
\ No newline at end of file
@@ -2,96 +2,138 @@
 #define LOX_INTERPRETER_H
 #include <ctype.h>
 #include <stdbool.h>
+#include "arena.h"
+#include "constant.h"
 #include "expression.h"
 #include "hashtable.h"
+#include "symbol.h"
+#include "value.h"
 
+// An environment is a frame of the slots its scope's locals were resolved
+// to, filled in the order they are declared. The global one has none, the
+// globals are kept in a vector indexed by the IDs of their names.
 typedef struct Env {
-  char* name;
   struct Env* enclosing;
-  hash_table* map;
+  int count;
+  int num_slots;
+  Value slots[];
 } Env;
 
+typedef Value (*NativeFn)(void);
+
 typedef struct Function {
   StatementFunction* declaration;
   Env* closure;
   bool is_initializer;
+  // a function of the runtime without a declaration, taking no arguments
+  NativeFn native;
 } Function;
 
 typedef struct Class {
   char* name;
   struct Class* superclass;
+  // name -> Function*
   hash_table* methods;
 } Class;
 
 typedef struct Instance {
   Class* class;
+  // name -> Value*, a cell allocated when the field is first set
   hash_table* fields;
 } Instance;
 
-typedef union Value {
-  char* string;
-  double number;
-  bool boolean;
-  bool nil;
-  Function* function;
-  Class* class;
-  Instance* instance;
-} Value;
-
-typedef enum ValueType {
-  V_STRING,
-  V_NUMBER,
-  V_BOOL,
-  V_NIL,
-  V_FUNCTION,
-  V_CLASS,
-  V_INSTANCE
-} ValueType;
-
-typedef struct {
-  ValueType type;
-  Value* value;
-} Object;
-
-Env* new_env(Env* enclosing, char* name);
-
-Object* env_define(Env* env, char* identifier, Object* value);
-Object* env_update(Env* env, char* identifier, Object* value);
-Object* env_lookup(Env* env, char* identifier);
+// an environment with room for `num_slots` locals
+Env* new_env(Env* enclosing, int num_slots);
+
+// Identifiers are (pointer, length) views, usually straight from a token.
+// Only globals are defined by them, env_define appends to the slots of any
+// other environment.
+Value env_define(Env* env, const char* identifier, int length, Value value);
 void env_free(Env* env);
 Env* find_declare_env(Env* env, int depth);
 
-Value* new_value();
-Object* new_object();
 void free_mem_unreleased();
-Object* new_function_obj(StatementFunction* declaration,
-                         Env* closure,
-                         bool is_initializer);
+Value new_function_obj(StatementFunction* declaration,
+                       Env* closure,
+                       bool is_initializer);
+
+// Set up the global environment. Every program interpreted until
+// free_interpreter shares it, literals are read from `constants`, the pool
+// filled by the parser, and globals are numbered by `globals`, the table
+// the resolver interns their names in.
+void init_interpreter(ConstantPool* constants, SymbolTable* globals);
+
+// Run a program, the interpreter takes over the arena holding its AST.
+// Functions and classes it defines stay callable by later programs, so the
+// arenas are released by free_interpreter.
+void interpret(Statement* statements[], Arena* arena);
+
+void free_interpreter();
+
+// The runtime the tree walker shares with the bytecode VM: frames,
+// globals and the object model, reporting errors the same way.
+
+// Push the frame of a block or call with `num_slots` locals, which is
+// popped in the reverse order. One a closure may still reach, as the
+// resolver found, lives on the heap until the interpreter is freed.
+Env* push_frame(Env* enclosing, int num_slots, bool captured);
+void pop_frame(Env* env, bool captured);
+// drop every frame still pushed, after a program was abandoned halfway
+void reset_frames();
+// The tree walker and the closure engine recurse on the C stack. A program
+// marks where it starts running, and a call made once it used more than its
+// share of the stack is a stack overflow.
+void mark_stack_base();
+bool stack_exhausted();
+Env* global_environment();
+// keep the arena of a program until the interpreter is freed
+void keep_arena(Arena* arena);
+
+// A global by its name and the slot it is interned to, which is filled in
+// when it is -1. Reading or assigning one not defined yet is an error.
+Value read_global(int* slot, const char* identifier, int length);
+void assign_global(int* slot, const char* identifier, int length, Value value);
+void define_global(int* slot, const char* identifier, int length, Value value);
+
+// the body of a function, parsed first if a lazy parse deferred it
+StatementBlock* function_body(StatementFunction* declaration);
+Value new_class(StatementClass* declaration, Value superclass, Env* env);
+Instance* new_instance(Class* class);
+Function* find_method(Class* class, Token* name);
+Value bind_method(Function* method, Value instance);
+// a field of an instance, else a method of its class bound to it
+Value get_property(Value object, Token* name);
+Value set_property(Value object, Token* name, Value value);
+// the method `name` of `superclass` bound to `instance`
+Value super_method(Value superclass, Value instance, Token* name);
+// the operator `op` on two values of any type
+Value binary_values(TokenType op, Value left, Value right);
+// -value, or an error and nil for anything but a number
+Value negate_value(Value value);
+void print_value(Value value);
 
-void interpret(Statement* statements[]);
 void execute(Statement* statement, Env* env);
-Object* evaluate(Expr* expr, Env* env);
-
-Object* eval_variable(Expr* expr, Env* env);
-Object* eval_literal(Expr* expr, Env* env);
-Object* eval_unary(Expr* expr, Env* env);
-Object* eval_grouping(Expr* expr, Env* env);
-Object* eval_binary(Expr* expr, Env* env);
-Object* eval_assign(Expr* expr, Env* env);
-Object* eval_logical(Expr* expr, Env* env);
-Object* eval_call(Expr* expr, Env* env);
-Object* _eval_call_function(Object* callee, Expr* expr, Env* env);
-Object* _eval_call_class(Object* callee, Expr* expr, Env* env);
-Object* eval_get(Expr* expr, Env* env);
-Object* eval_set(Expr* expr, Env* env);
-Object* eval_this(Expr* expr, Env* env);
-Object* eval_super(Expr* expr, Env* env);
+Value evaluate(Expr* expr, Env* env);
+
+Value eval_variable(Expr* expr, Env* env);
+Value eval_literal(Expr* expr);
+Value eval_unary(Expr* expr, Env* env);
+Value eval_grouping(Expr* expr, Env* env);
+Value eval_binary(Expr* expr, Env* env);
+Value eval_assign(Expr* expr, Env* env);
+Value eval_logical(Expr* expr, Env* env);
+Value eval_call(Expr* expr, Env* env);
+Value _eval_call_function(Value callee, Expr* expr, Env* env);
+Value _eval_call_class(Value callee, Expr* expr, Env* env);
+Value eval_get(Expr* expr, Env* env);
+Value eval_set(Expr* expr, Env* env);
+Value eval_this(Expr* expr, Env* env);
+Value eval_super(Expr* expr, Env* env);
 void eval_block(Statement* stmt, Env* env);
 
-bool is_truthy(Object* obj);
-bool is_logical_truthy(Object* obj);
-void check_number_operand(Token* op, Object* left, Object* right);
-char* stringify(Object* obj);
-bool is_equal(Object* a, Object* b);
+void check_number_operand(TokenType op, Value left, Value right);
+// the text of a value, valid until the next call
+char* stringify(Value value);
+bool is_equal(Value a, Value b);
 
 #endif
\ No newline at end of file
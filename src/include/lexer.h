@@ -1,21 +1,45 @@
 #ifndef LOX_LEXER_H
 #define LOX_LEXER_H
 #include <stdbool.h>
+#include <stddef.h>
 #include "token.h"
 
 typedef struct Lexer {
-  char* source;
-  int start;
-  int current;
+  const char* source;
+  const char* start;
+  const char* current;
+  // cached end of the source, so bounds checks never call strlen
+  const char* end;
   int line;
-  Token** tokens;
+  // filled by scan_tokens and scan_tokens_parallel, once filled next_token
+  // replays them from index `next` instead of scanning
+  Token* tokens;
   int num_tokens;
+  int capacity;
+  int next;
+  // set on the chunk lexers of scan_tokens_parallel: an error only sets
+  // `failed` instead of exiting, the caller rescans serially to report it
+  bool chunk;
+  bool failed;
 } Lexer;
 
-Lexer* new_lexer(char* source);
+// the source needs no NUL terminator, the lexer never reads past `length`
+Lexer* new_lexer(const char* source, size_t length);
+
+// free the lexer and its tokens, the source buffer is not owned
+void free_lexer(Lexer* lexer);
 
 void print_lexer(Lexer* lexer);
 
-Token** scan_tokens(Lexer* lexer);
+// scan and return the next token of the source, E_O_F once it is exhausted
+Token next_token(Lexer* lexer);
+
+// scan the whole source into lexer->tokens, ending with the E_O_F token
+Token* scan_tokens(Lexer* lexer);
+
+// same tokens as scan_tokens, with the source split into chunks lexed on
+// `num_threads` threads (all online cores when <= 0). Small sources are
+// scanned serially.
+Token* scan_tokens_parallel(Lexer* lexer, int num_threads);
 
 #endif  // LOX_LEXER_H
\ No newline at end of file
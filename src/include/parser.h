@@ -1,10 +1,55 @@
 #ifndef LOX_PARSER_H
 #define LOX_PARSER_H
+#include "arena.h"
+#include "constant.h"
 #include "expression.h"
+#include "lexer.h"
+
+// must be a power of two, the parser reads at most the previous and current
+// token so a few slots are enough
+#define TOKEN_RING_SIZE 4
+
+// deepest nesting of declarations, statements and expressions the parser
+// accepts
+#define MAX_NESTING 1000
+
+// most operators the chains being parsed may hold together, `1 + 2 + 3` is
+// a chain of two
+#define MAX_CHAINED 10000
 
 typedef struct Parser {
-  Token** tokens;
+  Lexer* lexer;
+  // tokens are pulled from the lexer on demand into this ring, indexed by
+  // their position modulo TOKEN_RING_SIZE. A slot is overwritten a few tokens
+  // later, so tokens the AST keeps are copied to the arena when taken.
+  Token ring[TOKEN_RING_SIZE];
   int current;
+  // number and string literals, the AST refers to them by index and the
+  // interpreter reads them from here. Owned by the caller so one pool can
+  // serve several programs.
+  ConstantPool* constants;
+  // owns the AST, its child lists and kept tokens, the caller takes it over
+  // with the statements returned by parse
+  Arena* arena;
+  // current depth of declarations, statements and expressions
+  int nesting;
+  // operators applied so far by the chains being parsed
+  int chained;
+  // defer the bodies of top-level functions and methods, see parse_deferred
+  bool lazy;
+  // set once an error was reported
+  bool had_error;
+  // record errors without printing them, for the workers of parse_parallel
+  bool quiet;
+  // set once the nesting passed MAX_NESTING or the chains MAX_CHAINED, the
+  // rest of the input is skipped
+  bool gave_up;
+  // Literals parsed so far, recorded by a worker of parse_parallel only. A
+  // worker has a pool of its own, which is merged into the shared one after
+  // the parse and these literals renumbered. NULL for any other parser.
+  Expr** literals;
+  int num_literals;
+  int literals_capacity;
 } Parser;
 
 /** rules of parser
@@ -21,8 +66,18 @@ typedef struct Parser {
                           | "super" "." IDENTIFIER ;
 */
 
-Parser* new_parser(Token** tokens, int num_tokens);
+Parser* new_parser(Lexer* lexer, ConstantPool* constants);
 
 Statement** parse(Parser* parser);
 
+// Same program as parse, with the top-level declarations split into chunks
+// parsed on `num_threads` threads (all online cores when <= 0). The tokens
+// must have been scanned into parser->lexer->tokens. Small programs are
+// parsed serially.
+Statement** parse_parallel(Parser* parser, int num_threads);
+
+// Parse a body a lazy parse skipped, `parser` reads a lexer over the
+// body's source as recorded in its StatementDeferred. Returns the block.
+Statement* parse_deferred(Parser* parser);
+
 #endif
\ No newline at end of file
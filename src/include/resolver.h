@@ -2,20 +2,58 @@
 #ifndef LOX_RESOLVER_H
 #define LOX_RESOLVER_H
 #include "expression.h"
-#include "stack.h"
+#include "symbol.h"
 
 typedef enum _FunctionType { F_NONE, F_FUNCTION, F_METHOD } FunctionType;
 
 typedef enum _ClassType { C_NONE, C_CLASS, C_SUBCLASS } ClassType;
 
+// a name declared in a scope and the slot it was given
+typedef struct ScopeEntry {
+  int symbol;
+  int slot;
+  bool defined;
+} ScopeEntry;
+
+// A scope is the run of entries from `first` up to the next scope's first.
+// Most are a few names searched linearly, a wide one also gets an open
+// addressing index holding entry + 1 per bucket.
+typedef struct Scope {
+  int first;
+  int num_slots;
+  // functions the scope is nested in
+  int function_depth;
+  // reached by a closure, so it outlives its execution
+  bool captured;
+  int* index;
+  int index_capacity;
+} Scope;
+
 typedef struct Resolver {
-  stack scopes;
+  SymbolTable* symbols;
+  // shared by every program run, a global's ID in it is its slot
+  SymbolTable* globals;
+  // one stack of entries shared by every open scope
+  ScopeEntry* entries;
+  int num_entries;
+  int entry_capacity;
+  Scope* scopes;
+  int num_scopes;
+  int scope_capacity;
+  int function_depth;
   FunctionType cur_fn_type;
   ClassType cur_class_type;
+  // set once an error was reported
+  bool had_error;
 } Resolver;
 
-Resolver* new_resolver();
+Resolver* new_resolver(SymbolTable* globals);
 void resolve(Resolver* resolver, Statement** stms);
+// resolve a function whose deferred body was just parsed, in the scopes of
+// where it was declared
+void resolve_deferred(Resolver* resolver,
+                      StatementFunction* stmt,
+                      DeferredKind kind);
 static void resolve_block(Resolver* resolver, StatementBlock* stmt);
 static void resolve_statements(Resolver* resolver, Statement** stmts);
 static void resolve_statement(Resolver* resolver, Statement* stmt);
@@ -27,9 +65,9 @@ static void resolve_function(Resolver* resolver,
                              StatementFunction* stmt,
                              FunctionType type);
 static void resolve_expr(Resolver* resolver, Expr* expr);
-static int resolve_local(Resolver* resolver, Token* name);
+static int resolve_local(Resolver* resolver, Token* name, int* slot);
 static void begin_scope(Resolver* resolver);
-static void end_scope(Resolver* resolver);
+static void end_scope(Resolver* resolver, StatementBlock* block);
 static void declare(Resolver* resolver, Token* name);
 static void define(Resolver* resolver, Token* name);
 
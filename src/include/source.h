@@ -0,0 +1,29 @@
+#ifndef LOX_SOURCE_H
+#define LOX_SOURCE_H
+#include <stdbool.h>
+#include <stddef.h>
+
+// A loaded script. Regular files are mapped read-only and scanned in place,
+// pipes and stdin ("-") are read into a buffer. The data is not
+// NUL-terminated when mapped, tokens point into it so it must outlive the
+// AST.
+typedef struct Source {
+  const char* path;
+  const char* data;
+  size_t length;
+  bool mapped;
+} Source;
+
+// NULL after printing an error when the file cannot be read
+Source* load_source(const char* path);
+
+void free_source(Source* source);
+
+// Expand files and directories into a NULL-terminated list of script paths,
+// directories contribute their *.lox files recursively in name order.
+// Returns NULL after printing an error when a path does not exist.
+char** expand_paths(char** paths, int count);
+
+void free_paths(char** paths);
+
+#endif  // LOX_SOURCE_H
@@ -0,0 +1,20 @@
+#ifndef LOX_SYMBOL_H
+#define LOX_SYMBOL_H
+#include "hashtable.h"
+
+// Identifiers interned to small integers, so names are compared as IDs
+// rather than as strings. IDs count up from 0 in the order names are seen.
+typedef struct SymbolTable {
+  // name -> ID + 1
+  hash_table* ids;
+  int count;
+} SymbolTable;
+
+SymbolTable* new_symbol_table();
+
+void free_symbol_table(SymbolTable* table);
+
+// ID of the name, a new one the first time it is seen
+int intern_symbol(SymbolTable* table, const char* start, int length);
+
+#endif  // LOX_SYMBOL_H
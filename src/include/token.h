@@ -1,11 +1,6 @@
 #ifndef LOX_TOKEN_H
 #define LOX_TOKEN_H
-
-typedef union {
-  char* string;
-  char* identifier;
-  double number;
-} Literal;
+#include <stdbool.h>
 
 typedef enum TokenType {
   // single-character tokens
@@ -54,16 +49,27 @@ typedef enum TokenType {
   E_O_F,
 } TokenType;
 
+// A token is a view into the source buffer: `start` points at the first
+// character of the lexeme and `length` is its size, no copy is made. For
+// STRING tokens the view excludes the surrounding quotes.
 typedef struct Token {
   TokenType type;
-  char* lexeme;
-  Literal* literal;
+  const char* start;
+  int length;
   int line;
+  double number;
 } Token;
 
-Token* new_token(TokenType type, char* lexeme, Literal* literal, int line);
+Token* new_token(TokenType type, const char* start, int length, int line);
+
+// materialize the lexeme as a NUL-terminated string, caller owns the memory
+char* token_lexeme(Token* token);
+
+bool lexeme_equals(Token* a, Token* b);
+
+bool lexeme_is(Token* token, const char* text);
 
-TokenType map_keyword(char* text);
+TokenType map_keyword(const char* text, int length);
 
 void print_token(Token* token);
 
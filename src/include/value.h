@@ -0,0 +1,110 @@
+#ifndef LOX_VALUE_H
+#define LOX_VALUE_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// A value is one 64-bit word. A number is its double, anything else hides in
+// the payload of a quiet NaN that arithmetic does not produce: nil, false
+// and true are small integers there, a string, function, class or instance
+// sets the sign bit too and is a pointer of up to 48 bits with its kind in
+// bits 48 and 49. Strings point straight at their NUL-terminated bytes.
+typedef uint64_t Value;
+
+typedef enum ValueType {
+  V_STRING,
+  V_NUMBER,
+  V_BOOL,
+  V_NIL,
+  V_FUNCTION,
+  V_CLASS,
+  V_INSTANCE
+} ValueType;
+
+#define QNAN ((uint64_t)0x7ffc000000000000)
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define POINTER_TAG (SIGN_BIT | QNAN)
+#define POINTER_MASK ((uint64_t)0x0000ffffffffffff)
+
+#define KIND_STRING ((uint64_t)0 << 48)
+#define KIND_FUNCTION ((uint64_t)1 << 48)
+#define KIND_CLASS ((uint64_t)2 << 48)
+#define KIND_INSTANCE ((uint64_t)3 << 48)
+#define KIND_MASK ((uint64_t)3 << 48)
+
+#define NIL_VAL ((Value)(QNAN | 1))
+#define FALSE_VAL ((Value)(QNAN | 2))
+#define TRUE_VAL ((Value)(QNAN | 3))
+#define BOOL_VAL(b) ((b) ? TRUE_VAL : FALSE_VAL)
+// a word no value uses, for a value not made yet
+#define EMPTY_VAL ((Value)QNAN)
+#define POINTER_VAL(kind, pointer) \
+  ((Value)(POINTER_TAG | (kind) | ((uint64_t)(uintptr_t)(pointer))))
+#define STRING_VAL(string) POINTER_VAL(KIND_STRING, string)
+#define FUNCTION_VAL(function) POINTER_VAL(KIND_FUNCTION, function)
+#define CLASS_VAL(class) POINTER_VAL(KIND_CLASS, class)
+#define INSTANCE_VAL(instance) POINTER_VAL(KIND_INSTANCE, instance)
+
+#define IS_NUMBER(value) (((value)&QNAN) != QNAN)
+#define IS_NIL(value) ((value) == NIL_VAL)
+#define IS_BOOL(value) (((value) | 1) == TRUE_VAL)
+#define IS_POINTER(value) (((value)&POINTER_TAG) == POINTER_TAG)
+#define IS_KIND(value, kind) \
+  (((value) & (POINTER_TAG | KIND_MASK)) == (POINTER_TAG | (kind)))
+#define IS_STRING(value) IS_KIND(value, KIND_STRING)
+#define IS_FUNCTION(value) IS_KIND(value, KIND_FUNCTION)
+#define IS_CLASS(value) IS_KIND(value, KIND_CLASS)
+#define IS_INSTANCE(value) IS_KIND(value, KIND_INSTANCE)
+
+#define AS_BOOL(value) ((value) == TRUE_VAL)
+#define AS_POINTER(value) ((void*)(uintptr_t)((value)&POINTER_MASK))
+#define AS_STRING(value) ((char*)AS_POINTER(value))
+#define AS_FUNCTION(value) ((struct Function*)AS_POINTER(value))
+#define AS_CLASS(value) ((struct Class*)AS_POINTER(value))
+#define AS_INSTANCE(value) ((struct Instance*)AS_POINTER(value))
+
+static inline double value_to_number(Value value) {
+  double number;
+  memcpy(&number, &value, sizeof(number));
+  return number;
+}
+
+static inline Value number_to_value(double number) {
+  Value value;
+  memcpy(&value, &number, sizeof(value));
+  return value;
+}
+
+#define AS_NUMBER(value) value_to_number(value)
+#define NUMBER_VAL(number) number_to_value(number)
+
+static inline ValueType value_type(Value value) {
+  if (IS_NUMBER(value))
+    return V_NUMBER;
+  if (IS_NIL(value))
+    return V_NIL;
+  if (IS_BOOL(value))
+    return V_BOOL;
+  switch (value & KIND_MASK) {
+    case KIND_STRING:
+      return V_STRING;
+    case KIND_FUNCTION:
+      return V_FUNCTION;
+    case KIND_CLASS:
+      return V_CLASS;
+    default:
+      return V_INSTANCE;
+  }
+}
+
+// only true is true, else is false, used for if/while
+static inline bool is_truthy(Value value) {
+  return value == TRUE_VAL;
+}
+
+// only false and nil is logical false, used for or/and
+static inline bool is_logical_truthy(Value value) {
+  return value != NIL_VAL && value != FALSE_VAL;
+}
+
+#endif  // LOX_VALUE_H
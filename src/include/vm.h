@@ -0,0 +1,15 @@
+#ifndef LOX_VM_H
+#define LOX_VM_H
+#include "arena.h"
+#include "expression.h"
+
+// Compile a program to bytecode and run it on the stack VM. It runs on the
+// runtime of the tree walker, which init_interpreter sets up, and takes
+// over the arena like interpret. Function bodies are compiled by their
+// first call.
+void interpret_bytecode(Statement* statements[], Arena* arena);
+
+// free the chunks compiled so far, along with free_interpreter
+void free_vm();
+
+#endif  // LOX_VM_H
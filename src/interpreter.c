@@ -1,62 +1,184 @@
 #include "include/interpreter.h"
+#include <setjmp.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "include/lexer.h"
 #include "include/log.h"
+#include "include/parser.h"
+#include "include/resolver.h"
 
 static Env* global_env = NULL;
-void* latest_return_value = NULL;
+static ConstantPool* constants = NULL;
+// Globals by the ID of their name in `global_names`. A slot is defined once
+// its declaration runs, before that the name is an undefined variable.
+typedef struct Global {
+  Value value;
+  bool defined;
+} Global;
+static SymbolTable* global_names = NULL;
+static Global* globals = NULL;
+static int globals_capacity = 0;
+// arenas of the programs run so far
+static Arena** arenas = NULL;
+static int num_arenas = 0;
+Value latest_return_value = NIL_VAL;
 bool function_returned = false;
-void** mem_unreleased;
-
-void interpret(Statement** statements) {
-  global_env = new_env(NULL, "global");
-  mem_unreleased = malloc(sizeof(mem_unreleased));
+static Value call_value(Value callee, Expr* expr, Env* env);
+static Value call_method(Function* method,
+                         Value instance,
+                         Expr* expr,
+                         Env* env);
+static Value call_function(Function* function, Expr* expr, Env* env);
+void record_mem_unreleased(void* obj);
+static Value eval_number_binary(Expr* expr, Env* env);
+static Value eval_negate_number(Expr* expr, Env* env);
+
+// Frames of blocks and calls no closure reaches are pushed on and popped
+// off one contiguous stack. It never moves, as frames point to each other.
+#define FRAME_STACK_SIZE (8 << 20)
+static char* frame_stack = NULL;
+static size_t frame_top = 0;
+
+// Calls may use this share of the C stack, the rest is left to the
+// recursion within one body, which the parser bounds.
+#define STACK_BUDGET(limit) ((limit) / 4 * 3)
+// the stack assumed when its limit is unknown or unlimited
+#define DEFAULT_STACK_SIZE (8 << 20)
+// the C stack where the program started, and how much of it calls use
+static uintptr_t stack_base = 0;
+static size_t stack_budget = 0;
+// where a stack overflow abandons the program
+static jmp_buf overflow;
+
+// environments that closures may still use, freed with the interpreter
+static void** mem_unreleased = NULL;
+static int num_unreleased = 0;
+static int unreleased_capacity = 0;
+
+static Value clock_native(void) {
+  return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
+};
+
+static void define_native(const char* name, NativeFn native) {
+  Function* function = calloc(1, sizeof(*function));
+  function->native = native;
+  record_mem_unreleased(function);
+  env_define(global_env, name, strlen(name), FUNCTION_VAL(function));
+};
+
+void init_interpreter(ConstantPool* pool, SymbolTable* names) {
+  global_env = new_env(NULL, 0);
+  frame_stack = malloc(FRAME_STACK_SIZE);
+  frame_top = 0;
+  constants = pool;
+  global_names = names;
+  define_native("clock", clock_native);
+};
+
+Env* global_environment() {
+  return global_env;
+};
+
+void keep_arena(Arena* arena) {
+  arenas = realloc(arenas, sizeof(Arena*) * (num_arenas + 1));
+  arenas[num_arenas++] = arena;
+};
+
+void interpret(Statement** statements, Arena* arena) {
+  keep_arena(arena);
+  mark_stack_base();
+  if (setjmp(overflow) != 0) {
+    reset_frames();
+    function_returned = false;
+    return;
+  }
   for (int i = 0; statements[i] != NULL; i++) {
     Statement* stmt = statements[i];
     execute(stmt, global_env);
+    // a return outside of any function, which the resolver reported
+    function_returned = false;
   }
-  free(statements);
+};
+
+void free_interpreter() {
   env_free(global_env);
-  free(latest_return_value);
+  free(frame_stack);
+  frame_stack = NULL;
+  free(globals);
+  globals = NULL;
+  globals_capacity = 0;
   free_mem_unreleased();
+  for (int i = 0; i < num_arenas; i++) {
+    free_arena(arenas[i]);
+  }
+  free(arenas);
+  arenas = NULL;
+  num_arenas = 0;
 };
 
-Env* new_env(Env* enclosing, char* name) {
-  Env* env = malloc(sizeof(*env));
-  env->name = name;
+Env* new_env(Env* enclosing, int num_slots) {
+  Env* env = malloc(sizeof(*env) + sizeof(Value) * num_slots);
   env->enclosing = enclosing;
-  env->map = hash_table_create(8192, NULL);
+  env->count = 0;
+  env->num_slots = num_slots;
   return env;
 };
 
-Object* env_define(Env* env, char* identifier, Object* obj) {
-  hash_table_insert(env->map, identifier, obj);
-  return obj;
+// The global in `*slot`, interning its name first when the slot is not
+// known yet. The vector grows as the resolvers intern more names.
+static Global* find_global(int* slot, const char* identifier, int length) {
+  if (*slot < 0) {
+    *slot = intern_symbol(global_names, identifier, length);
+  }
+  if (*slot >= globals_capacity) {
+    int capacity = globals_capacity < 64 ? 64 : globals_capacity;
+    while (capacity <= *slot) {
+      capacity *= 2;
+    }
+    globals = realloc(globals, sizeof(Global) * capacity);
+    memset(globals + globals_capacity, 0,
+           sizeof(Global) * (capacity - globals_capacity));
+    globals_capacity = capacity;
+  }
+  return &globals[*slot];
 };
 
-Object* env_update(Env* env, char* identifier, Object* obj) {
-  bool updated = hash_table_update(env->map, identifier, obj);
-  if (!updated) {
-    if (env->enclosing != NULL) {
-      return env_update(env->enclosing, identifier, obj);
-    } else {
-      log_error("Undefined variable '%s'.", identifier);
-    }
+Value read_global(int* slot, const char* identifier, int length) {
+  Global* global = find_global(slot, identifier, length);
+  if (!global->defined) {
+    log_error("Undefined variable '%.*s'.", length, identifier);
+    return NIL_VAL;
   }
-  return obj;
+  return global->value;
 };
 
-Object* env_lookup(Env* env, char* identifier) {
-  Object* obj = hash_table_lookup(env->map, identifier);
-  if (obj == NULL) {
-    if (env->enclosing != NULL) {
-      return env_lookup(env->enclosing, identifier);
-    } else {
-      log_error("Undefined variable '%s'.", identifier);
-    }
+void assign_global(int* slot, const char* identifier, int length, Value value) {
+  Global* global = find_global(slot, identifier, length);
+  if (!global->defined) {
+    log_error("Undefined variable '%.*s'.", length, identifier);
+  } else {
+    global->value = value;
   }
-  return obj;
+};
+
+void define_global(int* slot, const char* identifier, int length, Value value) {
+  Global* global = find_global(slot, identifier, length);
+  global->value = value;
+  global->defined = true;
+};
+
+Value env_define(Env* env, const char* identifier, int length, Value value) {
+  if (env == global_env) {
+    int slot = -1;
+    define_global(&slot, identifier, length, value);
+  } else if (env->count < env->num_slots) {
+    env->slots[env->count++] = value;
+  }
+  return value;
 };
 
 Env* find_declare_env(Env* env, int depth) {
@@ -71,145 +193,159 @@ Env* find_declare_env(Env* env, int depth) {
 };
 
 void env_free(Env* env) {
-  hash_table_destroy(env->map);
   free(env);
 };
 
-Value* new_value() {
-  Value* v = malloc(sizeof(*v));
-  v->number = 0;
-  v->nil = true;
-  return v;
-};
-
 void record_mem_unreleased(void* obj) {
-  int size = sizeof(mem_unreleased) / sizeof(void*);
-  mem_unreleased = realloc(mem_unreleased, sizeof(void*) * (size + 1));
-  mem_unreleased[size] = obj;
+  if (num_unreleased == unreleased_capacity) {
+    unreleased_capacity = unreleased_capacity < 64 ? 64 : unreleased_capacity * 2;
+    mem_unreleased =
+        realloc(mem_unreleased, sizeof(void*) * unreleased_capacity);
+  }
+  mem_unreleased[num_unreleased++] = obj;
 };
 
 void free_mem_unreleased() {
-  int size = sizeof(mem_unreleased) / sizeof(mem_unreleased[0]);
-  for (int i = 0; i < size; i++) {
-    if (mem_unreleased[i] != NULL) {
-      free(mem_unreleased[i]);
-    }
+  for (int i = 0; i < num_unreleased; i++) {
+    free(mem_unreleased[i]);
   }
   free(mem_unreleased);
+  mem_unreleased = NULL;
+  num_unreleased = 0;
+  unreleased_capacity = 0;
 }
 
-Object* new_object() {
-  Object* obj = malloc(sizeof(*obj));
-  obj->type = V_NIL;
-  obj->value = new_value();
-  record_mem_unreleased(obj);
-  return obj;
+// A frame the frame stack has no room for is on the heap too, until it is
+// popped.
+Env* push_frame(Env* enclosing, int num_slots, bool captured) {
+  size_t size = sizeof(Env) + sizeof(Value) * num_slots;
+  if (captured) {
+    Env* env = new_env(enclosing, num_slots);
+    record_mem_unreleased(env);
+    return env;
+  }
+  if (size > FRAME_STACK_SIZE - frame_top) {
+    return new_env(enclosing, num_slots);
+  }
+  Env* env = (Env*)(frame_stack + frame_top);
+  frame_top += size;
+  env->enclosing = enclosing;
+  env->count = 0;
+  env->num_slots = num_slots;
+  return env;
 };
 
-Object* new_function_obj(StatementFunction* declaration,
-                         Env* closure,
-                         bool is_initializer) {
-  Object* obj = new_object();
-  obj->type = V_FUNCTION;
-  obj->value->function = malloc(sizeof(*obj->value->function));
-  obj->value->function->declaration = declaration;
-  obj->value->function->closure = closure;
-  obj->value->function->is_initializer = is_initializer;
-  return obj;
+void pop_frame(Env* env, bool captured) {
+  uintptr_t at = (uintptr_t)env - (uintptr_t)frame_stack;
+  if (at < FRAME_STACK_SIZE) {
+    frame_top = at;
+  } else if (!captured) {
+    free(env);
+  }
+};
+
+void reset_frames() {
+  frame_top = 0;
+};
+
+void mark_stack_base() {
+  struct rlimit limit;
+  size_t stack_size = DEFAULT_STACK_SIZE;
+  if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+    stack_size = limit.rlim_cur;
+  char base;
+  stack_base = (uintptr_t)&base;
+  stack_budget = STACK_BUDGET(stack_size);
+};
+
+bool stack_exhausted() {
+  // the stack grows down on every target, compared as addresses
+  char here;
+  return stack_base - (uintptr_t)&here > stack_budget;
+};
+
+Value new_function_obj(StatementFunction* declaration,
+                       Env* closure,
+                       bool is_initializer) {
+  Function* function = malloc(sizeof(*function));
+  function->declaration = declaration;
+  function->closure = closure;
+  function->is_initializer = is_initializer;
+  function->native = NULL;
+  return FUNCTION_VAL(function);
 };
 
 void execute(Statement* statement, Env* env) {
   switch (statement->type) {
     case STATEMENT_EXPRESSION: {
-      evaluate(statement->u_stmt->expr->expr, env);
+      evaluate(statement->as.expr.expr, env);
       // NOTE: we can't free object here, cause in expression we may define a
       // variable in env,  if we free the object, the variable may be freed too
       break;
     }
     case STATEMENT_PRINT: {
-      Object* obj = evaluate(statement->u_stmt->print->expr, env);
-      char* str = stringify(obj);
-      log_info("%s\n", str);
+      print_value(evaluate(statement->as.print.expr, env));
       break;
     }
     case STATEMENT_VAR: {
-      if (statement->u_stmt->var->initializer != NULL) {
-        Object* obj = evaluate(statement->u_stmt->var->initializer, env);
-        env_define(env, statement->u_stmt->var->name->lexeme, obj);
-      }
+      Token* name = statement->as.var.name;
+      // a parse error, which the resolver skipped too
+      if (name == NULL)
+        break;
+      // without an initializer evaluate gives nil
+      Value value = evaluate(statement->as.var.initializer, env);
+      env_define(env, name->start, name->length, value);
       break;
     }
     case STATEMENT_BLOCK: {
-      Env* block_env = new_env(env, "block");
+      StatementBlock* block = &statement->as.block;
+      // the resolver gave no scope to a block declaring nothing
+      if (block->num_slots == 0) {
+        eval_block(statement, env);
+        break;
+      }
+      Env* block_env = push_frame(env, block->num_slots, block->captured);
       eval_block(statement, block_env);
-
+      pop_frame(block_env, block->captured);
       break;
     }
     case STATEMENT_IF: {
-      Object* obj = evaluate(statement->u_stmt->if_stmt->condition, env);
-      if (is_truthy(obj)) {
-        execute(statement->u_stmt->if_stmt->then_branch, env);
-      } else if (statement->u_stmt->if_stmt->else_branch != NULL) {
-        execute(statement->u_stmt->if_stmt->else_branch, env);
+      Value condition = evaluate(statement->as.if_stmt.condition, env);
+      if (is_truthy(condition)) {
+        execute(statement->as.if_stmt.then_branch, env);
+      } else if (statement->as.if_stmt.else_branch != NULL) {
+        execute(statement->as.if_stmt.else_branch, env);
       }
       break;
     }
     case STATEMENT_WHILE: {
-      while (
-          is_truthy(evaluate(statement->u_stmt->while_stmt->condition, env))) {
-        execute(statement->u_stmt->while_stmt->body, env);
+      while (!function_returned &&
+             is_truthy(evaluate(statement->as.while_stmt.condition, env))) {
+        execute(statement->as.while_stmt.body, env);
       }
       break;
     }
     // function declare
     case STATEMENT_FUNCTION: {
-      Object* obj = new_function_obj(statement->u_stmt->function, env, false);
-      env_define(env, statement->u_stmt->function->name->lexeme, obj);
+      Value function = new_function_obj(&statement->as.function, env, false);
+      Token* name = statement->as.function.name;
+      env_define(env, name->start, name->length, function);
       break;
     }
     case STATEMENT_CLASS: {
-      Object* superclassObj = new_object();
-      Expr* sp = statement->u_stmt->class->superclass;
-      Env* super_env = NULL;
-      if (sp != NULL) {
-        superclassObj = evaluate(sp, env);
-        if (sp->type != V_CLASS) {
-          log_error("Superclass must be a class.",
-                    sp->u_expr->variable->name->lexeme);
-        }
-        // create a new env for  superclass
-        super_env = new_env(env, "super");
-        env_define(super_env, "super", superclassObj);
-      }
-
-      Object* class = new_object();
-      class->type = V_CLASS;
-      class->value->class = (Class*)malloc(sizeof(Class));
-      class->value->class->name = statement->u_stmt->class->name->lexeme;
-      class->value->class->methods = hash_table_create(100, NULL);
-      class->value->class->superclass = superclassObj->value->class;
-      for (int i = 0; statement->u_stmt->class->methods[i] != NULL; i++) {
-        Statement* method = statement->u_stmt->class->methods[i];
-        StatementFunction* fn_stmt = method->u_stmt->function;
-        bool is_init = strcmp(fn_stmt->name->lexeme, "init") == 0;
-        // use super_env here, which bind `super` to superclass
-        Object* fnObj = new_function_obj(fn_stmt, super_env, is_init);
-        hash_table_insert(class->value->class->methods, fn_stmt->name->lexeme,
-                          fnObj);
-      }
-
-      // can't free super_env here, cause it will be used in function's closure
-      env_define(env, statement->u_stmt->class->name->lexeme, class);
-      record_mem_unreleased(super_env);
+      StatementClass* class = &statement->as.class;
+      Value superclass = class->superclass != NULL
+                             ? evaluate(class->superclass, env)
+                             : NIL_VAL;
+      Token* name = class->name;
+      env_define(env, name->start, name->length,
+                 new_class(class, superclass, env));
       break;
     }
     case STATEMENT_RETURN: {
-      if (strcmp(env->name, "interpret") == 0) {
-        log_error("Can't return from top-level code.");
-        break;
-      }
-      Object* obj = evaluate(statement->u_stmt->return_stmt->value, env);
-      latest_return_value = obj;
+      latest_return_value = evaluate(statement->as.return_stmt.value, env);
+      // the blocks and loops it is in stop until the call is done
+      function_returned = true;
       break;
     }
     default:
@@ -218,28 +354,20 @@ void execute(Statement* statement, Env* env) {
 };
 
 void eval_block(Statement* stmt, Env* env) {
-  for (int i = 0; stmt->u_stmt->block->stmts[i] != NULL; i++) {
-    if (function_returned)
-      break;
-    Statement* statement = stmt->u_stmt->block->stmts[i];
-    execute(statement, env);
+  for (int i = 0; stmt->as.block.stmts[i] != NULL; i++) {
     // after return, we should break block to skip the rest statements
-    if (statement->type == STATEMENT_RETURN) {
-      function_returned = true;
+    if (function_returned)
       break;
-    }
+    execute(stmt->as.block.stmts[i], env);
   }
-  // NOTE: we can't free env here, cause in this block may define a function
-  // this env will be used in function's closure
-  record_mem_unreleased(env);
 }
 
-Object* evaluate(Expr* expr, Env* env) {
+Value evaluate(Expr* expr, Env* env) {
   if (expr == NULL)
-    return new_object();
+    return NIL_VAL;
   switch (expr->type) {
     case E_Literal:
-      return eval_literal(expr, env);
+      return eval_literal(expr);
     case E_Unary:
       return eval_unary(expr, env);
     case E_Call:
@@ -262,286 +390,542 @@ Object* evaluate(Expr* expr, Env* env) {
       return eval_assign(expr, env);
     case E_Logical:
       return eval_logical(expr, env);
+    case E_AddNumbers:
+    case E_SubtractNumbers:
+    case E_MultiplyNumbers:
+    case E_DivideNumbers:
+    case E_LessNumbers:
+    case E_LessEqualNumbers:
+    case E_GreaterNumbers:
+    case E_GreaterEqualNumbers:
+    case E_EqualNumbers:
+    case E_NotEqualNumbers:
+      return eval_number_binary(expr, env);
+    case E_NegateNumber:
+      return eval_negate_number(expr, env);
+    case E_Not:
+      return BOOL_VAL(!is_truthy(evaluate(expr->as.unary.right, env)));
     default:
-      return new_object();
+      return NIL_VAL;
+  }
+};
+
+Value eval_variable(Expr* expr, Env* env) {
+  ExprVariable* variable = &expr->as.variable;
+  if (variable->depth < 0) {
+    Token* name = variable->name;
+    return read_global(&variable->slot, name->start, name->length);
   }
+  return find_declare_env(env, variable->depth)->slots[variable->slot];
 };
 
-Object* eval_variable(Expr* expr, Env* env) {
-  Env* declare_env = find_declare_env(env, expr->u_expr->variable->depth);
-  return env_lookup(declare_env, expr->u_expr->variable->name->lexeme);
+Value eval_this(Expr* expr, Env* env) {
+  // outside of a class, which the resolver reported
+  if (expr->as.this.depth < 0) {
+    int slot = -1;
+    return read_global(&slot, "this", strlen("this"));
+  }
+  return find_declare_env(env, expr->as.this.depth)->slots[0];
 };
 
-Object* eval_this(Expr* expr, Env* env) {
-  Env* declare_env = find_declare_env(env, expr->u_expr->variable->depth);
-  return env_lookup(declare_env, "this");
+// Bind a method to an instance: its closure is extended by a scope holding
+// 'this'. The method object itself is shared by the class and left as is.
+Value bind_method(Function* method, Value instance) {
+  Env* this_env = new_env(method->closure, 1);
+  env_define(this_env, "this", strlen("this"), instance);
+  return new_function_obj(method->declaration, this_env,
+                          method->is_initializer);
 };
 
-Object* eval_super(Expr* expr, Env* env) {
-  Env* declare_env = find_declare_env(env, expr->u_expr->super->depth);
-  Object* superclass = env_lookup(declare_env, "super");
-  Env* instance_declare_env =
-      find_declare_env(env, expr->u_expr->super->depth - 1);
+Value eval_super(Expr* expr, Env* env) {
+  if (expr->as.super.depth < 0) {
+    int slot = -1;
+    return read_global(&slot, "super", strlen("super"));
+  }
+  // the scope of 'this' is right inside the one of 'super'
+  Value superclass = find_declare_env(env, expr->as.super.depth)->slots[0];
+  Value instance = find_declare_env(env, expr->as.super.depth - 1)->slots[0];
+  return super_method(superclass, instance, expr->as.super.method);
+};
 
-  Object* method = hash_table_lookup(superclass->value->class->methods,
-                                     expr->u_expr->super->method->lexeme);
+Value super_method(Value superclass, Value instance, Token* name) {
+  Function* method = NULL;
+  if (IS_CLASS(superclass)) {
+    method = hash_table_lookup_n(AS_CLASS(superclass)->methods, name->start,
+                                 name->length);
+  }
 
   if (method == NULL) {
-    log_error("Undefined property '%s'.", expr->u_expr->super->method->lexeme);
-    return NULL;
+    log_error("Undefined property '%.*s'.", name->length, name->start);
+    return NIL_VAL;
   }
 
-  method->value->function->closure = instance_declare_env;
+  return bind_method(method, instance);
+};
+
+Function* find_method(Class* class, Token* name) {
+  if (class == NULL)
+    return NULL;
+  Function* method =
+      hash_table_lookup_n(class->methods, name->start, name->length);
+  // if not found in class, try to find in superclass
+  if (method == NULL && class->superclass != NULL) {
+    method = hash_table_lookup_n(class->superclass->methods, name->start,
+                                 name->length);
+  }
   return method;
 };
 
-Object* eval_get(Expr* expr, Env* env) {
-  Object* obj = evaluate(expr->u_expr->get->object, env);
-  if (obj->type == V_INSTANCE) {
-    Object* value = hash_table_lookup(obj->value->instance->fields,
-                                      expr->u_expr->get->name->lexeme);
-    if (value != NULL) {
-      return value;
+Value eval_get(Expr* expr, Env* env) {
+  Value object = evaluate(expr->as.get.object, env);
+  return get_property(object, expr->as.get.name);
+};
+
+Value get_property(Value object, Token* name) {
+  if (IS_INSTANCE(object)) {
+    Instance* instance = AS_INSTANCE(object);
+    Value* field =
+        hash_table_lookup_n(instance->fields, name->start, name->length);
+    if (field != NULL) {
+      return *field;
     }
     // if not found in instance, try to find in class
-    Class* class = obj->value->instance->class;
-    if (class != NULL) {
-      Object* method =
-          hash_table_lookup(class->methods, expr->u_expr->get->name->lexeme);
-
-      // if not found in class, try to find in superclass
-      if (method == NULL && class->superclass != NULL) {
-        method = hash_table_lookup(class->superclass->methods,
-                                   expr->u_expr->get->name->lexeme);
-      }
-
-      if (method != NULL) {
-        Function* fn = method->value->function;
-        Env* this_env = new_env(fn->closure, "method");
-        env_define(this_env, "this", obj);
-        bool is_init = strcmp(fn->declaration->name->lexeme, "init") == 0;
-        return new_function_obj(fn->declaration, this_env, is_init);
-      }
+    Function* method = find_method(instance->class, name);
+    if (method != NULL) {
+      return bind_method(method, object);
     }
-    log_error("Undefined property '%s'.", expr->u_expr->get->name->lexeme);
+    log_error("Undefined property '%.*s'.", name->length, name->start);
   }
   log_error("Only instances have properties.");
-  return NULL;
+  return NIL_VAL;
 };
 
-Object* eval_set(Expr* expr, Env* env) {
-  Object* obj = evaluate(expr->u_expr->set->object, env);
-  if (obj->type != V_INSTANCE) {
+Value eval_set(Expr* expr, Env* env) {
+  Value object = evaluate(expr->as.set.object, env);
+  if (!IS_INSTANCE(object)) {
     log_error("Only instances have fields.");
+    return NIL_VAL;
+  }
+  Value value = evaluate(expr->as.set.value, env);
+  return set_property(object, expr->as.set.name, value);
+};
+
+Value set_property(Value object, Token* name, Value value) {
+  if (!IS_INSTANCE(object)) {
+    log_error("Only instances have fields.");
+    return NIL_VAL;
+  }
+  hash_table* fields = AS_INSTANCE(object)->fields;
+  Value* field = hash_table_lookup_n(fields, name->start, name->length);
+  if (field == NULL) {
+    field = malloc(sizeof(Value));
+    hash_table_insert_n(fields, name->start, name->length, field);
   }
-  Object* value = evaluate(expr->u_expr->set->value, env);
-  hash_table_upsert(obj->value->instance->fields,
-                    expr->u_expr->set->name->lexeme, value);
+  *field = value;
   return value;
 };
 
-Object* eval_literal(Expr* expr, Env* env) {
-  Token* token = expr->u_expr->literal->value;
-  Literal* literal = token->literal;
-  Object* obj = new_object();
-  switch (token->type) {
+static Value literal_value(ExprLiteral* literal) {
+  switch (literal->type) {
     case TRUE:
-      obj->type = V_BOOL;
-      obj->value->boolean = true;
-      return obj;
+      return TRUE_VAL;
     case FALSE:
-      obj->type = V_BOOL;
-      obj->value->boolean = false;
-      return obj;
+      return FALSE_VAL;
     case STRING:
-      obj->type = V_STRING;
-      obj->value->string = (char*)malloc(strlen(literal->string) + 1);
-      strcpy(obj->value->string, literal->string);
-      return obj;
+      // pool strings are shared, nothing writes to or frees a string value
+      return STRING_VAL(constants->constants[literal->constant].string);
     case NUMBER:
-      obj->type = V_NUMBER;
-      obj->value->number = literal->number;
-      return obj;
+      return NUMBER_VAL(constants->constants[literal->constant].number);
     default:
-      return obj;
+      return NIL_VAL;
   };
 };
 
-Object* eval_unary(Expr* expr, Env* env) {
-  Object* right = evaluate(expr->u_expr->unary->right, env);
-  Object* obj = new_object();
+// A literal is turned into a value once, every evaluation after the first
+// returns the word kept in its node.
+Value eval_literal(Expr* expr) {
+  ExprLiteral* literal = &expr->as.literal;
+  if (literal->value == EMPTY_VAL) {
+    literal->value = literal_value(literal);
+  }
+  return literal->value;
+};
+
+// A unary node specializes itself: '!' works on any value, '-' once its
+// operand is a number.
+Value eval_unary(Expr* expr, Env* env) {
+  Value right = evaluate(expr->as.unary.right, env);
 
-  switch (expr->u_expr->unary->op->type) {
+  switch (expr->as.unary.op->type) {
     case MINUS:
-      obj->type = V_NUMBER;
-      obj->value->number = -right->value->number;
-      break;
+      if (IS_NUMBER(right)) {
+        expr->type = E_NegateNumber;
+      }
+      return negate_value(right);
     case BANG:
-      obj->type = V_BOOL;
-      obj->value->boolean = !is_truthy(right);
-      break;
+      expr->type = E_Not;
+      return BOOL_VAL(!is_truthy(right));
     default:
-      break;
+      return NIL_VAL;
   }
-  return obj;
 };
 
-Object* eval_call(Expr* expr, Env* env) {
-  // callee is a function object, which return by env_lookup in eval_literal
-  Object* callee = evaluate(expr->u_expr->call->callee, env);
+// its guard turns the node back into a generic one for any other operand
+static Value eval_negate_number(Expr* expr, Env* env) {
+  Value right = evaluate(expr->as.unary.right, env);
+  if (!IS_NUMBER(right)) {
+    expr->type = E_Unary;
+    return negate_value(right);
+  }
+  return NUMBER_VAL(-AS_NUMBER(right));
+};
+
+Value eval_call(Expr* expr, Env* env) {
+  Expr* callee_expr = expr->as.call.callee;
+  // obj.method(...) runs the method without binding it to obj first
+  if (callee_expr->type == E_Get) {
+    Value object = evaluate(callee_expr->as.get.object, env);
+    Token* name = callee_expr->as.get.name;
+    if (IS_INSTANCE(object) &&
+        hash_table_lookup_n(AS_INSTANCE(object)->fields, name->start,
+                            name->length) == NULL) {
+      Function* method = find_method(AS_INSTANCE(object)->class, name);
+      if (method != NULL) {
+        return call_method(method, object, expr, env);
+      }
+    }
+    return call_value(get_property(object, name), expr, env);
+  }
+  return call_value(evaluate(callee_expr, env), expr, env);
+};
 
-  if (callee->type == V_CLASS) {
+static Value call_value(Value callee, Expr* expr, Env* env) {
+  if (IS_CLASS(callee)) {
     return _eval_call_class(callee, expr, env);
-  } else if (callee->type == V_FUNCTION) {
+  } else if (IS_FUNCTION(callee)) {
     return _eval_call_function(callee, expr, env);
-  } else {
-    log_error("Can only call functions and classes.");
   }
-  free(callee);
-  return NULL;
+  log_error("Can only call functions and classes.");
+  return NIL_VAL;
+};
+
+Instance* new_instance(Class* class) {
+  Instance* instance = malloc(sizeof(Instance));
+  instance->class = class;
+  instance->fields = hash_table_create(100, NULL);
+  return instance;
+};
+
+// A class of `declaration`, whose methods close over `env`. With a
+// superclass they close over a scope binding 'super' to it instead.
+Value new_class(StatementClass* declaration, Value superclass, Env* env) {
+  Env* super_env = NULL;
+  Class* class = malloc(sizeof(Class));
+  class->name = token_lexeme(declaration->name);
+  class->methods = hash_table_create(100, NULL);
+  class->superclass = NULL;
+  if (declaration->superclass != NULL) {
+    if (!IS_CLASS(superclass)) {
+      log_error("Superclass must be a class.");
+    } else {
+      class->superclass = AS_CLASS(superclass);
+    }
+    super_env = new_env(env, 1);
+    env_define(super_env, "super", strlen("super"), superclass);
+    // methods may use it as long as the class lives
+    record_mem_unreleased(super_env);
+  }
+
+  for (int i = 0; declaration->methods[i] != NULL; i++) {
+    StatementFunction* method = &declaration->methods[i]->as.function;
+    bool is_init = lexeme_is(method->name, "init");
+    Value function = new_function_obj(
+        method, super_env != NULL ? super_env : env, is_init);
+    hash_table_insert_n(class->methods, method->name->start,
+                        method->name->length, AS_FUNCTION(function));
+  }
+  return CLASS_VAL(class);
 };
 
-Object* _eval_call_class(Object* callee, Expr* expr, Env* env) {
-  Object* instance = new_object();
-  instance->type = V_INSTANCE;
-  instance->value->instance = malloc(sizeof(Instance));
-  instance->value->instance->class = callee->value->class;
-  instance->value->instance->fields = hash_table_create(100, NULL);
+Value _eval_call_class(Value callee, Expr* expr, Env* env) {
+  Class* class = AS_CLASS(callee);
+  Instance* instance = new_instance(class);
 
   // find and call initializer
-  Object* initializer =
-      hash_table_lookup(callee->value->class->methods, "init");
+  Function* initializer = hash_table_lookup(class->methods, "init");
   if (initializer != NULL) {
     // bind this to instance for invoking init() directly
-    env_define(initializer->value->function->closure, "this", instance);
-    _eval_call_function(initializer, expr, env);
+    call_method(initializer, INSTANCE_VAL(instance), expr, env);
   }
 
-  return instance;
+  return INSTANCE_VAL(instance);
+};
+
+// First call of a function whose body a lazy parse skipped: parse and
+// resolve the body now. It replaces the placeholder statement in place, so
+// every function object sharing the declaration sees it.
+static void parse_deferred_body(StatementFunction* declaration) {
+  StatementDeferred deferred = declaration->body->as.deferred;
+  Lexer* lexer = new_lexer(deferred.start, deferred.length);
+  lexer->line = deferred.line;
+  Parser* parser = new_parser(lexer, constants);
+  *declaration->body = *parse_deferred(parser);
+  Resolver* resolver = new_resolver(global_names);
+  resolve_deferred(resolver, declaration, deferred.kind);
+  keep_arena(parser->arena);
+  free(resolver);
+  free(parser);
+  free_lexer(lexer);
+};
+
+Value _eval_call_function(Value callee, Expr* expr, Env* env) {
+  return call_function(AS_FUNCTION(callee), expr, env);
+};
+
+// Call a method of `instance` with a frame binding 'this' that lives only
+// as long as the call, unless a closure made by the method may reach it.
+static Value call_method(Function* method,
+                         Value instance,
+                         Expr* expr,
+                         Env* env) {
+  bool captured = function_body(method->declaration)->captured;
+  Env* this_env = push_frame(method->closure, 1, captured);
+  env_define(this_env, "this", strlen("this"), instance);
+  Function bound = {method->declaration, this_env, method->is_initializer,
+                    NULL};
+  Value result = call_function(&bound, expr, env);
+  pop_frame(this_env, captured);
+  return result;
+};
+
+StatementBlock* function_body(StatementFunction* declaration) {
+  if (declaration->body->type == STATEMENT_DEFERRED) {
+    parse_deferred_body(declaration);
+  }
+  return &declaration->body->as.block;
 };
 
-Object* _eval_call_function(Object* callee, Expr* expr, Env* env) {
-  Env* closure = callee->value->function->closure;
-  Object** arguments = malloc(sizeof(Object*) + sizeof(NULL));
-  Env* fn_env = new_env(closure, "function");
+static Value call_function(Function* function, Expr* expr, Env* env) {
+  Expr** args = expr->as.call.arguments;
+  int num_args = 0;
+  while (args[num_args] != NULL) {
+    num_args++;
+  }
+  if (function->native != NULL) {
+    for (int i = 0; i < num_args; i++) {
+      evaluate(args[i], env);
+    }
+    if (num_args != 0) {
+      log_error("Expected 0 arguments but got %d.", num_args);
+      return NIL_VAL;
+    }
+    return function->native();
+  }
+  Env* closure = function->closure;
+  StatementFunction* declaration = function->declaration;
+  StatementBlock* body = function_body(declaration);
+
+  // the parameters take the first slots of the frame, so a call has to
+  // fill every one of them
+  Token** params = declaration->params;
+  int num_params = 0;
+  while (params[num_params] != NULL) {
+    num_params++;
+  }
+  if (num_args != num_params) {
+    for (int i = 0; i < num_args; i++) {
+      evaluate(args[i], env);
+    }
+    log_error("Expected %d arguments but got %d.", num_params, num_args);
+    return NIL_VAL;
+  }
+  if (stack_exhausted()) {
+    log_error("Stack overflow.");
+    longjmp(overflow, 1);
+  }
 
-  int i = 0;
-  while (expr->u_expr->call->arguments[i] != NULL) {
-    arguments = realloc(arguments, sizeof(Object*) * (i + 1) + sizeof(NULL));
-    arguments[i] = evaluate(expr->u_expr->call->arguments[i], env);
-    // set the function arguments to params
-    env_define(fn_env, callee->value->function->declaration->params[i]->lexeme,
-               arguments[i]);
-    i++;
+  // the arguments are evaluated straight into the parameter slots, frames
+  // pushed meanwhile are popped before this one
+  Env* fn_env = push_frame(closure, body->num_slots, body->captured);
+  for (int i = 0; i < num_args; i++) {
+    fn_env->slots[i] = evaluate(args[i], env);
   }
+  fn_env->count = num_params;
 
   // set a global variable for function return value
-  latest_return_value = new_object();
+  latest_return_value = NIL_VAL;
   function_returned = false;
-  eval_block(callee->value->function->declaration->body, fn_env);
+  eval_block(declaration->body, fn_env);
   function_returned = false;
-  free(arguments);
-  free(fn_env);
+  pop_frame(fn_env, body->captured);
 
   // if function is initializer, return the instance
-  if (callee->value->function->is_initializer) {
-    return env_lookup(closure, "this");
+  if (function->is_initializer) {
+    return closure->slots[0];
   }
   // check the return value
   return latest_return_value;
 };
 
-Object* eval_grouping(Expr* expr, Env* env) {
-  return evaluate(expr->u_expr->grouping->expression, env);
+Value eval_grouping(Expr* expr, Env* env) {
+  return evaluate(expr->as.grouping.expression, env);
 };
 
-Object* eval_binary(Expr* expr, Env* env) {
-  Object* left = evaluate(expr->u_expr->binary->left, env);
-  Object* right = evaluate(expr->u_expr->binary->right, env);
-  Object* obj = new_object();
-  switch (expr->u_expr->binary->op->type) {
+// A binary node whose operands are both numbers rewrites itself into the
+// variant of its operator for numbers, which skips the operator dispatch
+// and type checks of the generic node.
+static ExprType number_variant(TokenType op) {
+  switch (op) {
+    case PLUS:
+      return E_AddNumbers;
+    case MINUS:
+      return E_SubtractNumbers;
+    case STAR:
+      return E_MultiplyNumbers;
+    case SLASH:
+      return E_DivideNumbers;
+    case LESS:
+      return E_LessNumbers;
+    case LESS_EQUAL:
+      return E_LessEqualNumbers;
     case GREATER:
-      check_number_operand(expr->u_expr->binary->op, left, right);
-      obj->type = V_BOOL;
-      obj->value->boolean = left->value->number > right->value->number;
-      break;
+      return E_GreaterNumbers;
     case GREATER_EQUAL:
-      check_number_operand(expr->u_expr->binary->op, left, right);
-      obj->type = V_BOOL;
-      obj->value->boolean = left->value->number >= right->value->number;
-      break;
+      return E_GreaterEqualNumbers;
+    case EQUAL_EQUAL:
+      return E_EqualNumbers;
+    case BANG_EQUAL:
+      return E_NotEqualNumbers;
+    default:
+      return E_Binary;
+  }
+};
+
+Value eval_binary(Expr* expr, Env* env) {
+  Value left = evaluate(expr->as.binary.left, env);
+  Value right = evaluate(expr->as.binary.right, env);
+  if (IS_NUMBER(left) && IS_NUMBER(right)) {
+    expr->type = number_variant(expr->as.binary.op->type);
+  }
+  return binary_values(expr->as.binary.op->type, left, right);
+};
+
+// Its guard hands operands of any other type to the generic node, which the
+// node turns back into until they are numbers again.
+static Value eval_number_binary(Expr* expr, Env* env) {
+  Value left = evaluate(expr->as.binary.left, env);
+  Value right = evaluate(expr->as.binary.right, env);
+  if (!IS_NUMBER(left) || !IS_NUMBER(right)) {
+    expr->type = E_Binary;
+    return binary_values(expr->as.binary.op->type, left, right);
+  }
+  double a = AS_NUMBER(left);
+  double b = AS_NUMBER(right);
+  switch (expr->type) {
+    case E_AddNumbers:
+      return NUMBER_VAL(a + b);
+    case E_SubtractNumbers:
+      return NUMBER_VAL(a - b);
+    case E_MultiplyNumbers:
+      return NUMBER_VAL(a * b);
+    case E_DivideNumbers:
+      return NUMBER_VAL(a / b);
+    case E_LessNumbers:
+      return BOOL_VAL(a < b);
+    case E_LessEqualNumbers:
+      return BOOL_VAL(a <= b);
+    case E_GreaterNumbers:
+      return BOOL_VAL(a > b);
+    case E_GreaterEqualNumbers:
+      return BOOL_VAL(a >= b);
+    case E_EqualNumbers:
+      return BOOL_VAL(a == b);
+    default:
+      return BOOL_VAL(a != b);
+  }
+};
+
+Value binary_values(TokenType op, Value left, Value right) {
+  switch (op) {
+    case GREATER:
+      check_number_operand(op, left, right);
+      return BOOL_VAL(AS_NUMBER(left) > AS_NUMBER(right));
+    case GREATER_EQUAL:
+      check_number_operand(op, left, right);
+      return BOOL_VAL(AS_NUMBER(left) >= AS_NUMBER(right));
     case LESS:
-      check_number_operand(expr->u_expr->binary->op, left, right);
-      obj->type = V_BOOL;
-      obj->value->boolean = left->value->number < right->value->number;
-      break;
+      check_number_operand(op, left, right);
+      return BOOL_VAL(AS_NUMBER(left) < AS_NUMBER(right));
     case LESS_EQUAL:
-      check_number_operand(expr->u_expr->binary->op, left, right);
-      obj->type = V_BOOL;
-      obj->value->boolean = left->value->number <= right->value->number;
-      break;
+      check_number_operand(op, left, right);
+      return BOOL_VAL(AS_NUMBER(left) <= AS_NUMBER(right));
     case BANG_EQUAL:
-      obj->type = V_BOOL;
-      obj->value->boolean = !is_equal(left, right);
-      break;
+      return BOOL_VAL(!is_equal(left, right));
     case EQUAL_EQUAL:
-      obj->type = V_BOOL;
-      obj->value->boolean = is_equal(left, right);
-      break;
+      return BOOL_VAL(is_equal(left, right));
     case MINUS:
-      check_number_operand(expr->u_expr->binary->op, left, right);
-      obj->type = V_NUMBER;
-      obj->value->number = left->value->number - right->value->number;
-      break;
+      check_number_operand(op, left, right);
+      return NUMBER_VAL(AS_NUMBER(left) - AS_NUMBER(right));
     case SLASH:
-      check_number_operand(expr->u_expr->binary->op, left, right);
-      obj->type = V_NUMBER;
-      obj->value->number = left->value->number / right->value->number;
-      break;
+      check_number_operand(op, left, right);
+      return NUMBER_VAL(AS_NUMBER(left) / AS_NUMBER(right));
     case STAR:
-      check_number_operand(expr->u_expr->binary->op, left, right);
-      obj->type = V_NUMBER;
-      obj->value->number = left->value->number * right->value->number;
-      break;
+      check_number_operand(op, left, right);
+      return NUMBER_VAL(AS_NUMBER(left) * AS_NUMBER(right));
     case PLUS:
-      if (left->type == V_NUMBER && right->type == V_NUMBER) {
-        obj->type = V_NUMBER;
-        obj->value->number =
-            (double)left->value->number + (double)right->value->number;
-      } else if (left->type == V_STRING && right->type == V_STRING) {
-        obj->type = V_STRING;
-        size_t len =
-            strlen(left->value->string) + strlen(right->value->string) + 1;
-        obj->value->string = (char*)malloc(len);
-        strcpy(obj->value->string, left->value->string);
-        strcat(obj->value->string, right->value->string);
-      } else {
-        log_error("%s Operand must be all number or string. %d %d",
-                  type_to_string(PLUS), left->type, right->type);
+      if (IS_NUMBER(left) && IS_NUMBER(right)) {
+        return NUMBER_VAL(AS_NUMBER(left) + AS_NUMBER(right));
+      } else if (IS_STRING(left) && IS_STRING(right)) {
+        size_t len = strlen(AS_STRING(left)) + strlen(AS_STRING(right)) + 1;
+        char* string = malloc(len);
+        strcpy(string, AS_STRING(left));
+        strcat(string, AS_STRING(right));
+        return STRING_VAL(string);
       }
-      break;
+      log_error("%s Operand must be all number or string. %d %d",
+                type_to_string(PLUS), value_type(left), value_type(right));
+      return NIL_VAL;
     default:
-      break;
+      return NIL_VAL;
   }
-  return obj;
 };
 
-Object* eval_assign(Expr* expr, Env* env) {
-  Object* obj = evaluate(expr->u_expr->assign->value, env);
-  Env* declare_env = find_declare_env(env, expr->u_expr->assign->depth);
-  return env_update(declare_env, expr->u_expr->assign->name->lexeme, obj);
+Value eval_assign(Expr* expr, Env* env) {
+  Value value = evaluate(expr->as.assign.value, env);
+  ExprAssign* assign = &expr->as.assign;
+  if (assign->depth < 0) {
+    Token* name = assign->name;
+    Global* global = find_global(&assign->slot, name->start, name->length);
+    if (!global->defined) {
+      log_error("Undefined variable '%.*s'.", name->length, name->start);
+    } else {
+      global->value = value;
+    }
+    return value;
+  }
+  find_declare_env(env, assign->depth)->slots[assign->slot] = value;
+  return value;
+};
+
+Value negate_value(Value value) {
+  if (!IS_NUMBER(value)) {
+    log_error("%s Operand must be a number. %d", type_to_string(MINUS),
+              value_type(value));
+    return NIL_VAL;
+  }
+  return NUMBER_VAL(-AS_NUMBER(value));
 };
 
-void check_number_operand(Token* op, Object* left, Object* right) {
-  if (left->type != V_NUMBER || right->type != V_NUMBER) {
-    log_error("%s Operand must be a number. %d %d", type_to_string(op->type),
-              left->type, right->type);
+void check_number_operand(TokenType op, Value left, Value right) {
+  if (!IS_NUMBER(left) || !IS_NUMBER(right)) {
+    log_error("%s Operand must be a number. %d %d", type_to_string(op),
+              value_type(left), value_type(right));
   }
 };
 
-Object* eval_logical(Expr* expr, Env* env) {
-  Object* left = evaluate(expr->u_expr->logical->left, env);
-  if (expr->u_expr->logical->op->type == OR) {
+Value eval_logical(Expr* expr, Env* env) {
+  Value left = evaluate(expr->as.logical.left, env);
+  if (expr->as.logical.op->type == OR) {
     if (is_logical_truthy(left)) {
       return left;
     }
@@ -550,79 +934,34 @@ Object* eval_logical(Expr* expr, Env* env) {
       return left;
     }
   }
-  return evaluate(expr->u_expr->logical->right, env);
+  return evaluate(expr->as.logical.right, env);
 };
 
-char* stringify(Object* obj) {
-  if (obj == NULL)
-    return "nil";
-  switch (obj->type) {
-    case V_NIL:
-      return "nil";
-    case V_STRING: {
-      char* str = (char*)malloc(strlen(obj->value->string) + 1);
-      strcpy(str, obj->value->string);
-      return str;
-    }
-    case V_BOOL:
-      return obj->value->boolean == true ? "true" : "false";
-    case V_NUMBER: {
-      char buf[50];
-      sprintf(buf, "%.1f", obj->value->number);
-      char* s = strdup(buf);
-      return s;
-    }
-    default:
-      return "nil";
-  }
-};
-
-// only true is true, else is false, used for if/while
-bool is_truthy(Object* obj) {
-  if (obj == NULL)
-    return false;
-  if (obj->type == V_BOOL)
-    return obj->value->boolean;
-  return false;
+void print_value(Value value) {
+  log_info("%s\n", stringify(value));
 };
 
-// only false and nil is logical false, used for or/and
-bool is_logical_truthy(Object* obj) {
-  if (obj == NULL) {
-    return false;
-  }
-  if (obj->type == V_NIL) {
-    return false;
-  }
-  if (obj->type == V_BOOL && obj->value->boolean == false) {
-    return false;
-  }
-  return true;
-};
-
-bool is_equal(Object* a, Object* b) {
-  if (a == NULL && b == NULL)
-    return true;
-  if (a == NULL || b == NULL)
-    return false;
-
-  if (a->type != b->type)
-    return false;
-
-  switch (a->type) {
+char* stringify(Value value) {
+  static char number[50];
+  switch (value_type(value)) {
+    case V_STRING:
+      return AS_STRING(value);
     case V_BOOL:
-      return a->value->boolean == b->value->boolean;
-    case V_NIL:
-      return a->value->nil == b->value->nil;
+      return AS_BOOL(value) ? "true" : "false";
     case V_NUMBER:
-      return a->value->number = b->value->number;
-    case V_STRING:
-      if (a->value->string == NULL && b->value->string == NULL)
-        return true;
-      else if ((a->value->string == NULL) || (b->value->string == NULL) ||
-               (strcmp(a->value->string, b->value->string) != 0))
-        return false;
+      snprintf(number, sizeof(number), "%.1f", AS_NUMBER(value));
+      return number;
     default:
-      return false;
+      return "nil";
   }
 };
+
+// Numbers compare as doubles, so NaN is unequal to itself, and strings by
+// their text. Any other value is only equal to itself.
+bool is_equal(Value a, Value b) {
+  if (IS_NUMBER(a) && IS_NUMBER(b))
+    return AS_NUMBER(a) == AS_NUMBER(b);
+  if (IS_STRING(a) && IS_STRING(b))
+    return strcmp(AS_STRING(a), AS_STRING(b)) == 0;
+  return a == b;
+};
@@ -1,22 +1,95 @@
 #include "include/lexer.h"
-#include <ctype.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "include/token.h"
 
-void scan_token(Lexer* lexer);
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Every byte of the source is classified with a single table lookup, the
+// scanner dispatches on the class instead of testing characters one by one.
+enum CharClass {
+  CC_INVALID = 0,
+  CC_SPACE,
+  CC_NEWLINE,
+  CC_SINGLE,    // one character token
+  CC_OPERATOR,  // one character token, or two when followed by '='
+  CC_SLASH,
+  CC_QUOTE,
+  // classes that may continue an identifier must stay last
+  CC_DIGIT,
+  CC_ALPHA,
+};
+
+static const unsigned char char_class[256] = {
+    [' '] = CC_SPACE,       ['\t'] = CC_SPACE,      ['\r'] = CC_SPACE,
+    ['\n'] = CC_NEWLINE,    ['('] = CC_SINGLE,      [')'] = CC_SINGLE,
+    ['{'] = CC_SINGLE,      ['}'] = CC_SINGLE,      [','] = CC_SINGLE,
+    ['.'] = CC_SINGLE,      ['-'] = CC_SINGLE,      ['+'] = CC_SINGLE,
+    [';'] = CC_SINGLE,      ['*'] = CC_SINGLE,      ['!'] = CC_OPERATOR,
+    ['='] = CC_OPERATOR,    ['<'] = CC_OPERATOR,    ['>'] = CC_OPERATOR,
+    ['/'] = CC_SLASH,       ['"'] = CC_QUOTE,       ['_'] = CC_ALPHA,
+    ['0' ... '9'] = CC_DIGIT,
+    ['a' ... 'z'] = CC_ALPHA,
+    ['A' ... 'Z'] = CC_ALPHA,
+};
+
+// token type of CC_SINGLE and CC_OPERATOR characters, the `X_EQUAL` variant
+// of an operator always directly follows it in TokenType
+static const TokenType char_token[256] = {
+    ['('] = LEFT_PAREN, [')'] = RIGHT_PAREN, ['{'] = LEFT_BRACE,
+    ['}'] = RIGHT_BRACE, [','] = COMMA,      ['.'] = DOT,
+    ['-'] = MINUS,      ['+'] = PLUS,        [';'] = SEMICOLON,
+    ['*'] = STAR,       ['!'] = BANG,        ['='] = EQUAL,
+    ['<'] = LESS,       ['>'] = GREATER,
+};
+
+// SIMD helpers: `simd_eq` returns a bitmask with one bit per byte of the
+// block that equals `c`.
+#if defined(__AVX2__)
+#define SIMD_WIDTH 32
+#define SIMD_FULL 0xFFFFFFFFu
+typedef __m256i simd_block;
+#define simd_load(p) _mm256_loadu_si256((const __m256i*)(p))
+#define simd_eq(v, c) \
+  ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8((v), _mm256_set1_epi8(c))))
+#elif defined(__SSE2__)
+#define SIMD_WIDTH 16
+#define SIMD_FULL 0xFFFFu
+typedef __m128i simd_block;
+#define simd_load(p) _mm_loadu_si128((const __m128i*)(p))
+#define simd_eq(v, c) \
+  ((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8((v), _mm_set1_epi8(c))))
+#endif
+
+// bits of `mask` below bit `n`, n is always less than SIMD_WIDTH
+#define BITS_BELOW(mask, n) ((mask) & ((1u << (n)) - 1))
+
+// scan_tokens_parallel gives each thread at least this many bytes
+#define PARALLEL_MIN_CHUNK (64 * 1024)
+#define PARALLEL_MAX_THREADS 64
+
+Token lex_next(Lexer* lexer);
+
+bool scan_token(Lexer* lexer, Token* token);
+
+bool lex_error(Lexer* lexer, const char* message);
 
 char advance(Lexer* lexer);
 
-void add_token(Lexer* lexer, TokenType type);
+Token make_token(Lexer* lexer, TokenType type);
 
-void add_token_with_literal(Lexer* lexer,
-                            TokenType type,
-                            char* lexeme,
-                            Literal* literal);
+Token make_token_view(Lexer* lexer,
+                      TokenType type,
+                      const char* start,
+                      const char* end);
 
-void _add_token(Lexer* lexer, Token* token);
+void _add_token(Lexer* lexer, Token token);
 
 bool is_at_end(Lexer* lexer);
 
@@ -26,164 +99,444 @@ char peek(Lexer* lexer);
 
 char peek_next(Lexer* lexer);
 
-void parse_string(Lexer* lexer);
+void skip_whitespace(Lexer* lexer);
+
+const char* find_byte(const char* p, const char* end, char c);
+
+const char* find_quote(const char* p, const char* end, int* lines);
+
+Token parse_string(Lexer* lexer);
 
 bool is_digit(char c);
 
-void parse_number(Lexer* lexer);
+Token parse_number(Lexer* lexer);
 
-void parse_identifier(Lexer* lexer);
+Token parse_identifier(Lexer* lexer);
 
-char* substr(const char* src, int start, int end);
+double parse_decimal(const char* start, int length);
 
-bool is_alpha(char c);
+double slice_to_double(const char* start, int length);
 
-Lexer* new_lexer(char* source) {
+Lexer* new_lexer(const char* source, size_t length) {
   Lexer* lexer = calloc(1, sizeof(Lexer));
   lexer->source = source;
-  lexer->start = 0;
-  lexer->current = 0;
+  lexer->start = source;
+  lexer->current = source;
+  // every bounds check compares against this pointer
+  lexer->end = source + length;
   lexer->line = 0;
+  lexer->tokens = NULL;
   lexer->num_tokens = 0;
-  lexer->tokens = calloc(1, sizeof(Token*));
+  lexer->capacity = 0;
+  lexer->next = 0;
   return lexer;
 };
 
+void free_lexer(Lexer* lexer) {
+  free(lexer->tokens);
+  free(lexer);
+}
+
 void print_lexer(Lexer* lexer) {
   for (int i = 0; i < lexer->num_tokens; i++) {
-    Token* token = lexer->tokens[i];
-    print_token(token);
+    print_token(&lexer->tokens[i]);
   }
 }
 
-Token** scan_tokens(Lexer* lexer) {
-  while (!is_at_end(lexer)) {
+Token next_token(Lexer* lexer) {
+  if (lexer->tokens != NULL) {
+    // replay the scanned tokens, the last one is E_O_F
+    int i = lexer->next;
+    if (i < lexer->num_tokens - 1)
+      lexer->next++;
+    return lexer->tokens[i];
+  }
+  return lex_next(lexer);
+}
+
+Token lex_next(Lexer* lexer) {
+  Token token;
+  do {
+    skip_whitespace(lexer);
     lexer->start = lexer->current;
-    scan_token(lexer);
-  };
-  add_token(lexer, E_O_F);
+    if (is_at_end(lexer))
+      return make_token(lexer, E_O_F);
+  } while (!scan_token(lexer, &token));
+  return token;
+}
+
+Token* scan_tokens(Lexer* lexer) {
+  Token token;
+  do {
+    token = lex_next(lexer);
+    _add_token(lexer, token);
+  } while (token.type != E_O_F);
+  return lexer->tokens;
+}
+
+// Parallel lexing. Tokens never span a newline except inside a string, and
+// a comment always ends at one, so right after a newline that is not inside
+// a string the serial lexer is between tokens. The source is cut into
+// regions starting after a newline, which can only start inside or outside a
+// string. Each region is pre-scanned for both cases in parallel, a serial
+// pass over the regions picks the real case and moves cuts that fall inside
+// a string to the next safe newline, then the chunks are lexed in parallel
+// from line 0 and stitched together with their line offsets.
+typedef struct Region {
+  const char* begin;
+  const char* end;
+  // indexed by whether the region starts inside a string
+  bool ends_in_string[2];
+  // first byte after a newline outside any string, NULL if there is none
+  const char* first_safe[2];
+} Region;
+
+typedef struct Chunk {
+  Lexer lexer;
+  // where the chunk's tokens go in the stitched array, and the number of
+  // lines before the chunk
+  Token* out;
+  int line;
+} Chunk;
+
+// state machine of the pre-scan, it follows strings and comments exactly
+// like scan_token does
+static const char* scan_region(const char* p,
+                               const char* end,
+                               bool in_string,
+                               bool* ends_in_string) {
+  const char* safe = NULL;
+  while (p < end) {
+    if (in_string) {
+      p = find_byte(p, end, '"');
+      if (p == end)
+        break;
+      p++;
+      in_string = false;
+      continue;
+    }
+    char c = *p++;
+    if (c == '"') {
+      in_string = true;
+    } else if (c == '/' && p < end && *p == '/') {
+      // the newline ending the comment is seen by the next iteration
+      p = find_byte(p, end, '\n');
+    } else if (c == '\n' && safe == NULL) {
+      safe = p;
+    }
+  }
+  *ends_in_string = in_string;
+  return safe;
+}
+
+static void* prescan_region(void* arg) {
+  Region* region = arg;
+  for (int in_string = 0; in_string < 2; in_string++) {
+    region->first_safe[in_string] =
+        scan_region(region->begin, region->end, in_string,
+                    &region->ends_in_string[in_string]);
+  }
+  return NULL;
+}
+
+static void* lex_chunk(void* arg) {
+  Chunk* chunk = arg;
+  Token token;
+  do {
+    token = lex_next(&chunk->lexer);
+    _add_token(&chunk->lexer, token);
+  } while (token.type != E_O_F);
+  return NULL;
+}
+
+// copy a chunk's tokens, without its E_O_F, to their place in the result
+static void* stitch_chunk(void* arg) {
+  Chunk* chunk = arg;
+  int count = chunk->lexer.num_tokens - 1;
+  memcpy(chunk->out, chunk->lexer.tokens, sizeof(Token) * count);
+  for (int i = 0; i < count; i++) {
+    chunk->out[i].line += chunk->line;
+  }
+  return NULL;
+}
+
+// run `work` on each of the `count` items of `items` on its own thread
+static void run_threads(void* (*work)(void*),
+                        void* items,
+                        size_t item_size,
+                        int count) {
+  pthread_t threads[PARALLEL_MAX_THREADS];
+  for (int i = 0; i < count; i++) {
+    if (pthread_create(&threads[i], NULL, work,
+                       (char*)items + i * item_size) != 0) {
+      fprintf(stderr, "Lexer Error: Could not create thread.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (int i = 0; i < count; i++) {
+    pthread_join(threads[i], NULL);
+  }
+}
+
+Token* scan_tokens_parallel(Lexer* lexer, int num_threads) {
+  if (num_threads <= 0)
+    num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  const char* source = lexer->current;
+  size_t length = lexer->end - source;
+  if ((size_t)num_threads > length / PARALLEL_MIN_CHUNK)
+    num_threads = (int)(length / PARALLEL_MIN_CHUNK);
+  if (num_threads > PARALLEL_MAX_THREADS)
+    num_threads = PARALLEL_MAX_THREADS;
+  if (num_threads < 2)
+    return scan_tokens(lexer);
+
+  Region regions[PARALLEL_MAX_THREADS];
+  const char* begin = source;
+  for (int i = 0; i < num_threads; i++) {
+    const char* end = lexer->end;
+    if (i < num_threads - 1) {
+      end = source + length * (i + 1) / num_threads;
+      if (end < begin)
+        end = begin;
+      end = find_byte(end, lexer->end, '\n');
+      if (end < lexer->end)
+        end++;
+    }
+    regions[i].begin = begin;
+    regions[i].end = end;
+    begin = end;
+  }
+  run_threads(prescan_region, regions, sizeof(Region), num_threads);
+
+  // A region starting inside a string is cut at its first safe newline
+  // instead, a region without one is merged into the previous chunk.
+  Chunk* chunks = calloc(num_threads, sizeof(Chunk));
+  int num_chunks = 0;
+  bool in_string = false;
+  for (int i = 0; i < num_threads; i++) {
+    const char* start = in_string ? regions[i].first_safe[1] : regions[i].begin;
+    in_string = regions[i].ends_in_string[in_string];
+    if (start == NULL)
+      continue;
+    if (num_chunks > 0)
+      chunks[num_chunks - 1].lexer.end = start;
+    Lexer* chunk = &chunks[num_chunks++].lexer;
+    chunk->source = lexer->source;
+    chunk->start = start;
+    chunk->current = start;
+    chunk->end = lexer->end;
+    chunk->chunk = true;
+  }
+  run_threads(lex_chunk, chunks, sizeof(Chunk), num_chunks);
+
+  // An error is reported by rescanning serially, which exits with the same
+  // message and line as the serial lexer.
+  int total = 1;
+  int lines = lexer->line;
+  for (int i = 0; i < num_chunks; i++) {
+    if (chunks[i].lexer.failed) {
+      for (int j = 0; j < num_chunks; j++) {
+        free(chunks[j].lexer.tokens);
+      }
+      free(chunks);
+      return scan_tokens(lexer);
+    }
+    chunks[i].line = lines;
+    lines += chunks[i].lexer.line;
+    total += chunks[i].lexer.num_tokens - 1;
+  }
+
+  lexer->tokens = realloc(lexer->tokens, sizeof(Token) * total);
+  if (lexer->tokens == NULL) {
+    fprintf(stderr, "Lexer Error: Memory allocation failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  Token* out = lexer->tokens;
+  for (int i = 0; i < num_chunks; i++) {
+    chunks[i].out = out;
+    out += chunks[i].lexer.num_tokens - 1;
+  }
+  run_threads(stitch_chunk, chunks, sizeof(Chunk), num_chunks);
+  for (int i = 0; i < num_chunks; i++) {
+    free(chunks[i].lexer.tokens);
+  }
+  free(chunks);
+
+  lexer->current = lexer->end;
+  lexer->start = lexer->end;
+  lexer->line = lines;
+  *out = make_token(lexer, E_O_F);
+  lexer->num_tokens = total;
+  lexer->capacity = total;
   return lexer->tokens;
 }
 
-void scan_token(Lexer* lexer) {
+// scan the token starting at lexer->start, returns false when the
+// characters did not produce a token (a comment)
+bool scan_token(Lexer* lexer, Token* token) {
   char c = advance(lexer);
-  switch (c) {
-    case '(':
-      add_token(lexer, LEFT_PAREN);
-      break;
-    case ')':
-      add_token(lexer, RIGHT_PAREN);
-      break;
-    case '{':
-      add_token(lexer, LEFT_BRACE);
-      break;
-    case '}':
-      add_token(lexer, RIGHT_BRACE);
-      break;
-    case ',':
-      add_token(lexer, COMMA);
-      break;
-    case '.':
-      add_token(lexer, DOT);
-      break;
-    case '-':
-      add_token(lexer, MINUS);
-      break;
-    case '+':
-      add_token(lexer, PLUS);
-      break;
-    case ';':
-      add_token(lexer, SEMICOLON);
-      break;
-    case '*':
-      add_token(lexer, STAR);
-      break;
+  switch (char_class[(unsigned char)c]) {
+    case CC_SINGLE:
+      *token = make_token(lexer, char_token[(unsigned char)c]);
+      return true;
     // look second char
-    case '!':
-      add_token(lexer, match(lexer, '=') ? BANG_EQUAL : BANG);
-      break;
-    case '=':
-      add_token(lexer, match(lexer, '=') ? EQUAL_EQUAL : EQUAL);
-      break;
-    case '<':
-      add_token(lexer, match(lexer, '=') ? LESS_EQUAL : LESS);
-      break;
-    case '>':
-      add_token(lexer, match(lexer, '=') ? GREATER_EQUAL : GREATER);
-      break;
+    case CC_OPERATOR: {
+      TokenType type = char_token[(unsigned char)c];
+      *token = make_token(lexer, match(lexer, '=') ? type + 1 : type);
+      return true;
+    }
     // handle comment
-    case '/':
+    case CC_SLASH:
       if (match(lexer, '/')) {
         // A comment goes until the end of line.
-        while (peek(lexer) != '\n' && !is_at_end(lexer))
-          advance(lexer);
-      } else {
-        add_token(lexer, SLASH);
+        lexer->current = find_byte(lexer->current, lexer->end, '\n');
+        return false;
       }
-      // skip whitespace
-    case ' ':
-    case '\r':
-    case '\t':
-      break;
-    case '\n':
-      lexer->line++;
-      break;
-    case '"':
-      parse_string(lexer);
-      break;
+      *token = make_token(lexer, SLASH);
+      return true;
+    case CC_QUOTE:
+      *token = parse_string(lexer);
+      return true;
+    case CC_DIGIT:
+      *token = parse_number(lexer);
+      return true;
+    case CC_ALPHA:
+      *token = parse_identifier(lexer);
+      return true;
     default:
-      if (is_digit(c)) {
-        parse_number(lexer);
-      } else if (is_alpha(c)) {
-        parse_identifier(lexer);
-      } else {
-        fprintf(stderr, "Lexer Error: Unexpected character at %d.\n",
-                lexer->line);
-        exit(EXIT_FAILURE);
-      }
+      return lex_error(lexer, "Unexpected character");
+  }
+}
+
+// report a lexing error and exit, a chunk lexer only records it and skips to
+// the end of its chunk
+bool lex_error(Lexer* lexer, const char* message) {
+  if (lexer->chunk) {
+    lexer->failed = true;
+    lexer->current = lexer->end;
+    return false;
+  }
+  fprintf(stderr, "Lexer Error: %s at %d.\n", message, lexer->line);
+  exit(EXIT_FAILURE);
+}
+
+// Skip a run of spaces, tabs and newlines, counting the newlines. With SIMD
+// a whole block is classified at once and the run end found with ctz.
+void skip_whitespace(Lexer* lexer) {
+  const char* p = lexer->current;
+  int lines = 0;
+#ifdef SIMD_WIDTH
+  while (lexer->end - p >= SIMD_WIDTH) {
+    simd_block block = simd_load(p);
+    uint32_t newlines = simd_eq(block, '\n');
+    uint32_t spaces = simd_eq(block, ' ') | simd_eq(block, '\t') |
+                      simd_eq(block, '\r') | newlines;
+    if (spaces != SIMD_FULL) {
+      int n = __builtin_ctz(~spaces);
+      lexer->current = p + n;
+      lexer->line += lines + __builtin_popcount(BITS_BELOW(newlines, n));
+      return;
+    }
+    lines += __builtin_popcount(newlines);
+    p += SIMD_WIDTH;
+  }
+#endif
+  while (p < lexer->end) {
+    unsigned char cc = char_class[(unsigned char)*p];
+    if (cc == CC_NEWLINE) {
+      lines++;
+    } else if (cc != CC_SPACE) {
       break;
+    }
+    p++;
+  }
+  lexer->current = p;
+  lexer->line += lines;
+}
+
+// memchr-style search, returns `end` when `c` is not found
+const char* find_byte(const char* p, const char* end, char c) {
+#ifdef SIMD_WIDTH
+  while (end - p >= SIMD_WIDTH) {
+    uint32_t found = simd_eq(simd_load(p), c);
+    if (found != 0) {
+      return p + __builtin_ctz(found);
+    }
+    p += SIMD_WIDTH;
+  }
+#endif
+  while (p < end && *p != c)
+    p++;
+  return p;
+}
+
+// find the closing quote of a string body and count the newlines before it,
+// returns `end` for an unterminated string
+const char* find_quote(const char* p, const char* end, int* lines) {
+#ifdef SIMD_WIDTH
+  while (end - p >= SIMD_WIDTH) {
+    simd_block block = simd_load(p);
+    uint32_t quotes = simd_eq(block, '"');
+    uint32_t newlines = simd_eq(block, '\n');
+    if (quotes != 0) {
+      int n = __builtin_ctz(quotes);
+      *lines += __builtin_popcount(BITS_BELOW(newlines, n));
+      return p + n;
+    }
+    *lines += __builtin_popcount(newlines);
+    p += SIMD_WIDTH;
+  }
+#endif
+  while (p < end && *p != '"') {
+    if (*p == '\n')
+      (*lines)++;
+    p++;
   }
+  return p;
 }
 
 char advance(Lexer* lexer) {
   if (!is_at_end(lexer)) {
-    return lexer->source[lexer->current++];
+    return *lexer->current++;
   }
   return '\0';
 }
 
-void add_token(Lexer* lexer, TokenType type) {
-  _add_token(lexer, new_token(type, NULL, NULL, lexer->line));
+Token make_token(Lexer* lexer, TokenType type) {
+  return make_token_view(lexer, type, lexer->start, lexer->current);
 }
 
-void add_token_with_literal(Lexer* lexer,
-                            TokenType type,
-                            char* lexeme,
-                            Literal* literal) {
-  _add_token(lexer, new_token(type, lexeme, literal, lexer->line));
-  free(lexeme);
+// a token whose lexeme is [start, end) of the source, nothing is copied
+Token make_token_view(Lexer* lexer,
+                      TokenType type,
+                      const char* start,
+                      const char* end) {
+  Token token = {type, start, end - start, lexer->line, 0};
+  return token;
 };
 
-void _add_token(Lexer* lexer, Token* token) {
+void _add_token(Lexer* lexer, Token token) {
   int len = lexer->num_tokens;
-  lexer->tokens = realloc(lexer->tokens, sizeof(Token*) * (len + 1));
-  if (lexer->tokens == NULL) {
-    fprintf(stderr, "Lexer Error: Memory allocation failed.\n");
-    exit(EXIT_FAILURE);
+  if (len == lexer->capacity) {
+    lexer->capacity = lexer->capacity < 64 ? 64 : lexer->capacity * 2;
+    lexer->tokens = realloc(lexer->tokens, sizeof(Token) * lexer->capacity);
+    if (lexer->tokens == NULL) {
+      fprintf(stderr, "Lexer Error: Memory allocation failed.\n");
+      exit(EXIT_FAILURE);
+    }
   }
   lexer->num_tokens = len + 1;
   lexer->tokens[len] = token;
 }
 
 bool is_at_end(Lexer* lexer) {
-  return lexer->current >= (int)strlen(lexer->source) ||
-         lexer->source[lexer->current] == '\0';
+  return lexer->current >= lexer->end;
 };
 
 bool match(Lexer* lexer, char expected) {
   if (is_at_end(lexer))
     return false;
-  if (lexer->source[lexer->current] != expected)
+  if (*lexer->current != expected)
     return false;
   lexer->current++;
   return true;
@@ -192,40 +545,34 @@ bool match(Lexer* lexer, char expected) {
 char peek(Lexer* lexer) {
   if (is_at_end(lexer))
     return '\0';
-  return lexer->source[lexer->current];
+  return *lexer->current;
 };
 
 char peek_next(Lexer* lexer) {
-  if (lexer->current + 1 >= (int)strlen(lexer->source))
+  if (lexer->current + 1 >= lexer->end)
     return '\0';
-  return lexer->source[lexer->current + 1];
+  return lexer->current[1];
 };
 
-void parse_string(Lexer* lexer) {
-  while (peek(lexer) != '"' && !is_at_end(lexer)) {
-    if (peek(lexer) == '\n')
-      lexer->line++;
-    advance(lexer);
-  }
+Token parse_string(Lexer* lexer) {
+  int lines = 0;
+  const char* quote = find_quote(lexer->current, lexer->end, &lines);
+  lexer->line += lines;
+  lexer->current = quote;
 
   if (is_at_end(lexer)) {
-    fprintf(stderr, "Lexer Error: Unterminated string at %d.\n", lexer->line);
-    exit(EXIT_FAILURE);
-    return;
+    lex_error(lexer, "Unterminated string");
+    return make_token(lexer, E_O_F);
   }
 
   // The closing ".
   advance(lexer);
 
   // Trim the surrounding quotes.
-  char* lexeme = substr(lexer->source, lexer->start + 1, lexer->current - 1);
-
-  Literal* literal = (Literal*)malloc(sizeof(Literal));
-  literal->string = strdup(lexeme);
-  add_token_with_literal(lexer, STRING, lexeme, literal);
+  return make_token_view(lexer, STRING, lexer->start + 1, lexer->current - 1);
 };
 
-void parse_number(Lexer* lexer) {
+Token parse_number(Lexer* lexer) {
   while (is_digit(peek(lexer)))
     advance(lexer);
 
@@ -238,45 +585,67 @@ void parse_number(Lexer* lexer) {
       advance(lexer);
   }
 
-  char* lexeme = substr(lexer->source, lexer->start, lexer->current);
-  double n = atof(lexeme);
-  Literal* literal = (Literal*)malloc(sizeof(Literal));
-  literal->number = n;
-  add_token_with_literal(lexer, NUMBER, lexeme, literal);
+  Token token = make_token(lexer, NUMBER);
+  token.number = parse_decimal(token.start, token.length);
+  return token;
 };
 
-void parse_identifier(Lexer* lexer) {
-  while (isalnum((unsigned char)peek(lexer)))
-    advance(lexer);
-  char* lexeme = substr(lexer->source, lexer->start, lexer->current);
-  TokenType type = map_keyword(lexeme);
+Token parse_identifier(Lexer* lexer) {
+  while (!is_at_end(lexer) &&
+         char_class[(unsigned char)*lexer->current] >= CC_DIGIT)
+    lexer->current++;
+  TokenType type =
+      map_keyword(lexer->start, (int)(lexer->current - lexer->start));
   if (type != (TokenType)-1) {  // keywords
-    add_token(lexer, type);
-  } else {  // identifier
-    Literal* literal = (Literal*)malloc(sizeof(Literal));
-    literal->identifier = strdup(lexeme);
-    add_token_with_literal(lexer, IDENTIFIER, lexeme, literal);
+    return make_token(lexer, type);
   }
+  // identifier
+  return make_token(lexer, IDENTIFIER);
 };
 
-char* substr(const char* src, int start, int end) {
-  int len = end - start;
-  char* dest = (char*)malloc(
-      (len + 1) * sizeof(char));  // Allocate memory for the destination string
-  if (dest == NULL) {
-    fprintf(stderr, "Lexer Error: Memory allocation failed.\n");
-    return NULL;
+// powers of ten that are exact doubles
+static const double exact_powers_of_ten[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// Clinger's fast path: when the digits without the dot form an integer below
+// 2^53 and there are at most 22 fraction digits, the integer and the power
+// of ten are both exact doubles, so one correctly rounded division gives the
+// correctly rounded value. Other literals go through strtod.
+double parse_decimal(const char* start, int length) {
+  uint64_t mantissa = 0;
+  int fraction = 0;
+  bool after_dot = false;
+  for (int i = 0; i < length; i++) {
+    if (start[i] == '.') {
+      after_dot = true;
+      continue;
+    }
+    if (mantissa >= (1ULL << 53) / 10)
+      return slice_to_double(start, length);
+    mantissa = mantissa * 10 + (start[i] - '0');
+    fraction += after_dot;
   }
+  if (fraction > 22)
+    return slice_to_double(start, length);
+  return (double)mantissa / exact_powers_of_ten[fraction];
+}
 
-  strncpy(dest, src + start, len);
-  dest[len] = '\0';
-  return dest;
+// strtod needs a terminated string and must not read past the literal (e.g.
+// "1e5" is the number 1 followed by an identifier), so copy the digits to a
+// buffer on the stack first
+double slice_to_double(const char* start, int length) {
+  char buf[64];
+  char* digits = length < (int)sizeof(buf) ? buf : malloc(length + 1);
+  memcpy(digits, start, length);
+  digits[length] = '\0';
+  double n = strtod(digits, NULL);
+  if (digits != buf)
+    free(digits);
+  return n;
 }
 
 bool is_digit(char c) {
-  return c >= '0' && c <= '9';
-};
-
-bool is_alpha(char c) {
-  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+  return char_class[(unsigned char)c] == CC_DIGIT;
 };
@@ -1,36 +1,305 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "include/cache.h"
+#include "include/closure_compiler.h"
+#include "include/flat_ast.h"
 #include "include/interpreter.h"
 #include "include/lexer.h"
 #include "include/parser.h"
 #include "include/resolver.h"
+#include "include/source.h"
+#include "include/vm.h"
 
-int main(int argc, char** argv) {
-  if (argc < 2) {
-    printf("Usage: %s <source>\n", argv[0]);
+// inputs smaller than this are repeated for the lexer benchmark, so the
+// timing reflects throughput on large files rather than startup cost
+#define BENCH_MIN_BYTES (16 * 1024 * 1024)
+#define BENCH_ROUNDS 5
+
+// what runs a program once it is compiled
+typedef enum Engine {
+  // walk the AST
+  ENGINE_TREE,
+  // compile it to bytecode for the stack VM
+  ENGINE_VM,
+  // compile it to nodes that run through pre-bound functions
+  ENGINE_CLOSURE,
+} Engine;
+
+// options of a normal run
+typedef struct Options {
+  int lex_threads;
+  int parse_threads;
+  // run the program from the flat AST instead of the parser's tree
+  bool flat_ast;
+  // print the size of both AST representations
+  bool ast_stats;
+  // parse function bodies on their first call
+  bool lazy_parse;
+  // where compiled programs are cached, NULL to always compile
+  char* cache_dir;
+  Engine engine;
+} Options;
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// lex the file BENCH_ROUNDS times and report the best throughput in MB/s,
+// with `lex_threads` other than 1 the parallel lexer is measured
+static int bench_lexer(char* path, int lex_threads) {
+  Source* file = load_source(path);
+  if (file == NULL) {
     return 1;
   }
-  char* path = argv[1];
-  FILE* file = fopen(path, "r");
-  if (file == NULL) {
-    printf("Error: Could not open file %s\n", path);
+  size_t length = file->length;
+  if (length == 0) {
+    printf("Error: %s is empty\n", path);
     return 1;
   }
-  fseek(file, 0, SEEK_END);
-  size_t length = ftell(file);
-  fseek(file, 0, SEEK_SET);
-  char* source = malloc(length + 1);
-  fread(source, 1, length, file);
-  fclose(file);
-  source[length] = '\0';
 
-  Lexer* lexer = new_lexer(source);
-  Token** tokens = scan_tokens(lexer);
+  size_t copies = (BENCH_MIN_BYTES + length - 1) / length;
+  size_t size = copies * (length + 1);
+  char* source = malloc(size);
+  for (size_t i = 0; i < copies; i++) {
+    memcpy(source + i * (length + 1), file->data, length);
+    source[i * (length + 1) + length] = '\n';
+  }
+  free_source(file);
+
+  double best = 0;
+  int num_tokens = 0;
+  for (int round = 0; round < BENCH_ROUNDS; round++) {
+    double start = now_seconds();
+    Lexer* lexer = new_lexer(source, size);
+    if (lex_threads == 1) {
+      num_tokens = 1;
+      while (next_token(lexer).type != E_O_F) {
+        num_tokens++;
+      }
+    } else {
+      scan_tokens_parallel(lexer, lex_threads);
+      num_tokens = lexer->num_tokens;
+    }
+    double elapsed = now_seconds() - start;
+    free_lexer(lexer);
+    if (best == 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  printf("lexed %.1f MB, %d tokens in %.3f s: %.1f MB/s\n", size / 1e6,
+         num_tokens, best, size / 1e6 / best);
+  free(source);
+  return 0;
+}
+
+// dump the token stream of a file
+static int print_tokens(char* path, int lex_threads) {
+  Source* source = load_source(path);
+  if (source == NULL) {
+    return 1;
+  }
+  Lexer* lexer = new_lexer(source->data, source->length);
+  scan_tokens_parallel(lexer, lex_threads);
   print_lexer(lexer);
-  Parser* parser = new_parser(tokens, lexer->num_tokens);
-  Statement** statements = parse(parser);
-  Resolver* resolver = new_resolver();
-  resolve(resolver, statements);
-  interpret(statements);
+  free_lexer(lexer);
+  free_source(source);
   return 0;
 }
+
+// Lex, parse and resolve a source into a program in a new arena, which is
+// cached when `options` has a cache directory and it compiled cleanly. A
+// lazy parse leaves bodies unresolved, whose errors are not known yet, so
+// its program is not cached.
+static Statement** compile(Source* source,
+                           ConstantPool* constants,
+                           SymbolTable* globals,
+                           Options* options,
+                           Arena** arena,
+                           uint64_t key) {
+  // the parser pulls tokens from the lexer as it goes, the token stream is
+  // only materialized when it is lexed or parsed in parallel
+  Lexer* lexer = new_lexer(source->data, source->length);
+  if (options->lex_threads != 1 || options->parse_threads != 1) {
+    scan_tokens_parallel(lexer, options->lex_threads);
+  }
+  Parser* parser = new_parser(lexer, constants);
+  parser->lazy = options->lazy_parse;
+  Statement** statements = options->parse_threads != 1
+                               ? parse_parallel(parser, options->parse_threads)
+                               : parse(parser);
+  Resolver* resolver = new_resolver(globals);
+  resolve(resolver, statements);
+  *arena = parser->arena;
+  if (options->cache_dir != NULL && !options->lazy_parse &&
+      !parser->had_error && !resolver->had_error) {
+    store_cached_program(options->cache_dir, key, source, statements,
+                         constants);
+  }
+  if (options->flat_ast || options->ast_stats) {
+    FlatAst* flat = flatten_ast(statements, source->data, source->length);
+    if (options->ast_stats) {
+      printf("%s: %u nodes, %u tokens, tree %zu bytes, flat %zu bytes\n",
+             source->path, flat->num_nodes - 1, flat->num_tokens - 1,
+             (*arena)->allocated, flat_ast_size(flat));
+    }
+    if (options->flat_ast) {
+      free_arena(*arena);
+      *arena = new_arena();
+      statements = inflate_ast(flat, *arena, source->data, NULL);
+    }
+    free_flat_ast(flat);
+  }
+  free(resolver);
+  free(parser);
+  free_lexer(lexer);
+  return statements;
+}
+
+// Run the scripts in order in one interpreter, they share the heap and the
+// global environment. Sources stay loaded until the end because the AST
+// points into them.
+static int run_scripts(char** paths, Options* options) {
+  ConstantPool* constants = new_constant_pool();
+  SymbolTable* globals = new_symbol_table();
+  init_interpreter(constants, globals);
+  int num_sources = 0;
+  while (paths[num_sources] != NULL) {
+    num_sources++;
+  }
+  Source** sources = calloc(num_sources, sizeof(Source*));
+  int status = 0;
+  for (int i = 0; i < num_sources; i++) {
+    sources[i] = load_source(paths[i]);
+    if (sources[i] == NULL) {
+      status = 1;
+      break;
+    }
+    Arena* arena = NULL;
+    Statement** statements = NULL;
+    uint64_t key = 0;
+    if (options->cache_dir != NULL) {
+      key = cache_key(sources[i]);
+    }
+    // the AST options work on the tree compile builds, so they skip the
+    // cached program
+    if (options->cache_dir != NULL && !options->flat_ast &&
+        !options->ast_stats) {
+      arena = new_arena();
+      statements = load_cached_program(options->cache_dir, key, sources[i],
+                                       constants, arena);
+    }
+    if (statements == NULL) {
+      if (arena != NULL)
+        free_arena(arena);
+      statements =
+          compile(sources[i], constants, globals, options, &arena, key);
+    }
+    if (options->engine == ENGINE_VM) {
+      interpret_bytecode(statements, arena);
+    } else if (options->engine == ENGINE_CLOSURE) {
+      interpret_closures(statements, arena);
+    } else {
+      interpret(statements, arena);
+    }
+  }
+  free_vm();
+  free_closure_compiler();
+  free_interpreter();
+  for (int i = 0; i < num_sources; i++) {
+    if (sources[i] != NULL)
+      free_source(sources[i]);
+  }
+  free(sources);
+  free_constant_pool(constants);
+  free_symbol_table(globals);
+  return status;
+}
+
+static void usage(char* program) {
+  printf("Usage: %s [options] <source>...\n", program);
+  printf("       %s [options] --tokens <source>\n", program);
+  printf("       %s [options] --bench-lexer <source>\n", program);
+  printf("A source is a file, a directory of .lox files or - for stdin.\n");
+  printf("Options:\n");
+  printf("  --lex-threads=<n>  lex on n threads, 0 for all cores\n");
+  printf("  --parse-threads=<n> parse on n threads, 0 for all cores\n");
+  printf("  --flat-ast         run from the flat AST representation\n");
+  printf("  --ast-stats        print the memory used by the AST\n");
+  printf("  --lazy-parse       parse function bodies when first called, errors\n");
+  printf("                     in a body are reported on its first call\n");
+  printf("  --cache-dir=<dir>  cache compiled programs in dir, a lazy parse\n");
+  printf("                     only reads the cache\n");
+  printf("  --no-cache         always compile, neither read nor write the cache\n");
+  printf("  --engine=<name>    run programs with tree (the default), walking\n");
+  printf("                     the AST, vm, the bytecode VM, or closure,\n");
+  printf("                     nodes compiled to pre-bound functions\n");
+}
+
+int main(int argc, char** argv) {
+  char* mode = NULL;
+  char** inputs = malloc(sizeof(char*) * argc);
+  int num_inputs = 0;
+  Options options = {.lex_threads = 1, .parse_threads = 1};
+  bool no_cache = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--bench-lexer") == 0 ||
+        strcmp(argv[i], "--tokens") == 0) {
+      mode = argv[i];
+    } else if (strncmp(argv[i], "--lex-threads=", 14) == 0) {
+      options.lex_threads = atoi(argv[i] + 14);
+    } else if (strncmp(argv[i], "--parse-threads=", 16) == 0) {
+      options.parse_threads = atoi(argv[i] + 16);
+    } else if (strcmp(argv[i], "--flat-ast") == 0) {
+      options.flat_ast = true;
+    } else if (strcmp(argv[i], "--ast-stats") == 0) {
+      options.ast_stats = true;
+    } else if (strcmp(argv[i], "--lazy-parse") == 0) {
+      options.lazy_parse = true;
+    } else if (strncmp(argv[i], "--cache-dir=", 12) == 0) {
+      free(options.cache_dir);
+      options.cache_dir = strdup(argv[i] + 12);
+    } else if (strcmp(argv[i], "--no-cache") == 0) {
+      no_cache = true;
+    } else if (strcmp(argv[i], "--engine=tree") == 0) {
+      options.engine = ENGINE_TREE;
+    } else if (strcmp(argv[i], "--engine=vm") == 0) {
+      options.engine = ENGINE_VM;
+    } else if (strcmp(argv[i], "--engine=closure") == 0) {
+      options.engine = ENGINE_CLOSURE;
+    } else if (strncmp(argv[i], "--", 2) == 0) {
+      usage(argv[0]);
+      return 1;
+    } else {
+      inputs[num_inputs++] = argv[i];
+    }
+  }
+  if (num_inputs == 0 || (mode != NULL && num_inputs != 1)) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (mode != NULL && strcmp(mode, "--bench-lexer") == 0) {
+    return bench_lexer(inputs[0], options.lex_threads);
+  }
+  if (mode != NULL) {
+    return print_tokens(inputs[0], options.lex_threads);
+  }
+
+  if (no_cache) {
+    free(options.cache_dir);
+    options.cache_dir = NULL;
+  }
+
+  char** paths = expand_paths(inputs, num_inputs);
+  free(inputs);
+  if (paths == NULL) {
+    return 1;
+  }
+  int status = run_scripts(paths, &options);
+  free_paths(paths);
+  free(options.cache_dir);
+  return status;
+}
@@ -1,7 +1,13 @@
 #include "include/parser.h"
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+// parse_parallel gives each thread at least this many tokens
+#define PARALLEL_MIN_TOKENS (16 * 1024)
+#define PARALLEL_MAX_THREADS 64
 
 Statement* statement(Parser* parser);
 Statement* statement_print(Parser* parser);
@@ -14,333 +20,566 @@ Statement* statement_if(Parser* parser);
 Statement* statement_while(Parser* parser);
 Statement* statement_for(Parser* parser);
 Statement* statement_return(Parser* parser);
-Statement* new_statement(StatementType type);
+Statement* new_statement(Parser* parser, StatementType type);
 
 Statement* declaration(Parser* parser);
 
+// binding power of infix operators, loosest first
+typedef enum Precedence {
+  PREC_NONE,
+  PREC_ASSIGNMENT,  // =
+  PREC_OR,          // or
+  PREC_AND,         // and
+  PREC_EQUALITY,    // == !=
+  PREC_COMPARISON,  // < > <= >=
+  PREC_TERM,        // + -
+  PREC_FACTOR,      // * /
+  PREC_UNARY,       // ! -
+  PREC_CALL,        // . ()
+} Precedence;
+
+typedef Expr* (*PrefixFn)(Parser* parser, bool can_assign);
+typedef Expr* (*InfixFn)(Parser* parser, Expr* left, bool can_assign);
+
+typedef struct ParseRule {
+  PrefixFn prefix;
+  InfixFn infix;
+  Precedence precedence;
+} ParseRule;
+
 Expr* expression(Parser* parser);
-Expr* assignment(Parser* parser);
-Expr* logic_or(Parser* parser);
-Expr* logci_and(Parser* parser);
-Expr* equality(Parser* parser);
-Expr* comparison(Parser* parser);
-Expr* term(Parser* parser);
-Expr* factor(Parser* parser);
-Expr* unary(Parser* parser);
-Expr* call(Parser* parser);
-Expr* finish_call(Parser* parser, Expr* expr);
-Expr* primary(Parser* parser);
+Expr* parse_precedence(Parser* parser, Precedence precedence);
+Expr* binary(Parser* parser, Expr* left, bool can_assign);
+Expr* logical(Parser* parser, Expr* left, bool can_assign);
+Expr* call(Parser* parser, Expr* callee, bool can_assign);
+Expr* dot(Parser* parser, Expr* object, bool can_assign);
+Expr* finish_call(Parser* parser, Expr* callee);
+Expr* unary(Parser* parser, bool can_assign);
+Expr* literal(Parser* parser, bool can_assign);
+Expr* number(Parser* parser, bool can_assign);
+Expr* string(Parser* parser, bool can_assign);
+Expr* super(Parser* parser, bool can_assign);
+Expr* this(Parser* parser, bool can_assign);
+Expr* variable(Parser* parser, bool can_assign);
+Expr* grouping(Parser* parser, bool can_assign);
+Expr* block_expression(Parser* parser, bool can_assign);
 
 static Token* advance(Parser* parser);
 static Token* peek(Parser* parser);
 static Token* previous(Parser* parser);
 static Token* consume(Parser* parser, TokenType type, char* message);
 
-static void error(Token* token, char* message);
+static void error(Parser* parser, Token* token, char* message);
 static void synchronize(Parser* parser);
+static bool enter_nesting(Parser* parser);
+static bool enter_chain(Parser* parser);
+static Statement* skip_body(Parser* parser, DeferredKind kind);
 
 static bool match(Parser* parser, TokenType type);
-static bool match_any(Parser* parser, TokenType* types);
 static bool check(Parser* parser, TokenType type);
 static bool is_at_end(Parser* parser);
 
-Expr* new_expr(UnTaggedExpr* u_expr, ExprType type);
-Expr* new_binary(Expr* left, Token* op, Expr* right);
-Expr* new_unary(Token* op, Expr* right);
-Expr* new_literal(Token* value);
-Expr* new_call(Expr* callee, Token* paren, Expr** arguments);
-Expr* new_grouping(Expr* expression);
-Expr* new_get(Expr* object, Token* name);
-Expr* new_set(Expr* object, Token* name, Expr* value);
-Expr* new_this(Token* keyword);
-Expr* new_super(Token* keyword, Token* method);
-Expr* new_variable(Token* value);
-Expr* new_assign(Token* name, Expr* value);
-Expr* new_logical(Expr* left, Token* op, Expr* right);
-
-Parser* new_parser(Token** tokens, int num_tokens) {
-  Parser* parser = (Parser*)malloc(sizeof(Token*) * num_tokens + sizeof(int));
-  parser->tokens = tokens;
+Expr* new_expr(Parser* parser, ExprType type);
+Expr* new_binary(Parser* parser, Expr* left, Token* op, Expr* right);
+Expr* new_unary(Parser* parser, Token* op, Expr* right);
+Expr* new_literal(Parser* parser, TokenType type, int constant);
+Expr* new_call(Parser* parser, Expr* callee, Token* paren, Expr** arguments);
+Expr* new_grouping(Parser* parser, Expr* expression);
+Expr* new_get(Parser* parser, Expr* object, Token* name);
+Expr* new_set(Parser* parser, Expr* object, Token* name, Expr* value);
+Expr* new_this(Parser* parser, Token* keyword);
+Expr* new_super(Parser* parser, Token* keyword, Token* method);
+Expr* new_variable(Parser* parser, Token* value);
+Expr* new_assign(Parser* parser, Token* name, Expr* value);
+Expr* new_logical(Parser* parser, Expr* left, Token* op, Expr* right);
+
+Parser* new_parser(Lexer* lexer, ConstantPool* constants) {
+  Parser* parser = (Parser*)malloc(sizeof(Parser));
+  parser->lexer = lexer;
   parser->current = 0;
+  parser->ring[0] = next_token(lexer);
+  parser->constants = constants;
+  parser->arena = new_arena();
+  parser->nesting = 0;
+  parser->chained = 0;
+  parser->lazy = false;
+  parser->had_error = false;
+  parser->quiet = false;
+  parser->gave_up = false;
+  parser->literals = NULL;
+  parser->num_literals = 0;
+  parser->literals_capacity = 0;
   return parser;
 };
 
-Expr* new_expr(UnTaggedExpr* u_expr, ExprType type) {
-  Expr* expr = (Expr*)malloc(sizeof(Expr));
-  expr->u_expr = u_expr;
+// copy a token out of the ring into the arena, for tokens the AST keeps.
+// NULL stays NULL, consume returns it after reporting an error.
+static Token* keep_token(Parser* parser, Token* token) {
+  if (token == NULL)
+    return NULL;
+  Token* kept = arena_new(parser->arena, Token);
+  *kept = *token;
+  return kept;
+}
+
+// Child lists are collected here and copied to the arena once complete, so
+// growing a list never leaves dead copies in the arena. Short lists stay in
+// the inline buffer.
+#define NODE_LIST_INLINE 8
+
+typedef struct NodeList {
+  void** items;
+  int count;
+  int capacity;
+  void* inline_items[NODE_LIST_INLINE];
+} NodeList;
+
+static void list_init(NodeList* list) {
+  list->items = list->inline_items;
+  list->count = 0;
+  list->capacity = NODE_LIST_INLINE;
+}
+
+static void list_push(NodeList* list, void* item) {
+  if (list->count == list->capacity) {
+    list->capacity *= 2;
+    if (list->items == list->inline_items) {
+      list->items = malloc(sizeof(void*) * list->capacity);
+      memcpy(list->items, list->inline_items, sizeof(list->inline_items));
+    } else {
+      list->items = realloc(list->items, sizeof(void*) * list->capacity);
+    }
+  }
+  list->items[list->count++] = item;
+}
+
+// the NULL-terminated arena copy of the list
+static void* list_finish(Parser* parser, NodeList* list) {
+  void** items = arena_alloc(parser->arena, sizeof(void*) * (list->count + 1));
+  memcpy(items, list->items, sizeof(void*) * list->count);
+  items[list->count] = NULL;
+  if (list->items != list->inline_items)
+    free(list->items);
+  return items;
+}
+
+// a node of the given type, the caller fills in its payload
+Expr* new_expr(Parser* parser, ExprType type) {
+  Expr* expr = arena_new(parser->arena, Expr);
   expr->type = type;
   return expr;
 };
 
-UnTaggedExpr* new_untagged_expr() {
-  UnTaggedExpr* u_expr = (UnTaggedExpr*)malloc(sizeof(UnTaggedExpr));
-  return u_expr;
-}
-
-Expr* new_binary(Expr* left, Token* op, Expr* right) {
-  ExprBinary* binary = malloc(sizeof(ExprBinary));
+Expr* new_binary(Parser* parser, Expr* left, Token* op, Expr* right) {
+  Expr* expr = new_expr(parser, E_Binary);
+  ExprBinary* binary = &expr->as.binary;
   binary->left = left;
   binary->op = op;
   binary->right = right;
-  UnTaggedExpr* u_expr = new_untagged_expr();
-  u_expr->binary = binary;
-  return new_expr(u_expr, E_Binary);
+  return expr;
 };
 
-Expr* new_unary(Token* op, Expr* right) {
-  ExprUnary* unary = malloc(sizeof(ExprUnary));
+Expr* new_unary(Parser* parser, Token* op, Expr* right) {
+  Expr* expr = new_expr(parser, E_Unary);
+  ExprUnary* unary = &expr->as.unary;
   unary->op = op;
   unary->right = right;
-  UnTaggedExpr* u_expr = new_untagged_expr();
-  u_expr->unary = unary;
-  return new_expr(u_expr, E_Unary);
+  return expr;
 };
 
-Expr* new_literal(Token* value) {
-  ExprLiteral* literal = malloc(sizeof(ExprLiteral));
-  literal->value = value;
-  UnTaggedExpr* u_expr = new_untagged_expr();
-  u_expr->literal = literal;
-  return new_expr(u_expr, E_Literal);
+Expr* new_literal(Parser* parser, TokenType type, int constant) {
+  Expr* expr = new_expr(parser, E_Literal);
+  ExprLiteral* literal = &expr->as.literal;
+  literal->type = type;
+  literal->constant = constant;
+  literal->value = EMPTY_VAL;
+  if (parser->literals != NULL && constant >= 0) {
+    if (parser->num_literals == parser->literals_capacity) {
+      parser->literals_capacity *= 2;
+      parser->literals = realloc(parser->literals, sizeof(Expr*) *
+                                                       parser->literals_capacity);
+    }
+    parser->literals[parser->num_literals++] = expr;
+  }
+  return expr;
 };
 
-Expr* new_call(Expr* callee, Token* paren, Expr** arguments) {
-  ExprCall* call = malloc(sizeof(ExprCall));
+Expr* new_call(Parser* parser, Expr* callee, Token* paren, Expr** arguments) {
+  Expr* expr = new_expr(parser, E_Call);
+  ExprCall* call = &expr->as.call;
   call->callee = callee;
   call->paren = paren;
   call->arguments = arguments;
-  UnTaggedExpr* u_expr = new_untagged_expr();
-  u_expr->call = call;
-  return new_expr(u_expr, E_Call);
+  return expr;
 };
 
-Expr* new_grouping(Expr* expression) {
-  ExprGrouping* grouping = malloc(sizeof(ExprGrouping));
+Expr* new_grouping(Parser* parser, Expr* expression) {
+  Expr* expr = new_expr(parser, E_Grouping);
+  ExprGrouping* grouping = &expr->as.grouping;
   grouping->expression = expression;
-  UnTaggedExpr* u_expr = new_untagged_expr();
-  u_expr->grouping = grouping;
-  return new_expr(u_expr, E_Grouping);
+  return expr;
 };
 
-Expr* new_variable(Token* name) {
-  ExprVariable* variable = malloc(sizeof(ExprVariable));
+Expr* new_variable(Parser* parser, Token* name) {
+  Expr* expr = new_expr(parser, E_Variable);
+  ExprVariable* variable = &expr->as.variable;
   variable->name = name;
   variable->depth = -1;
-  UnTaggedExpr* u_expr = new_untagged_expr();
-  u_expr->variable = variable;
-  return new_expr(u_expr, E_Variable);
+  variable->slot = 0;
+  return expr;
 };
 
-Expr* new_get(Expr* object, Token* name) {
-  ExprGet* get = malloc(sizeof(ExprGet));
+Expr* new_get(Parser* parser, Expr* object, Token* name) {
+  Expr* expr = new_expr(parser, E_Get);
+  ExprGet* get = &expr->as.get;
   get->object = object;
   get->name = name;
-  UnTaggedExpr* u_expr = new_untagged_expr();
-  u_expr->get = get;
-  return new_expr(u_expr, E_Get);
+  return expr;
 };
 
-Expr* new_set(Expr* object, Token* name, Expr* value) {
-  ExprSet* set = malloc(sizeof(ExprSet));
+Expr* new_set(Parser* parser, Expr* object, Token* name, Expr* value) {
+  Expr* expr = new_expr(parser, E_Set);
+  ExprSet* set = &expr->as.set;
   set->object = object;
   set->name = name;
   set->value = value;
-  UnTaggedExpr* u_expr = new_untagged_expr();
-  u_expr->set = set;
-  return new_expr(u_expr, E_Set);
+  return expr;
 };
 
-Expr* new_this(Token* keyword) {
-  ExprThis* this = malloc(sizeof(ExprThis));
+Expr* new_this(Parser* parser, Token* keyword) {
+  Expr* expr = new_expr(parser, E_This);
+  ExprThis* this = &expr->as.this;
   this->keyword = keyword;
-  this->keyword->lexeme = "this";
   this->depth = -1;
-  UnTaggedExpr* u_expr = new_untagged_expr();
-  u_expr->this = this;
-  return new_expr(u_expr, E_This);
+  return expr;
 };
 
-Expr* new_super(Token* keyword, Token* method) {
-  ExprSuper* super = malloc(sizeof(ExprSuper));
+Expr* new_super(Parser* parser, Token* keyword, Token* method) {
+  Expr* expr = new_expr(parser, E_Super);
+  ExprSuper* super = &expr->as.super;
   super->keyword = keyword;
-  super->keyword->lexeme = "super";
   super->method = method;
   super->depth = -1;
-  UnTaggedExpr* u_expr = new_untagged_expr();
-  u_expr->super = super;
-  return new_expr(u_expr, E_Super);
+  return expr;
 };
 
-Expr* new_assign(Token* name, Expr* value) {
-  ExprAssign* assign = malloc(sizeof(ExprAssign));
+Expr* new_assign(Parser* parser, Token* name, Expr* value) {
+  Expr* expr = new_expr(parser, E_Assign);
+  ExprAssign* assign = &expr->as.assign;
   assign->name = name;
   assign->value = value;
   assign->depth = -1;
-  UnTaggedExpr* u_expr = new_untagged_expr();
-  u_expr->assign = assign;
-  return new_expr(u_expr, E_Assign);
+  assign->slot = 0;
+  return expr;
 };
 
-Expr* new_logical(Expr* left, Token* op, Expr* right) {
-  ExprLogical* logical = malloc(sizeof(ExprLogical));
+Expr* new_logical(Parser* parser, Expr* left, Token* op, Expr* right) {
+  Expr* expr = new_expr(parser, E_Logical);
+  ExprLogical* logical = &expr->as.logical;
   logical->left = left;
   logical->op = op;
   logical->right = right;
-  UnTaggedExpr* u_expr = new_untagged_expr();
-  u_expr->logical = logical;
-  return new_expr(u_expr, E_Logical);
+  return expr;
 };
 
 Statement** parse(Parser* parser) {
-  Statement** stmts = malloc(sizeof(Statement*) * 0 + sizeof(NULL));
-  int i = 0;
+  NodeList stmts;
+  list_init(&stmts);
   while (!is_at_end(parser)) {
-    stmts = realloc(stmts, sizeof(Statement*) * (i + 1) + sizeof(NULL));
-    stmts[i] = declaration(parser);
-    i++;
+    Statement* stmt = declaration(parser);
+    // a declaration nested too deep is dropped along with the rest
+    if (parser->gave_up)
+      break;
+    list_push(&stmts, stmt);
   }
-  // add NULL at end for loop stop flag.
-  stmts[i] = NULL;
-  return stmts;
+  // ends with NULL for loop stop flag.
+  return list_finish(parser, &stmts);
 };
 
 Statement* declaration(Parser* parser) {
+  if (!enter_nesting(parser))
+    return NULL;
+  Statement* stmt;
   if (match(parser, VAR))
-    return declare_var(parser);
-  if (match(parser, CLASS))
-    return declare_class(parser);
-  if (match(parser, FUN))
-    return declare_fun(parser, "function");
-  return statement(parser);
+    stmt = declare_var(parser);
+  else if (match(parser, CLASS))
+    stmt = declare_class(parser);
+  else if (match(parser, FUN))
+    stmt = declare_fun(parser, "function");
+  else
+    stmt = statement(parser);
+  parser->nesting--;
+  return stmt;
 };
 
-Statement* new_statement(StatementType type) {
-  Statement* stmt = malloc(sizeof(Statement));
-  stmt->type = type;
-  UnTaggedStatement* u_stmt = malloc(sizeof(UnTaggedStatement));
-  stmt->u_stmt = u_stmt;
-  switch (type) {
-    case STATEMENT_VAR:
-      u_stmt->var = malloc(sizeof(StatementVar));
-      break;
-    case STATEMENT_PRINT:
-      u_stmt->print = malloc(sizeof(StatementPrint));
-      break;
-    case STATEMENT_EXPRESSION:
-      u_stmt->expr = malloc(sizeof(StatementExpression));
-      break;
-    case STATEMENT_BLOCK:
-      u_stmt->block = malloc(sizeof(StatementBlock));
-      break;
-    case STATEMENT_IF:
-      u_stmt->if_stmt = malloc(sizeof(StatementIf));
-      break;
-    case STATEMENT_WHILE:
-      u_stmt->while_stmt = malloc(sizeof(StatementWhile));
-      break;
-    case STATEMENT_FUNCTION:
-      u_stmt->function = malloc(sizeof(StatementFunction));
-      break;
-    case STATEMENT_CLASS:
-      u_stmt->class = malloc(sizeof(StatementClass));
-      break;
-    case STATEMENT_RETURN:
-      u_stmt->return_stmt = malloc(sizeof(StatementReturn));
-      break;
-    default:
-      break;
+// A chunk of whole top-level declarations, parsed on its own thread into
+// its own arena.
+typedef struct ParseChunk {
+  // replays a copy of the chunk's tokens followed by E_O_F
+  Lexer lexer;
+  Parser* parser;
+  Statement** statements;
+} ParseChunk;
+
+static void* parse_chunk(void* arg) {
+  ParseChunk* chunk = arg;
+  chunk->statements = parse(chunk->parser);
+  return NULL;
+}
+
+// Add the constants of a worker's pool to `constants`, in the order the
+// worker found them, and renumber the worker's literals to match. Chunks
+// are merged in source order, so constants are numbered as by parse.
+static void merge_constants(ConstantPool* constants, Parser* worker) {
+  ConstantPool* own = worker->constants;
+  int* map = malloc(sizeof(int) * (own->count + 1));
+  for (int i = 0; i < own->count; i++) {
+    Constant* constant = &own->constants[i];
+    map[i] = constant->type == C_NUMBER
+                 ? add_number_constant(constants, constant->number)
+                 : add_string_constant(constants, constant->string,
+                                       strlen(constant->string));
+  }
+  for (int i = 0; i < worker->num_literals; i++) {
+    ExprLiteral* literal = &worker->literals[i]->as.literal;
+    literal->constant = map[literal->constant];
   }
+  free(map);
+}
+
+// A `fun` or `class` outside any braces and parentheses that follows a `;`
+// or a `}` starts a declaration, nothing before it can continue into it.
+// Cuts the tokens there into at most `max_chunks` chunks of similar size,
+// their first token indices go to `starts`.
+static int split_declarations(Token* tokens,
+                              int count,
+                              int max_chunks,
+                              int* starts) {
+  int num_chunks = 1;
+  starts[0] = 0;
+  int depth = 0;
+  for (int i = 1; i < count && num_chunks < max_chunks; i++) {
+    TokenType type = tokens[i].type;
+    if (type == LEFT_BRACE || type == LEFT_PAREN) {
+      depth++;
+    } else if (type == RIGHT_BRACE || type == RIGHT_PAREN) {
+      depth--;
+    } else if ((type == FUN || type == CLASS) && depth == 0 &&
+               (tokens[i - 1].type == SEMICOLON ||
+                tokens[i - 1].type == RIGHT_BRACE) &&
+               i >= (long)count * num_chunks / max_chunks) {
+      starts[num_chunks++] = i;
+    }
+  }
+  return num_chunks;
+}
+
+Statement** parse_parallel(Parser* parser, int num_threads) {
+  Lexer* lexer = parser->lexer;
+  if (lexer->tokens == NULL || parser->current != 0)
+    return parse(parser);
+  if (num_threads <= 0)
+    num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  int count = lexer->num_tokens - 1;
+  if (num_threads > count / PARALLEL_MIN_TOKENS)
+    num_threads = count / PARALLEL_MIN_TOKENS;
+  if (num_threads > PARALLEL_MAX_THREADS)
+    num_threads = PARALLEL_MAX_THREADS;
+  if (num_threads < 2)
+    return parse(parser);
+
+  int starts[PARALLEL_MAX_THREADS + 1];
+  int num_chunks =
+      split_declarations(lexer->tokens, count, num_threads, starts);
+  if (num_chunks < 2)
+    return parse(parser);
+  starts[num_chunks] = count;
+
+  ParseChunk* chunks = calloc(num_chunks, sizeof(ParseChunk));
+  for (int i = 0; i < num_chunks; i++) {
+    int length = starts[i + 1] - starts[i];
+    Lexer* chunk = &chunks[i].lexer;
+    chunk->source = lexer->source;
+    chunk->start = chunk->current = chunk->end = lexer->end;
+    chunk->tokens = malloc(sizeof(Token) * (length + 1));
+    memcpy(chunk->tokens, lexer->tokens + starts[i], sizeof(Token) * length);
+    chunk->tokens[length] = lexer->tokens[count];
+    chunk->num_tokens = chunk->capacity = length + 1;
+    // workers intern literals in pools of their own, without locking
+    chunks[i].parser = new_parser(chunk, new_constant_pool());
+    chunks[i].parser->lazy = parser->lazy;
+    chunks[i].parser->quiet = true;
+    chunks[i].parser->literals_capacity = 64;
+    chunks[i].parser->literals = malloc(sizeof(Expr*) * 64);
+  }
+
+  pthread_t threads[PARALLEL_MAX_THREADS];
+  for (int i = 0; i < num_chunks; i++) {
+    if (pthread_create(&threads[i], NULL, parse_chunk, &chunks[i]) != 0) {
+      fprintf(stderr, "Parser Error: Could not create thread.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  bool failed = false;
+  int total = 0;
+  for (int i = 0; i < num_chunks; i++) {
+    pthread_join(threads[i], NULL);
+    failed |= chunks[i].parser->had_error;
+    for (Statement** stmt = chunks[i].statements; *stmt != NULL; stmt++) {
+      total++;
+    }
+  }
+
+  // The statements are joined in source order. A program with errors is
+  // parsed again serially, which reports them in order and recovers from
+  // them exactly like parse.
+  Statement** statements = NULL;
+  if (!failed) {
+    statements = arena_alloc(parser->arena, sizeof(Statement*) * (total + 1));
+    Statement** out = statements;
+    for (int i = 0; i < num_chunks; i++) {
+      for (Statement** stmt = chunks[i].statements; *stmt != NULL; stmt++) {
+        *out++ = *stmt;
+      }
+    }
+    *out = NULL;
+  }
+  for (int i = 0; i < num_chunks; i++) {
+    if (failed) {
+      free_arena(chunks[i].parser->arena);
+    } else {
+      merge_constants(parser->constants, chunks[i].parser);
+      arena_merge(parser->arena, chunks[i].parser->arena);
+    }
+    free_constant_pool(chunks[i].parser->constants);
+    free(chunks[i].parser->literals);
+    free(chunks[i].parser);
+    free(chunks[i].lexer.tokens);
+  }
+  free(chunks);
+  if (failed)
+    return parse(parser);
+
+  // leave the parser at the end, as parse does
+  lexer->next = lexer->num_tokens - 1;
+  parser->ring[parser->current & (TOKEN_RING_SIZE - 1)] = lexer->tokens[count];
+  return statements;
+}
+
+// a statement of the given type, the caller fills in its payload
+Statement* new_statement(Parser* parser, StatementType type) {
+  Statement* stmt = arena_new(parser->arena, Statement);
+  stmt->type = type;
   return stmt;
 };
 
 Statement* statement(Parser* parser) {
+  if (!enter_nesting(parser))
+    return NULL;
+  Statement* stmt;
   if (match(parser, IF))
-    return statement_if(parser);
-  if (match(parser, PRINT))
-    return statement_print(parser);
-  if (match(parser, RETURN))
-    return statement_return(parser);
-  if (match(parser, WHILE))
-    return statement_while(parser);
-  if (match(parser, FOR))
-    return statement_for(parser);
-  if (match(parser, LEFT_BRACE))
-    return statement_block(parser);
-  return statement_expression(parser);
+    stmt = statement_if(parser);
+  else if (match(parser, PRINT))
+    stmt = statement_print(parser);
+  else if (match(parser, RETURN))
+    stmt = statement_return(parser);
+  else if (match(parser, WHILE))
+    stmt = statement_while(parser);
+  else if (match(parser, FOR))
+    stmt = statement_for(parser);
+  else if (match(parser, LEFT_BRACE))
+    stmt = statement_block(parser);
+  else
+    stmt = statement_expression(parser);
+  parser->nesting--;
+  return stmt;
 };
 
 Statement* declare_var(Parser* parser) {
-  Token* name = consume(parser, IDENTIFIER, "Expect variable name.");
+  Token* name =
+      keep_token(parser, consume(parser, IDENTIFIER, "Expect variable name."));
   Expr* initializer = NULL;
   if (match(parser, EQUAL)) {
     initializer = expression(parser);
   }
   consume(parser, SEMICOLON, "Expect ';' after variable declaration.");
-  Statement* stmt = new_statement(STATEMENT_VAR);
-  stmt->u_stmt->var->name = name;
-  stmt->u_stmt->var->initializer = initializer;
+  Statement* stmt = new_statement(parser, STATEMENT_VAR);
+  stmt->as.var.name = name;
+  stmt->as.var.initializer = initializer;
   return stmt;
 };
 
 Statement* declare_class(Parser* parser) {
-  Token* name = consume(parser, IDENTIFIER, "Expect class name.");
+  Token* name =
+      keep_token(parser, consume(parser, IDENTIFIER, "Expect class name."));
 
   Expr* superclass = NULL;
   if (match(parser, LESS)) {
     consume(parser, IDENTIFIER, "Expect superclass name.");
-    superclass = new_variable(previous(parser));
+    superclass = new_variable(parser, keep_token(parser, previous(parser)));
   }
 
   consume(parser, LEFT_BRACE, "Expect '{' before class body.");
-  Statement** methods = malloc(sizeof(Statement*) * 0 + sizeof(NULL));
-  int i = 0;
+  NodeList methods;
+  list_init(&methods);
   while (!check(parser, RIGHT_BRACE) && !is_at_end(parser)) {
-    methods = realloc(methods, sizeof(Statement*) * (i + 1) + sizeof(NULL));
-    methods[i] = declare_fun(parser, "method");
-    i++;
+    list_push(&methods, declare_fun(parser, "method"));
   }
-  methods[i] = NULL;
   consume(parser, RIGHT_BRACE, "Expect '}' after class body.");
+  if (superclass != NULL) {
+    for (int i = 0; i < methods.count; i++) {
+      Statement* body = ((Statement*)methods.items[i])->as.function.body;
+      if (body->type == STATEMENT_DEFERRED)
+        body->as.deferred.kind = DEFERRED_SUBCLASS_METHOD;
+    }
+  }
 
-  Statement* stmt = new_statement(STATEMENT_CLASS);
-  stmt->u_stmt->class->name = name;
-  stmt->u_stmt->class->methods = methods;
-  stmt->u_stmt->class->superclass = superclass;
+  Statement* stmt = new_statement(parser, STATEMENT_CLASS);
+  stmt->as.class.name = name;
+  stmt->as.class.methods = list_finish(parser, &methods);
+  stmt->as.class.superclass = superclass;
   return stmt;
 };
 
 Statement* declare_fun(Parser* parser, char* kind) {
   bool is_method = strcmp(kind, "method") == 0;
-  Token* name =
+  Token* name = keep_token(
+      parser,
       consume(parser, IDENTIFIER,
-              is_method ? "Expect method name." : "Expect function name.");
+              is_method ? "Expect method name." : "Expect function name."));
   consume(parser, LEFT_PAREN,
           is_method ? "Expect '(' after method name."
                     : "Expect '(' after function name.");
-  Token** parameters = malloc(sizeof(Token*) * 0 + sizeof(NULL));
-  int i = 0;
+  NodeList parameters;
+  list_init(&parameters);
   if (!check(parser, RIGHT_PAREN)) {
     do {
-      if (i >= 255) {
-        error(peek(parser), "Can't have more than 255 parameters.");
+      if (parameters.count >= 255) {
+        error(parser, peek(parser), "Can't have more than 255 parameters.");
       }
-      parameters = realloc(parameters, sizeof(Token*) * (i + 1) + sizeof(NULL));
-      parameters[i] = consume(parser, IDENTIFIER, "Expect parameter name.");
-      i++;
+      list_push(&parameters,
+                keep_token(parser, consume(parser, IDENTIFIER,
+                                           "Expect parameter name.")));
     } while (match(parser, COMMA));
   }
-  parameters[i] = NULL;
   consume(parser, RIGHT_PAREN, "Expect ')' after parameters.");
 
-  consume(parser, LEFT_BRACE,
-          is_method ? "Expect '{' before method body."
-                    : "Expect '{' before function body.");
+  Token* brace = consume(parser, LEFT_BRACE,
+                         is_method ? "Expect '{' before method body."
+                                   : "Expect '{' before function body.");
 
-  Statement* body = statement_block(parser);
-  Statement* stmt = new_statement(STATEMENT_FUNCTION);
-  stmt->u_stmt->function->name = name;
-  stmt->u_stmt->function->params = parameters;
-  stmt->u_stmt->function->body = body;
+  // only top-level functions and methods of top-level classes are deferred,
+  // their enclosing scopes are known without resolving the code around them
+  Statement* body;
+  if (parser->lazy && parser->nesting == 1 && brace != NULL) {
+    body = skip_body(parser, is_method ? DEFERRED_METHOD : DEFERRED_FUNCTION);
+  } else {
+    body = statement_block(parser);
+  }
+  Statement* stmt = new_statement(parser, STATEMENT_FUNCTION);
+  stmt->as.function.name = name;
+  stmt->as.function.params = list_finish(parser, &parameters);
+  stmt->as.function.body = body;
   return stmt;
 };
 
@@ -353,31 +592,31 @@ Statement* statement_if(Parser* parser) {
   if (match(parser, ELSE)) {
     else_branch = statement(parser);
   }
-  Statement* stmt = new_statement(STATEMENT_IF);
-  stmt->u_stmt->if_stmt->condition = condition;
-  stmt->u_stmt->if_stmt->then_branch = then_branch;
-  stmt->u_stmt->if_stmt->else_branch = else_branch;
+  Statement* stmt = new_statement(parser, STATEMENT_IF);
+  stmt->as.if_stmt.condition = condition;
+  stmt->as.if_stmt.then_branch = then_branch;
+  stmt->as.if_stmt.else_branch = else_branch;
   return stmt;
 };
 
 Statement* statement_print(Parser* parser) {
   Expr* expr = expression(parser);
   consume(parser, SEMICOLON, "Expect ';' after value.");
-  Statement* stmt = new_statement(STATEMENT_PRINT);
-  stmt->u_stmt->print->expr = expr;
+  Statement* stmt = new_statement(parser, STATEMENT_PRINT);
+  stmt->as.print.expr = expr;
   return stmt;
 };
 
 Statement* statement_return(Parser* parser) {
-  Token* keyword = previous(parser);
+  Token* keyword = keep_token(parser, previous(parser));
   Expr* value = NULL;
   if (!check(parser, SEMICOLON)) {
     value = expression(parser);
   }
   consume(parser, SEMICOLON, "Expect ';' after return value.");
-  Statement* stmt = new_statement(STATEMENT_RETURN);
-  stmt->u_stmt->return_stmt->keyword = keyword;
-  stmt->u_stmt->return_stmt->value = value;
+  Statement* stmt = new_statement(parser, STATEMENT_RETURN);
+  stmt->as.return_stmt.keyword = keyword;
+  stmt->as.return_stmt.value = value;
   return stmt;
 };
 
@@ -386,9 +625,9 @@ Statement* statement_while(Parser* parser) {
   Expr* condition = expression(parser);
   consume(parser, RIGHT_PAREN, "Expect ')' after condition.");
   Statement* body = statement(parser);
-  Statement* stmt = new_statement(STATEMENT_WHILE);
-  stmt->u_stmt->while_stmt->condition = condition;
-  stmt->u_stmt->while_stmt->body = body;
+  Statement* stmt = new_statement(parser, STATEMENT_WHILE);
+  stmt->as.while_stmt.condition = condition;
+  stmt->as.while_stmt.body = body;
   return stmt;
 };
 
@@ -419,31 +658,40 @@ Statement* statement_for(Parser* parser) {
   Statement* body = statement(parser);
 
   if (increment != NULL) {
-    Statement* increment_stmt = new_statement(STATEMENT_EXPRESSION);
-    increment_stmt->u_stmt->expr->expr = increment;
-
-    Statement* block = new_statement(STATEMENT_BLOCK);
-    block->u_stmt->block->stmts = (Statement**)malloc(sizeof(Statement*) * 3);
-    block->u_stmt->block->stmts[0] = body;
-    block->u_stmt->block->stmts[1] = increment_stmt;
-    block->u_stmt->block->stmts[2] = NULL;
+    Statement* increment_stmt = new_statement(parser, STATEMENT_EXPRESSION);
+    increment_stmt->as.expr.expr = increment;
+
+    Statement* block = new_statement(parser, STATEMENT_BLOCK);
+    block->as.block.stmts =
+        arena_alloc(parser->arena, sizeof(Statement*) * 3);
+    block->as.block.stmts[0] = body;
+    block->as.block.stmts[1] = increment_stmt;
+    block->as.block.stmts[2] = NULL;
+    block->as.block.num_slots = 0;
+    block->as.block.captured = false;
+    block->as.block.chunk = NULL;
     body = block;
   }
 
-  if (condition == NULL)
-    condition = new_literal(new_token(TRUE, NULL, NULL, 0));
+  if (condition == NULL) {
+    condition = new_literal(parser, TRUE, -1);
+  }
 
-  Statement* while_stmt = new_statement(STATEMENT_WHILE);
-  while_stmt->u_stmt->while_stmt->condition = condition;
-  while_stmt->u_stmt->while_stmt->body = body;
+  Statement* while_stmt = new_statement(parser, STATEMENT_WHILE);
+  while_stmt->as.while_stmt.condition = condition;
+  while_stmt->as.while_stmt.body = body;
   body = while_stmt;
 
   if (initializer != NULL) {
-    Statement* block = new_statement(STATEMENT_BLOCK);
-    block->u_stmt->block->stmts = (Statement**)malloc(sizeof(Statement*) * 3);
-    block->u_stmt->block->stmts[0] = initializer;
-    block->u_stmt->block->stmts[1] = body;
-    block->u_stmt->block->stmts[2] = NULL;
+    Statement* block = new_statement(parser, STATEMENT_BLOCK);
+    block->as.block.stmts =
+        arena_alloc(parser->arena, sizeof(Statement*) * 3);
+    block->as.block.stmts[0] = initializer;
+    block->as.block.stmts[1] = body;
+    block->as.block.stmts[2] = NULL;
+    block->as.block.num_slots = 0;
+    block->as.block.captured = false;
+    block->as.block.chunk = NULL;
     body = block;
   }
 
@@ -453,193 +701,276 @@ Statement* statement_for(Parser* parser) {
 Statement* statement_expression(Parser* parser) {
   Expr* expr = expression(parser);
   consume(parser, SEMICOLON, "Expect ';' after expression.");
-  Statement* stmt = new_statement(STATEMENT_EXPRESSION);
-  stmt->u_stmt->expr->expr = expr;
+  Statement* stmt = new_statement(parser, STATEMENT_EXPRESSION);
+  stmt->as.expr.expr = expr;
   return stmt;
 };
 
+// Match braces up to the end of a body whose '{' was just consumed, without
+// parsing it. The body's source is recorded for parse_deferred.
+static Statement* skip_body(Parser* parser, DeferredKind kind) {
+  // the '{' slot of the ring is reused while skipping
+  const char* start = previous(parser)->start;
+  Statement* stmt = new_statement(parser, STATEMENT_DEFERRED);
+  stmt->as.deferred.start = start;
+  stmt->as.deferred.line = previous(parser)->line;
+  stmt->as.deferred.kind = kind;
+
+  int depth = 1;
+  while (depth > 0 && !is_at_end(parser)) {
+    TokenType type = advance(parser)->type;
+    if (type == LEFT_BRACE)
+      depth++;
+    else if (type == RIGHT_BRACE)
+      depth--;
+  }
+  // an unclosed body runs to the end, its error is reported when parsed
+  Token* last = depth > 0 ? peek(parser) : previous(parser);
+  stmt->as.deferred.length = last->start + last->length - start;
+  return stmt;
+};
+
+Statement* parse_deferred(Parser* parser) {
+  consume(parser, LEFT_BRACE, "Expect '{' before function body.");
+  Statement* block = statement_block(parser);
+  // a body nested too deep runs as an empty one
+  if (parser->gave_up)
+    block->as.block.stmts[0] = NULL;
+  return block;
+};
+
 Statement* statement_block(Parser* parser) {
-  Statement** stmts = calloc(1, sizeof(Statement*) + sizeof(NULL));
-  int i = 0;
+  NodeList stmts;
+  list_init(&stmts);
   while (!check(parser, RIGHT_BRACE) && !is_at_end(parser)) {
-    stmts = realloc(stmts, sizeof(Statement*) * (i + 1) + sizeof(NULL));
-    stmts[i] = declaration(parser);
-    i++;
+    list_push(&stmts, declaration(parser));
   }
-  stmts[i] = NULL;
   consume(parser, RIGHT_BRACE, "Expect '}' after block.");
-  Statement* stmt = new_statement(STATEMENT_BLOCK);
-  stmt->u_stmt->block->stmts = stmts;
+  Statement* stmt = new_statement(parser, STATEMENT_BLOCK);
+  stmt->as.block.stmts = list_finish(parser, &stmts);
+  stmt->as.block.num_slots = 0;
+  stmt->as.block.captured = false;
+  stmt->as.block.chunk = NULL;
   return stmt;
 };
 
 Expr* expression(Parser* parser) {
-  return assignment(parser);
+  return parse_precedence(parser, PREC_ASSIGNMENT);
 };
 
-Expr* assignment(Parser* parser) {
-  Expr* expr = logic_or(parser);
-  if (match(parser, EQUAL)) {
-    Token* equals = previous(parser);
-    Expr* value = assignment(parser);
-
-    if (expr->type == E_Variable) {
-      Token* name = expr->u_expr->variable->name;
-      return new_assign(name, value);
-    } else if (expr->type == E_Get) {
-      ExprGet* get = expr->u_expr->get;
-      return new_set(get->object, get->name, value);
-    }
+// Pratt parser: every token type has a row in `rules` with the function that
+// parses an expression starting with it (prefix), the function that
+// continues an expression it follows (infix) and the precedence of that
+// infix use. Binary operators parse their right operand one level tighter,
+// which makes them left associative.
+static const ParseRule rules[E_O_F + 1] = {
+    [LEFT_PAREN] = {grouping, call, PREC_CALL},
+    [LEFT_BRACE] = {block_expression, NULL, PREC_NONE},
+    [DOT] = {NULL, dot, PREC_CALL},
+    [MINUS] = {unary, binary, PREC_TERM},
+    [PLUS] = {NULL, binary, PREC_TERM},
+    [SLASH] = {NULL, binary, PREC_FACTOR},
+    [STAR] = {NULL, binary, PREC_FACTOR},
+    [BANG] = {unary, NULL, PREC_NONE},
+    [BANG_EQUAL] = {NULL, binary, PREC_EQUALITY},
+    [EQUAL_EQUAL] = {NULL, binary, PREC_EQUALITY},
+    [GREATER] = {NULL, binary, PREC_COMPARISON},
+    [GREATER_EQUAL] = {NULL, binary, PREC_COMPARISON},
+    [LESS] = {NULL, binary, PREC_COMPARISON},
+    [LESS_EQUAL] = {NULL, binary, PREC_COMPARISON},
+    [IDENTIFIER] = {variable, NULL, PREC_NONE},
+    [STRING] = {string, NULL, PREC_NONE},
+    [NUMBER] = {number, NULL, PREC_NONE},
+    [AND] = {NULL, logical, PREC_AND},
+    [OR] = {NULL, logical, PREC_OR},
+    [FALSE] = {literal, NULL, PREC_NONE},
+    [TRUE] = {literal, NULL, PREC_NONE},
+    [NIL] = {literal, NULL, PREC_NONE},
+    [THIS] = {this, NULL, PREC_NONE},
+    [SUPER] = {super, NULL, PREC_NONE},
+};
 
-    free(value);
-    error(equals, "Invalid assignment target.");
+// parse an expression whose operators bind at least as tight as `precedence`
+Expr* parse_precedence(Parser* parser, Precedence precedence) {
+  if (!enter_nesting(parser))
+    return NULL;
+  int operators = 0;
+  // only the loosest level may be an assignment target, in `a + b = c` the
+  // operand `b` must not take the `=`
+  bool can_assign = precedence <= PREC_ASSIGNMENT;
+  Expr* expr = NULL;
+  PrefixFn prefix = rules[peek(parser)->type].prefix;
+  if (prefix != NULL) {
+    advance(parser);
+    expr = prefix(parser, can_assign);
+  } else {
+    // the token is left for the operator loop below, which consumes a
+    // stray infix operator so the parse keeps moving
+    error(parser, peek(parser), "Expect expression");
   }
-  return expr;
-}
 
-Expr* logic_or(Parser* parser) {
-  Expr* expr = logci_and(parser);
-  while (match(parser, OR)) {
-    Token* op = previous(parser);
-    Expr* right = logci_and(parser);
-    expr = new_logical(expr, op, right);
+  // every operator puts the expression so far one level deeper in the tree
+  while (precedence <= rules[peek(parser)->type].precedence &&
+         enter_chain(parser)) {
+    operators++;
+    advance(parser);
+    expr = rules[previous(parser)->type].infix(parser, expr, can_assign);
   }
-  return expr;
-}
 
-Expr* logci_and(Parser* parser) {
-  Expr* expr = equality(parser);
-  while (match(parser, AND)) {
-    Token* op = previous(parser);
-    Expr* right = equality(parser);
-    expr = new_logical(expr, op, right);
+  if (can_assign && match(parser, EQUAL)) {
+    // copied, the ring slot is reused while the value is parsed
+    Token equals = *previous(parser);
+    expression(parser);
+    error(parser, &equals, "Invalid assignment target.");
   }
+  parser->nesting--;
+  parser->chained -= operators;
   return expr;
 }
 
-Expr* equality(Parser* parser) {
-  Expr* expr = comparison(parser);
-  while (match_any(parser, (TokenType[]){BANG_EQUAL, EQUAL_EQUAL, -1})) {
-    Token* op = previous(parser);
-    Expr* right = comparison(parser);
-    Expr* binary = new_binary(expr, op, right);
-    expr = binary;
+// Report the input as nested too deep, once, and skip the rest of it.
+static void give_up(Parser* parser) {
+  error(parser, peek(parser), "Too much nesting.");
+  parser->gave_up = true;
+  while (!is_at_end(parser)) {
+    advance(parser);
   }
-  return expr;
-};
+}
 
-Expr* comparison(Parser* parser) {
-  Expr* expr = term(parser);
-  while (match_any(
-      parser, (TokenType[]){GREATER, GREATER_EQUAL, LESS, LESS_EQUAL, -1})) {
-    Token* op = previous((parser));
-    Expr* right = term(parser);
-    Expr* binary = new_binary(expr, op, right);
-    expr = binary;
+// Expressions and statements nest through recursion, here and in the
+// resolver, the compilers and the interpreter. Past MAX_NESTING the C stack
+// is at risk, so the parser reports it once and skips the rest of the input.
+// Returns false then, the caller returns right away and the declaration is
+// dropped.
+static bool enter_nesting(Parser* parser) {
+  if (parser->gave_up)
+    return false;
+  if (parser->nesting == MAX_NESTING) {
+    give_up(parser);
+    return false;
   }
-  return expr;
-};
+  parser->nesting++;
+  return true;
+}
 
-Expr* term(Parser* parser) {
-  Expr* expr = factor(parser);
-  while (match_any(parser, (TokenType[]){MINUS, PLUS, -1})) {
-    Token* op = previous((parser));
-    Expr* right = factor(parser);
-    Expr* binary = new_binary(expr, op, right);
-    expr = binary;
+// A chain of operators is parsed in a loop, but it nests as deep as it is
+// long in the tree the later passes walk recursively. So chains are bounded
+// too, apart from the nesting and far above what code is written with.
+static bool enter_chain(Parser* parser) {
+  if (parser->gave_up)
+    return false;
+  if (parser->chained == MAX_CHAINED) {
+    give_up(parser);
+    return false;
   }
-  return expr;
-};
+  parser->chained++;
+  return true;
+}
 
-Expr* factor(Parser* parser) {
-  Expr* expr = unary(parser);
-  while (match_any(parser, (TokenType[]){SLASH, STAR, -1})) {
-    Token* op = previous((parser));
-    Expr* right = unary(parser);
-    Expr* binary = new_binary(expr, op, right);
-    expr = binary;
-  }
-  return expr;
-};
+Expr* binary(Parser* parser, Expr* left, bool can_assign) {
+  (void)can_assign;
+  Token* op = keep_token(parser, previous(parser));
+  Expr* right = parse_precedence(parser, rules[op->type].precedence + 1);
+  return new_binary(parser, left, op, right);
+}
 
-Expr* unary(Parser* parser) {
-  if (match_any(parser, (TokenType[]){BANG, MINUS, -1})) {
-    Token* op = previous(parser);
-    Expr* right = unary(parser);
-    return new_unary(op, right);
-  }
-  return call(parser);
-};
+Expr* logical(Parser* parser, Expr* left, bool can_assign) {
+  (void)can_assign;
+  Token* op = keep_token(parser, previous(parser));
+  Expr* right = parse_precedence(parser, rules[op->type].precedence + 1);
+  return new_logical(parser, left, op, right);
+}
 
-Expr* call(Parser* parser) {
-  Expr* expr = primary(parser);
+Expr* unary(Parser* parser, bool can_assign) {
+  (void)can_assign;
+  Token* op = keep_token(parser, previous(parser));
+  Expr* right = parse_precedence(parser, PREC_UNARY);
+  return new_unary(parser, op, right);
+}
 
-  while (true) {
-    if (match(parser, LEFT_PAREN)) {
-      expr = finish_call(parser, expr);
-    } else if (match(parser, DOT)) {
-      Token* name =
-          consume(parser, IDENTIFIER, "Expect property name after '.'.");
-      expr = new_get(expr, name);
+Expr* call(Parser* parser, Expr* callee, bool can_assign) {
+  (void)can_assign;
+  return finish_call(parser, callee);
+}
 
-    } else {
-      break;
-    }
+Expr* dot(Parser* parser, Expr* object, bool can_assign) {
+  Token* name = keep_token(
+      parser, consume(parser, IDENTIFIER, "Expect property name after '.'."));
+  if (can_assign && match(parser, EQUAL)) {
+    Expr* value = expression(parser);
+    return new_set(parser, object, name, value);
   }
-  return expr;
-};
+  return new_get(parser, object, name);
+}
 
 Expr* finish_call(Parser* parser, Expr* callee) {
-  Expr** arguments = malloc(sizeof(Expr*) * 0 + sizeof(NULL));
-  int i = 0;
+  NodeList arguments;
+  list_init(&arguments);
   if (!check(parser, RIGHT_PAREN)) {
     do {
-      arguments = realloc(arguments, sizeof(Expr*) * (i + 1) + sizeof(NULL));
-      arguments[i] = expression(parser);
-      i++;
+      list_push(&arguments, expression(parser));
     } while (match(parser, COMMA));
-    arguments[i] = NULL;
   }
 
-  Token* paren = consume(parser, RIGHT_PAREN, "Expect ')' after arguments.");
-  return new_call(callee, paren, arguments);
+  Token* paren = keep_token(
+      parser, consume(parser, RIGHT_PAREN, "Expect ')' after arguments."));
+  return new_call(parser, callee, paren, list_finish(parser, &arguments));
 };
 
-Expr* primary(Parser* parser) {
-  if (match_any(parser, (TokenType[]){FALSE, TRUE, NIL, STRING, NUMBER, -1})) {
-    return new_literal(previous(parser));
-  }
+Expr* literal(Parser* parser, bool can_assign) {
+  (void)can_assign;
+  return new_literal(parser, previous(parser)->type, -1);
+}
 
-  if (match(parser, SUPER)) {
-    Token* keyword = previous(parser);
-    consume(parser, DOT, "Expect '.' after 'super'.");
-    Token* method =
-        consume(parser, IDENTIFIER, "Expect superclass method name.");
-    return new_super(keyword, method);
-  }
+Expr* number(Parser* parser, bool can_assign) {
+  (void)can_assign;
+  int constant =
+      add_number_constant(parser->constants, previous(parser)->number);
+  return new_literal(parser, NUMBER, constant);
+}
 
-  if (match(parser, THIS)) {
-    return new_this(previous(parser));
-  }
+Expr* string(Parser* parser, bool can_assign) {
+  (void)can_assign;
+  Token* token = previous(parser);
+  int constant =
+      add_string_constant(parser->constants, token->start, token->length);
+  return new_literal(parser, STRING, constant);
+}
 
-  if (match(parser, IDENTIFIER)) {
-    return new_variable(previous(parser));
-  }
+Expr* super(Parser* parser, bool can_assign) {
+  (void)can_assign;
+  Token* keyword = keep_token(parser, previous(parser));
+  consume(parser, DOT, "Expect '.' after 'super'.");
+  Token* method = keep_token(
+      parser, consume(parser, IDENTIFIER, "Expect superclass method name."));
+  return new_super(parser, keyword, method);
+}
 
-  // matched group
-  if (match(parser, LEFT_PAREN)) {
-    Expr* expr = expression(parser);
-    consume(parser, RIGHT_PAREN, "Expect ')' after expression.");
-    return new_grouping(expr);
-  }
+Expr* this(Parser* parser, bool can_assign) {
+  (void)can_assign;
+  return new_this(parser, keep_token(parser, previous(parser)));
+}
 
-  if (match(parser, LEFT_BRACE)) {
-    Statement* stmts = statement_block(parser);
-    free(stmts);
-    return NULL;
+Expr* variable(Parser* parser, bool can_assign) {
+  Token* name = keep_token(parser, previous(parser));
+  if (can_assign && match(parser, EQUAL)) {
+    Expr* value = expression(parser);
+    return new_assign(parser, name, value);
   }
+  return new_variable(parser, name);
+}
+
+Expr* grouping(Parser* parser, bool can_assign) {
+  (void)can_assign;
+  Expr* expr = expression(parser);
+  consume(parser, RIGHT_PAREN, "Expect ')' after expression.");
+  return new_grouping(parser, expr);
+}
 
-  error(peek(parser), "Expect expression");
+// a block where an expression is expected is parsed and dropped
+Expr* block_expression(Parser* parser, bool can_assign) {
+  (void)can_assign;
+  statement_block(parser);
   return NULL;
 }
 
@@ -648,16 +979,19 @@ bool is_at_end(Parser* parser) {
 };
 
 Token* peek(Parser* parser) {
-  return parser->tokens[parser->current];
+  return &parser->ring[parser->current & (TOKEN_RING_SIZE - 1)];
 };
 
 Token* previous(Parser* parser) {
-  return parser->tokens[parser->current - 1];
+  return &parser->ring[(parser->current - 1) & (TOKEN_RING_SIZE - 1)];
 };
 
+// move to the next token, pulling it from the lexer into the ring
 Token* advance(Parser* parser) {
   if (!is_at_end(parser)) {
     parser->current++;
+    parser->ring[parser->current & (TOKEN_RING_SIZE - 1)] =
+        next_token(parser->lexer);
   }
   return previous(parser);
 };
@@ -669,19 +1003,23 @@ bool check(Parser* parser, TokenType type) {
   return peek(parser)->type == type;
 };
 
-void error(Token* token, char* message) {
+void error(Parser* parser, Token* token, char* message) {
+  parser->had_error = true;
+  // the input after a nesting error is skipped, not reported
+  if (parser->quiet || parser->gave_up)
+    return;
   if (token->type == E_O_F) {
     fprintf(stderr, "Parser Error: %s at end.\n", message);
   } else {
-    fprintf(stderr, "Parser Error: %s of token: %s at %d.\n", message,
-            token->lexeme, token->line);
+    fprintf(stderr, "Parser Error: %s of token: %.*s at %d.\n", message,
+            token->length, token->start, token->line);
   }
 };
 
 Token* consume(Parser* parser, TokenType type, char* message) {
   if (check(parser, type))
     return advance(parser);
-  error(peek(parser), message);
+  error(parser, peek(parser), message);
   return NULL;
 };
 
@@ -717,16 +1055,3 @@ bool match(Parser* parser, TokenType type) {
   }
   return false;
 };
-
-bool match_any(Parser* parser, TokenType* types) {
-  if (is_at_end((parser))) {
-    return false;
-  }
-  for (int i = 0; types[i] != (TokenType)-1; i++) {
-    if (check(parser, types[i])) {
-      advance(parser);
-      return true;
-    }
-  }
-  return false;
-};
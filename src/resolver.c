@@ -1,37 +1,218 @@
 #include "include/resolver.h"
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "include/hashtable.h"
 #include "include/log.h"
 #include "include/token.h"
 
-Resolver* new_resolver() {
-  Resolver* resolver = malloc(sizeof(*resolver));
-  stack scopes = stack_create();
-  resolver->scopes = scopes;
+// report an error and remember that the program has one
+#define resolver_error(resolver, ...) \
+  do {                                \
+    log_error(__VA_ARGS__);           \
+    (resolver)->had_error = true;     \
+  } while (0)
+
+// a scope past this many names gets a hash index of them
+#define WIDE_SCOPE 16
+
+// grow `*array` of `size`-byte items to hold `needed` items
+static void* grow(void* array, int* capacity, int needed, size_t size) {
+  if (needed <= *capacity)
+    return array;
+  int new_capacity = *capacity < 16 ? 16 : *capacity;
+  while (new_capacity < needed) {
+    new_capacity *= 2;
+  }
+  array = realloc(array, new_capacity * size);
+  if (array == NULL) {
+    fprintf(stderr, "Memory allocation failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  *capacity = new_capacity;
+  return array;
+}
+
+static Scope* innermost_scope(Resolver* resolver) {
+  return &resolver->scopes[resolver->num_scopes - 1];
+}
+
+static uint32_t hash_symbol(int symbol) {
+  return (uint32_t)symbol * 2654435761u;
+}
+
+static void index_entry(Resolver* resolver, Scope* scope, int entry) {
+  uint32_t mask = scope->index_capacity - 1;
+  uint32_t at = hash_symbol(resolver->entries[entry].symbol) & mask;
+  while (scope->index[at] != 0) {
+    at = (at + 1) & mask;
+  }
+  scope->index[at] = entry + 1;
+}
+
+// (re)build the index of a wide scope, kept at most half full
+static void index_scope(Resolver* resolver, Scope* scope) {
+  int count = resolver->num_entries - scope->first;
+  free(scope->index);
+  scope->index_capacity = 64;
+  while (scope->index_capacity < count * 4) {
+    scope->index_capacity *= 2;
+  }
+  scope->index = calloc(scope->index_capacity, sizeof(int));
+  for (int entry = scope->first; entry < resolver->num_entries; entry++) {
+    index_entry(resolver, scope, entry);
+  }
+}
+
+// the entry of `symbol` in the i-th scope from the outermost, or NULL
+static ScopeEntry* find_in_scope(Resolver* resolver, int i, int symbol) {
+  Scope* scope = &resolver->scopes[i];
+  if (scope->index != NULL) {
+    uint32_t mask = scope->index_capacity - 1;
+    for (uint32_t at = hash_symbol(symbol) & mask; scope->index[at] != 0;
+         at = (at + 1) & mask) {
+      ScopeEntry* entry = &resolver->entries[scope->index[at] - 1];
+      if (entry->symbol == symbol)
+        return entry;
+    }
+    return NULL;
+  }
+  int end = i + 1 < resolver->num_scopes ? resolver->scopes[i + 1].first
+                                          : resolver->num_entries;
+  for (int entry = scope->first; entry < end; entry++) {
+    if (resolver->entries[entry].symbol == symbol)
+      return &resolver->entries[entry];
+  }
+  return NULL;
+}
+
+// add a name to the innermost scope
+static void add_entry(Resolver* resolver, int symbol, int slot, bool defined) {
+  resolver->entries =
+      grow(resolver->entries, &resolver->entry_capacity,
+           resolver->num_entries + 1, sizeof(ScopeEntry));
+  int entry = resolver->num_entries++;
+  resolver->entries[entry] = (ScopeEntry){symbol, slot, defined};
+
+  Scope* scope = innermost_scope(resolver);
+  int count = resolver->num_entries - scope->first;
+  if (count > WIDE_SCOPE &&
+      (scope->index == NULL || count * 2 > scope->index_capacity)) {
+    index_scope(resolver, scope);
+  } else if (scope->index != NULL) {
+    index_entry(resolver, scope, entry);
+  }
+}
+
+// declare `this` or `super` in the scope just opened for it, its slot is 0
+static void declare_keyword(Resolver* resolver, const char* keyword) {
+  int symbol = intern_symbol(resolver->symbols, keyword, strlen(keyword));
+  add_entry(resolver, symbol, innermost_scope(resolver)->num_slots++, true);
+}
+
+static void free_scopes(Resolver* resolver) {
+  while (resolver->num_scopes > 0) {
+    end_scope(resolver, NULL);
+  }
+  free(resolver->scopes);
+  free(resolver->entries);
+  free_symbol_table(resolver->symbols);
+}
+
+Resolver* new_resolver(SymbolTable* globals) {
+  Resolver* resolver = calloc(1, sizeof(*resolver));
+  resolver->symbols = new_symbol_table();
+  resolver->globals = globals;
   resolver->cur_fn_type = F_NONE;
+  resolver->cur_class_type = C_NONE;
+  resolver->had_error = false;
   return resolver;
 };
 
 void resolve(Resolver* resolver, Statement** stms) {
   resolve_statements(resolver, stms);
-  stack_destroy(resolver->scopes);
+  free_scopes(resolver);
+};
+
+void resolve_deferred(Resolver* resolver,
+                      StatementFunction* stmt,
+                      DeferredKind kind) {
+  // a top-level function sees only globals, a method also the scopes that
+  // resolve_class_statement opens around it
+  int scopes = 0;
+  if (kind == DEFERRED_SUBCLASS_METHOD) {
+    resolver->cur_class_type = C_SUBCLASS;
+    begin_scope(resolver);
+    declare_keyword(resolver, "super");
+    scopes++;
+  } else if (kind == DEFERRED_METHOD) {
+    resolver->cur_class_type = C_CLASS;
+  }
+  if (kind != DEFERRED_FUNCTION) {
+    begin_scope(resolver);
+    declare_keyword(resolver, "this");
+    scopes++;
+  }
+
+  resolve_function(resolver, stmt,
+                   kind == DEFERRED_FUNCTION ? F_FUNCTION : F_METHOD);
+
+  while (scopes-- > 0) {
+    end_scope(resolver, NULL);
+  }
+  free_scopes(resolver);
 };
 
 void begin_scope(Resolver* resolver) {
-  hash_table* scope = hash_table_create(8192, NULL);
-  stack_push(resolver->scopes, scope);
+  resolver->scopes = grow(resolver->scopes, &resolver->scope_capacity,
+                          resolver->num_scopes + 1, sizeof(Scope));
+  resolver->scopes[resolver->num_scopes++] = (Scope){
+      resolver->num_entries, 0, resolver->function_depth, false, NULL, 0};
 };
 
-void end_scope(Resolver* resolver) {
-  hash_table* scope = stack_pop(resolver->scopes);
-  hash_table_destroy(scope);
+// Close the innermost scope. When it is the scope of `block` the block gets
+// its slot count and whether closures capture it.
+void end_scope(Resolver* resolver, StatementBlock* block) {
+  Scope* scope = &resolver->scopes[--resolver->num_scopes];
+  resolver->num_entries = scope->first;
+  free(scope->index);
+  if (block != NULL) {
+    block->num_slots = scope->num_slots;
+    block->captured = scope->captured;
+  }
+};
+
+// whether any statement of a block declares a name, as resolving it would
+static bool declares_locals(Statement** stmts) {
+  for (int i = 0; stmts[i] != NULL; i++) {
+    switch (stmts[i]->type) {
+      case STATEMENT_VAR:
+        if (stmts[i]->as.var.name != NULL)
+          return true;
+        break;
+      case STATEMENT_FUNCTION:
+      case STATEMENT_CLASS:
+        return true;
+      default:
+        break;
+    }
+  }
+  return false;
 };
 
+// A block declaring nothing gets no scope and keeps no slots, so the
+// interpreter runs it in the enclosing environment. The references inside
+// it resolve to the same depths as from right outside it.
 void resolve_block(Resolver* resolver, StatementBlock* stmt) {
+  if (!declares_locals(stmt->stmts)) {
+    stmt->num_slots = 0;
+    stmt->captured = false;
+    resolve_statements(resolver, stmt->stmts);
+    return;
+  }
   begin_scope(resolver);
   resolve_statements(resolver, stmt->stmts);
-  end_scope(resolver);
+  end_scope(resolver, stmt);
 };
 
 void resolve_statements(Resolver* resolver, Statement** stmts) {
@@ -43,42 +224,42 @@ void resolve_statements(Resolver* resolver, Statement** stmts) {
 void resolve_statement(Resolver* resolver, Statement* stmt) {
   switch (stmt->type) {
     case STATEMENT_VAR:
-      resolve_var_statement(resolver, stmt->u_stmt->var);
+      resolve_var_statement(resolver, &stmt->as.var);
       break;
     case STATEMENT_FUNCTION:
-      resolve_function_statement(resolver, stmt->u_stmt->function);
+      resolve_function_statement(resolver, &stmt->as.function);
       break;
     case STATEMENT_CLASS:
-      resolve_class_statement(resolver, stmt->u_stmt->class);
+      resolve_class_statement(resolver, &stmt->as.class);
       break;
     case STATEMENT_BLOCK:
-      resolve_block(resolver, stmt->u_stmt->block);
+      resolve_block(resolver, &stmt->as.block);
       break;
     case STATEMENT_EXPRESSION:
-      resolve_expr(resolver, stmt->u_stmt->expr->expr);
+      resolve_expr(resolver, stmt->as.expr.expr);
       break;
     case STATEMENT_IF:
-      resolve_expr(resolver, stmt->u_stmt->if_stmt->condition);
-      resolve_statement(resolver, stmt->u_stmt->if_stmt->then_branch);
-      if (stmt->u_stmt->if_stmt->else_branch != NULL) {
-        resolve_statement(resolver, stmt->u_stmt->if_stmt->else_branch);
+      resolve_expr(resolver, stmt->as.if_stmt.condition);
+      resolve_statement(resolver, stmt->as.if_stmt.then_branch);
+      if (stmt->as.if_stmt.else_branch != NULL) {
+        resolve_statement(resolver, stmt->as.if_stmt.else_branch);
       }
       break;
     case STATEMENT_PRINT:
-      resolve_expr(resolver, stmt->u_stmt->print->expr);
+      resolve_expr(resolver, stmt->as.print.expr);
       break;
     case STATEMENT_RETURN:
       if (resolver->cur_fn_type == F_NONE) {
-        log_error("Can't return from top-level code.");
+        resolver_error(resolver, "Can't return from top-level code.");
         return;
       }
-      if (stmt->u_stmt->return_stmt->value != NULL) {
-        resolve_expr(resolver, stmt->u_stmt->return_stmt->value);
+      if (stmt->as.return_stmt.value != NULL) {
+        resolve_expr(resolver, stmt->as.return_stmt.value);
       }
       break;
     case STATEMENT_WHILE:
-      resolve_expr(resolver, stmt->u_stmt->while_stmt->condition);
-      resolve_statement(resolver, stmt->u_stmt->while_stmt->body);
+      resolve_expr(resolver, stmt->as.while_stmt.condition);
+      resolve_statement(resolver, stmt->as.while_stmt.body);
       break;
     default:
       break;
@@ -86,6 +267,9 @@ void resolve_statement(Resolver* resolver, Statement* stmt) {
 };
 
 void resolve_var_statement(Resolver* resolver, StatementVar* stmt) {
+  // left without a name by a parse error
+  if (stmt->name == NULL)
+    return;
   declare(resolver, stmt->name);
   if (stmt->initializer != NULL) {
     resolve_expr(resolver, stmt->initializer);
@@ -100,9 +284,8 @@ void resolve_class_statement(Resolver* resolver, StatementClass* stmt) {
   define(resolver, stmt->name);
 
   if (stmt->superclass != NULL) {
-    if (strcmp(stmt->name->lexeme,
-               stmt->superclass->u_expr->variable->name->lexeme) == 0) {
-      log_error("A class can't inherit from itself.");
+    if (lexeme_equals(stmt->name, stmt->superclass->as.variable.name)) {
+      resolver_error(resolver, "A class can't inherit from itself.");
     }
     resolve_expr(resolver, stmt->superclass);
   }
@@ -110,22 +293,20 @@ void resolve_class_statement(Resolver* resolver, StatementClass* stmt) {
   if (stmt->superclass != NULL) {
     resolver->cur_class_type = C_SUBCLASS;
     begin_scope(resolver);
-    hash_table* scope = stack_top(resolver->scopes);
-    hash_table_insert(scope, "super", (void*)1);
+    declare_keyword(resolver, "super");
   }
 
   begin_scope(resolver);
-  hash_table* scope = stack_top(resolver->scopes);
-  hash_table_insert(scope, "this", (void*)1);
+  declare_keyword(resolver, "this");
 
   for (int i = 0; stmt->methods[i] != NULL; i++) {
-    resolve_function(resolver, stmt->methods[i]->u_stmt->function, F_METHOD);
+    resolve_function(resolver, &stmt->methods[i]->as.function, F_METHOD);
   }
 
-  end_scope(resolver);
+  end_scope(resolver, NULL);
 
   if (stmt->superclass != NULL) {
-    end_scope(resolver);
+    end_scope(resolver, NULL);
   }
 
   resolver->cur_class_type = enclosing_class_type;
@@ -143,125 +324,165 @@ void resolve_function(Resolver* resolver,
   FunctionType enclosing_fn_type = resolver->cur_fn_type;
   resolver->cur_fn_type = type;
 
+  resolver->function_depth++;
   begin_scope(resolver);
-  int size = sizeof(stmt->params) / sizeof(stmt->params[0]);
-  for (int i = 0; i < size - 1; i++) {
+  // parameters take the first slots of the frame
+  for (int i = 0; stmt->params[i] != NULL; i++) {
     Token* param = stmt->params[i];
     declare(resolver, param);
     define(resolver, param);
   }
   // don't use resolve_block here, cause we make params and body in the same
-  // scope
-  resolve_statements(resolver, stmt->body->u_stmt->block->stmts);
-  end_scope(resolver);
+  // scope. A deferred body is resolved by resolve_deferred once parsed.
+  bool has_body = stmt->body->type == STATEMENT_BLOCK;
+  if (has_body) {
+    resolve_statements(resolver, stmt->body->as.block.stmts);
+  }
+  end_scope(resolver, has_body ? &stmt->body->as.block : NULL);
+  resolver->function_depth--;
   resolver->cur_fn_type = enclosing_fn_type;
 };
 
 void declare(Resolver* resolver, Token* name) {
-  if (stack_is_empty(resolver->scopes))
+  if (resolver->num_scopes == 0)
     return;
-  hash_table* scope = stack_top(resolver->scopes);
+  Scope* scope = innermost_scope(resolver);
+  // the interpreter gives every declaration a slot, even a repeated one
+  int slot = scope->num_slots++;
+  if (slot == MAX_SLOTS) {
+    resolver_error(resolver, "Too many local variables in one scope.");
+  }
 
-  if (hash_table_lookup(scope, name->lexeme) != NULL) {
-    log_error("Variable %s already declared in this scope.", name->lexeme);
+  int symbol = intern_symbol(resolver->symbols, name->start, name->length);
+  if (find_in_scope(resolver, resolver->num_scopes - 1, symbol) != NULL) {
+    resolver_error(resolver, "Variable %.*s already declared in this scope.", name->length,
+              name->start);
     return;
   }
 
-  // use -1 to mark as declared but not initialized
-  hash_table_insert(scope, name->lexeme, (void*)-1);
+  add_entry(resolver, symbol, slot, false);
 }
 
 void define(Resolver* resolver, Token* name) {
-  if (stack_is_empty(resolver->scopes))
+  if (resolver->num_scopes == 0)
     return;
-  hash_table* scope = stack_top(resolver->scopes);
-  // use 1 to mark as initialized
-  hash_table_update(scope, name->lexeme, (void*)1);
+  int symbol = intern_symbol(resolver->symbols, name->start, name->length);
+  ScopeEntry* entry =
+      find_in_scope(resolver, resolver->num_scopes - 1, symbol);
+  if (entry != NULL) {
+    entry->defined = true;
+  }
 }
 
 void resolve_var_expr(Resolver* resolver, Expr* expr) {
-  Token* name = expr->u_expr->variable->name;
-  bool is_empty = stack_is_empty(resolver->scopes);
-  if (!is_empty && hash_table_lookup(stack_top(resolver->scopes),
-                                     name->lexeme) == (void*)-1) {
-    log_error("Can't read local variable %s in its own initializer.",
-              name->lexeme);
+  Token* name = expr->as.variable.name;
+  if (resolver->num_scopes > 0) {
+    int symbol = intern_symbol(resolver->symbols, name->start, name->length);
+    ScopeEntry* entry =
+        find_in_scope(resolver, resolver->num_scopes - 1, symbol);
+    if (entry != NULL && !entry->defined) {
+      resolver_error(resolver, "Can't read local variable %.*s in its own initializer.",
+                name->length, name->start);
+    }
+  }
+  expr->as.variable.depth =
+      resolve_local(resolver, name, &expr->as.variable.slot);
+}
+
+// A name found in scope i from inside a function nested deeper than that
+// scope is captured: a closure walks there through the environments of
+// the enclosing functions, so none of them may be freed on exit.
+static void mark_captured(Resolver* resolver, int i) {
+  int function_depth = innermost_scope(resolver)->function_depth;
+  for (; resolver->scopes[i].function_depth < function_depth; i++) {
+    resolver->scopes[i].captured = true;
   }
-  expr->u_expr->variable->depth = resolve_local(resolver, name);
 }
 
-// return depth for write to var or assign expr
-int resolve_local(Resolver* resolver, Token* name) {
-  for (int i = stack_size(resolver->scopes) - 1; i >= 0; i--) {
-    hash_table* scope = stack_peek(resolver->scopes, i);
-    if (hash_table_lookup(scope, name->lexeme) != NULL) {
-      int depth = stack_size(resolver->scopes) - 1 - i;
-      return depth;
+// return depth for write to var or assign expr and set its slot, depth -1
+// is a global and its slot the ID of its name among the globals
+int resolve_local(Resolver* resolver, Token* name, int* slot) {
+  if (resolver->num_scopes > 0) {
+    int symbol = intern_symbol(resolver->symbols, name->start, name->length);
+    for (int i = resolver->num_scopes - 1; i >= 0; i--) {
+      ScopeEntry* entry = find_in_scope(resolver, i, symbol);
+      if (entry != NULL) {
+        *slot = entry->slot;
+        mark_captured(resolver, i);
+        int depth = resolver->num_scopes - 1 - i;
+        return depth;
+      }
     }
   }
+  *slot = intern_symbol(resolver->globals, name->start, name->length);
   return -1;
 };
 
 void resolve_expr(Resolver* resolver, Expr* expr) {
   switch (expr->type) {
     case E_Assign: {
-      resolve_expr(resolver, expr->u_expr->assign->value);
-      int depth = resolve_local(resolver, expr->u_expr->assign->name);
-      expr->u_expr->assign->depth = depth;
+      resolve_expr(resolver, expr->as.assign.value);
+      int depth = resolve_local(resolver, expr->as.assign.name,
+                                &expr->as.assign.slot);
+      expr->as.assign.depth = depth;
       break;
     }
     case E_Binary:
-      resolve_expr(resolver, expr->u_expr->binary->left);
-      resolve_expr(resolver, expr->u_expr->binary->right);
+      resolve_expr(resolver, expr->as.binary.left);
+      resolve_expr(resolver, expr->as.binary.right);
       break;
     case E_Get:
-      resolve_expr(resolver, expr->u_expr->get->object);
+      resolve_expr(resolver, expr->as.get.object);
       break;
     case E_Set:
-      resolve_expr(resolver, expr->u_expr->set->value);
-      resolve_expr(resolver, expr->u_expr->set->object);
+      resolve_expr(resolver, expr->as.set.value);
+      resolve_expr(resolver, expr->as.set.object);
       break;
     case E_This: {
       if (resolver->cur_class_type == C_NONE) {
-        log_error("Can't use 'this' outside of a class.");
+        resolver_error(resolver, "Can't use 'this' outside of a class.");
         return;
       }
-      int depth = resolve_local(resolver, expr->u_expr->this->keyword);
-      expr->u_expr->this->depth = depth;
+      int slot;
+      int depth = resolve_local(resolver, expr->as.this.keyword, &slot);
+      expr->as.this.depth = depth;
       break;
     }
     case E_Super: {
       if (resolver->cur_class_type == C_NONE) {
-        log_error("Can't use 'super' outside of a class.");
+        resolver_error(resolver, "Can't use 'super' outside of a class.");
       } else if (resolver->cur_class_type != C_SUBCLASS) {
-        log_error("Can't use 'super' in a class with no superclass.");
+        resolver_error(resolver, "Can't use 'super' in a class with no superclass.");
       }
-      int depth = resolve_local(resolver, expr->u_expr->super->keyword);
-      expr->u_expr->super->depth = depth;
+      int slot;
+      int depth = resolve_local(resolver, expr->as.super.keyword, &slot);
+      expr->as.super.depth = depth;
       break;
     }
     case E_Call:
-      resolve_expr(resolver, expr->u_expr->call->callee);
-      Expr** args = expr->u_expr->call->arguments;
-      int argc = sizeof(args) / sizeof(args[0]);
-      for (int i = 0; i < argc - 1; i++) {
+      resolve_expr(resolver, expr->as.call.callee);
+      Expr** args = expr->as.call.arguments;
+      for (int i = 0; args[i] != NULL; i++) {
         resolve_expr(resolver, args[i]);
       }
       break;
     case E_Grouping:
-      resolve_expr(resolver, expr->u_expr->grouping->expression);
+      resolve_expr(resolver, expr->as.grouping.expression);
       break;
     case E_Literal:
       break;
     case E_Logical:
-      resolve_expr(resolver, expr->u_expr->logical->left);
-      resolve_expr(resolver, expr->u_expr->logical->right);
+      resolve_expr(resolver, expr->as.logical.left);
+      resolve_expr(resolver, expr->as.logical.right);
       break;
     case E_Unary:
-      resolve_expr(resolver, expr->u_expr->unary->right);
+      resolve_expr(resolver, expr->as.unary.right);
       break;
     case E_Variable:
       resolve_var_expr(resolver, expr);
       break;
+    default:
+      // specialized kinds only appear as a program runs, after resolving
+      break;
   }
 };
\ No newline at end of file
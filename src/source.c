@@ -0,0 +1,170 @@
+#include "include/source.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define READ_CHUNK (64 * 1024)
+
+static char* read_all(int fd, size_t* length);
+
+static void add_path(char*** paths, int* count, int* capacity, char* path);
+
+static bool add_directory(char*** paths,
+                          int* count,
+                          int* capacity,
+                          const char* dir);
+
+Source* load_source(const char* path) {
+  bool from_stdin = strcmp(path, "-") == 0;
+  int fd = from_stdin ? STDIN_FILENO : open(path, O_RDONLY);
+  if (fd < 0) {
+    printf("Error: Could not open file %s\n", path);
+    return NULL;
+  }
+
+  Source* source = calloc(1, sizeof(Source));
+  source->path = path;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      // the lexer reads the file front to back exactly once
+      madvise(data, st.st_size, MADV_SEQUENTIAL);
+      source->data = data;
+      source->length = st.st_size;
+      source->mapped = true;
+    }
+  }
+  // pipes, stdin, empty files and anything mmap refused
+  if (!source->mapped) {
+    source->data = read_all(fd, &source->length);
+  }
+  if (!from_stdin)
+    close(fd);
+  if (source->data == NULL) {
+    printf("Error: Could not read file %s\n", path);
+    free(source);
+    return NULL;
+  }
+  return source;
+}
+
+void free_source(Source* source) {
+  if (source->mapped) {
+    munmap((void*)source->data, source->length);
+  } else {
+    free((void*)source->data);
+  }
+  free(source);
+}
+
+static char* read_all(int fd, size_t* length) {
+  size_t size = 0;
+  size_t capacity = READ_CHUNK;
+  char* data = malloc(capacity);
+  for (;;) {
+    if (size == capacity) {
+      capacity *= 2;
+      data = realloc(data, capacity);
+    }
+    ssize_t n = read(fd, data + size, capacity - size);
+    if (n < 0) {
+      free(data);
+      return NULL;
+    }
+    if (n == 0)
+      break;
+    size += n;
+  }
+  *length = size;
+  return data;
+}
+
+char** expand_paths(char** paths, int count) {
+  char** result = NULL;
+  int num_paths = 0;
+  int capacity = 0;
+  for (int i = 0; i < count; i++) {
+    struct stat st;
+    if (strcmp(paths[i], "-") == 0) {
+      add_path(&result, &num_paths, &capacity, strdup(paths[i]));
+    } else if (stat(paths[i], &st) != 0) {
+      // before any script runs, rather than once the ones before it did
+      printf("Error: Could not open file %s\n", paths[i]);
+      add_path(&result, &num_paths, &capacity, NULL);
+      free_paths(result);
+      return NULL;
+    } else if (S_ISDIR(st.st_mode)) {
+      if (!add_directory(&result, &num_paths, &capacity, paths[i])) {
+        add_path(&result, &num_paths, &capacity, NULL);
+        free_paths(result);
+        return NULL;
+      }
+    } else {
+      add_path(&result, &num_paths, &capacity, strdup(paths[i]));
+    }
+  }
+  add_path(&result, &num_paths, &capacity, NULL);
+  return result;
+}
+
+void free_paths(char** paths) {
+  if (paths == NULL)
+    return;
+  for (int i = 0; paths[i] != NULL; i++) {
+    free(paths[i]);
+  }
+  free(paths);
+}
+
+static void add_path(char*** paths, int* count, int* capacity, char* path) {
+  if (*count == *capacity) {
+    *capacity = *capacity < 16 ? 16 : *capacity * 2;
+    *paths = realloc(*paths, sizeof(char*) * *capacity);
+  }
+  (*paths)[(*count)++] = path;
+}
+
+static bool is_script(const char* name) {
+  size_t length = strlen(name);
+  return length > 4 && strcmp(name + length - 4, ".lox") == 0;
+}
+
+static bool add_directory(char*** paths,
+                          int* count,
+                          int* capacity,
+                          const char* dir) {
+  struct dirent** entries;
+  int num_entries = scandir(dir, &entries, NULL, alphasort);
+  if (num_entries < 0) {
+    printf("Error: Could not open directory %s\n", dir);
+    return false;
+  }
+  bool ok = true;
+  for (int i = 0; i < num_entries; i++) {
+    const char* name = entries[i]->d_name;
+    if (ok && name[0] != '.') {
+      size_t length = strlen(dir) + strlen(name) + 2;
+      char* path = malloc(length);
+      bool slash = dir[strlen(dir) - 1] == '/';
+      snprintf(path, length, "%s%s%s", dir, slash ? "" : "/", name);
+      struct stat st;
+      if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        ok = add_directory(paths, count, capacity, path);
+        free(path);
+      } else if (is_script(name)) {
+        add_path(paths, count, capacity, path);
+      } else {
+        free(path);
+      }
+    }
+    free(entries[i]);
+  }
+  free(entries);
+  return ok;
+}
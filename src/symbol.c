@@ -0,0 +1,27 @@
+#include "include/symbol.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+// buckets to start with, the table grows with the names interned
+#define SYMBOL_TABLE_SIZE 1024
+
+SymbolTable* new_symbol_table() {
+  SymbolTable* table = malloc(sizeof(SymbolTable));
+  table->ids = hash_table_create(SYMBOL_TABLE_SIZE, NULL);
+  table->count = 0;
+  return table;
+}
+
+void free_symbol_table(SymbolTable* table) {
+  hash_table_destroy(table->ids);
+  free(table);
+}
+
+int intern_symbol(SymbolTable* table, const char* start, int length) {
+  intptr_t found = (intptr_t)hash_table_lookup_n(table->ids, start, length);
+  if (found != 0)
+    return (int)found - 1;
+  int id = table->count++;
+  hash_table_insert_n(table->ids, start, length, (void*)(intptr_t)(id + 1));
+  return id;
+}
@@ -4,7 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 
-Token* new_token(TokenType type, char* lexeme, Literal* literal, int line) {
+Token* new_token(TokenType type, const char* start, int length, int line) {
   Token* token = (Token*)malloc(sizeof(Token));
   if (token == NULL) {
     fprintf(stderr, "Memory allocation failed.\n");
@@ -12,40 +12,106 @@ Token* new_token(TokenType type, char* lexeme, Literal* literal, int line) {
   }
 
   token->type = type;
-  // Use strdup to duplicate the lexeme string
-  token->lexeme = lexeme != NULL ? strdup(lexeme) : NULL;
-  token->literal = literal != NULL ? literal : NULL;
+  // the lexeme is not copied, the token only references the source
+  token->start = start;
+  token->length = length;
   token->line = line;
+  token->number = 0;
   return token;
 }
 
+char* token_lexeme(Token* token) {
+  char* lexeme = malloc(token->length + 1);
+  memcpy(lexeme, token->start, token->length);
+  lexeme[token->length] = '\0';
+  return lexeme;
+}
+
+bool lexeme_equals(Token* a, Token* b) {
+  return a->length == b->length &&
+         memcmp(a->start, b->start, a->length) == 0;
+}
+
+bool lexeme_is(Token* token, const char* text) {
+  return strncmp(token->start, text, token->length) == 0 &&
+         text[token->length] == '\0';
+}
+
 void print_token(Token* token) {
   printf("%s", type_to_string(token->type));
-  if (token->lexeme != NULL) {
-    printf(" %s", token->lexeme);
+  switch (token->type) {
+    case IDENTIFIER:
+    case STRING:
+    case NUMBER:
+      printf(" %.*s", token->length, token->start);
+      break;
+    default:
+      break;
   }
   printf("\n");
 };
 
-TokenType map_keyword(char* text) {
-  struct {
-    char* keyword;
-    TokenType type;
-  } keywords[] = {
-      {"and", AND},   {"class", CLASS}, {"else", ELSE},     {"false", FALSE},
-      {"for", FOR},   {"fun", FUN},     {"if", IF},         {"nil", NIL},
-      {"or", OR},     {"print", PRINT}, {"return", RETURN}, {"super", SUPER},
-      {"this", THIS}, {"true", TRUE},   {"var", VAR},       {"while", WHILE},
-  };
-  int num_keywords = sizeof(keywords) / sizeof(keywords[0]);
-  for (int i = 0; i < num_keywords; i++) {
-    if (strcmp(text, keywords[i].keyword) == 0) {
-      return keywords[i].type;
-    }
+// Keywords are classified by a switch on the length and the first character
+// that the compiler turns into jump tables. That leaves at most one candidate,
+// which is checked with a single memcmp; the slice needs no NUL terminator.
+#define KEYWORD(word, type)                                    \
+  (memcmp(text + 1, word + 1, sizeof(word) - 2) == 0 ? (type) \
+                                                     : (TokenType)-1)
+
+TokenType map_keyword(const char* text, int length) {
+  switch (length) {
+    case 2:
+      switch (text[0]) {
+        case 'i':
+          return KEYWORD("if", IF);
+        case 'o':
+          return KEYWORD("or", OR);
+      }
+      break;
+    case 3:
+      switch (text[0]) {
+        case 'a':
+          return KEYWORD("and", AND);
+        case 'f':
+          return text[1] == 'u' ? KEYWORD("fun", FUN) : KEYWORD("for", FOR);
+        case 'n':
+          return KEYWORD("nil", NIL);
+        case 'v':
+          return KEYWORD("var", VAR);
+      }
+      break;
+    case 4:
+      switch (text[0]) {
+        case 'e':
+          return KEYWORD("else", ELSE);
+        case 't':
+          return text[1] == 'h' ? KEYWORD("this", THIS) : KEYWORD("true", TRUE);
+      }
+      break;
+    case 5:
+      switch (text[0]) {
+        case 'c':
+          return KEYWORD("class", CLASS);
+        case 'f':
+          return KEYWORD("false", FALSE);
+        case 'p':
+          return KEYWORD("print", PRINT);
+        case 's':
+          return KEYWORD("super", SUPER);
+        case 'w':
+          return KEYWORD("while", WHILE);
+      }
+      break;
+    case 6:
+      if (text[0] == 'r')
+        return KEYWORD("return", RETURN);
+      break;
   }
   return -1;
 };
 
+#undef KEYWORD
+
 char* type_to_string(TokenType type) {
   switch (type) {
     case LEFT_PAREN:
@@ -0,0 +1,529 @@
+#include "include/vm.h"
+#include <stdlib.h>
+#include <string.h>
+#include "include/bytecode.h"
+#include "include/compiler.h"
+#include "include/interpreter.h"
+#include "include/log.h"
+
+#define FRAMES_MAX 16384
+// values on the stack, 64 a call on average; a call needs the most its
+// chunk keeps there
+#define STACK_MAX (FRAMES_MAX * 64)
+
+// With GCC or clang every instruction jumps straight to the next one
+// through a table of label addresses, elsewhere or when built with
+// -DVM_SWITCH_DISPATCH they go back to a switch.
+#if defined(__GNUC__) && !defined(VM_SWITCH_DISPATCH)
+#define COMPUTED_GOTO
+#endif
+
+typedef struct CallFrame {
+  Chunk* chunk;
+  uint8_t* ip;
+  // the innermost frame of locals, a block's or else the call's own
+  Env* env;
+  // pushed by the call, and `this_env` by a method call, NULL for a program
+  Env* locals;
+  Env* this_env;
+  bool captured;
+  // the closure of the function, whose slot 0 an initializer returns
+  Env* closure;
+  bool is_initializer;
+  // where the callee was, which the result replaces
+  Value* base;
+} CallFrame;
+
+static Value* stack = NULL;
+static Value* stack_top = NULL;
+static CallFrame frames[FRAMES_MAX];
+static int frame_count = 0;
+// set when a call did not fit, which ends the program
+static bool overflowed = false;
+
+// chunks compiled so far, freed with the VM
+static Chunk** chunks = NULL;
+static int num_chunks = 0;
+
+static void keep_chunk(Chunk* chunk) {
+  chunks = realloc(chunks, sizeof(Chunk*) * (num_chunks + 1));
+  chunks[num_chunks++] = chunk;
+}
+
+void free_vm() {
+  for (int i = 0; i < num_chunks; i++) {
+    free_chunk(chunks[i]);
+  }
+  free(chunks);
+  chunks = NULL;
+  num_chunks = 0;
+  free(stack);
+  stack = NULL;
+}
+
+// replace the callee and its arguments on the stack with the result
+static void finish_call(Value result, int num_args) {
+  stack_top -= num_args + 1;
+  *stack_top++ = result;
+}
+
+// Push the frame of a call of `function` with the arguments on top of the
+// stack, with 'this' bound to `instance` unless it is EMPTY_VAL. Returns
+// false when the call cannot start, which was reported.
+static bool begin_call(Function* function, Value instance, int num_args) {
+  StatementBlock* body = function_body(function->declaration);
+  if (body->chunk == NULL) {
+    body->chunk = compile_function(function->declaration);
+    if (body->chunk == NULL)
+      return false;
+    keep_chunk(body->chunk);
+  }
+  if (num_args != body->chunk->arity) {
+    log_error("Expected %d arguments but got %d.", body->chunk->arity,
+              num_args);
+    return false;
+  }
+  if (frame_count == FRAMES_MAX ||
+      body->chunk->max_stack > stack + STACK_MAX - stack_top) {
+    log_error("Stack overflow.");
+    overflowed = true;
+    return false;
+  }
+
+  Env* closure = function->closure;
+  Env* this_env = NULL;
+  if (instance != EMPTY_VAL) {
+    this_env = push_frame(closure, 1, body->captured);
+    env_define(this_env, "this", strlen("this"), instance);
+    closure = this_env;
+  }
+  // the arguments are the first locals, a few words copied one by one
+  Env* locals = push_frame(closure, body->num_slots, body->captured);
+  Value* args = stack_top - num_args;
+  for (int i = 0; i < num_args; i++) {
+    locals->slots[i] = args[i];
+  }
+  locals->count = num_args;
+
+  CallFrame* frame = &frames[frame_count++];
+  frame->chunk = body->chunk;
+  frame->ip = body->chunk->code;
+  frame->env = locals;
+  frame->locals = locals;
+  frame->this_env = this_env;
+  frame->captured = body->captured;
+  frame->closure = closure;
+  frame->is_initializer = function->is_initializer;
+  frame->base = stack_top - num_args - 1;
+  return true;
+}
+
+// Call `callee` with the arguments on top of the stack. A function declared
+// in Lox gets a frame, any other call is done right away.
+static void call_value(Value callee, int num_args) {
+  if (IS_FUNCTION(callee)) {
+    Function* function = AS_FUNCTION(callee);
+    if (function->native != NULL) {
+      if (num_args != 0) {
+        log_error("Expected 0 arguments but got %d.", num_args);
+        finish_call(NIL_VAL, num_args);
+      } else {
+        finish_call(function->native(), num_args);
+      }
+    } else if (!begin_call(function, EMPTY_VAL, num_args)) {
+      finish_call(NIL_VAL, num_args);
+    }
+  } else if (IS_CLASS(callee)) {
+    Class* class = AS_CLASS(callee);
+    Value instance = INSTANCE_VAL(new_instance(class));
+    Function* initializer = hash_table_lookup(class->methods, "init");
+    // the call is the instance, whatever its initializer does
+    stack_top[-num_args - 1] = instance;
+    if (initializer == NULL || !begin_call(initializer, instance, num_args)) {
+      finish_call(instance, num_args);
+    }
+  } else {
+    log_error("Can only call functions and classes.");
+    finish_call(NIL_VAL, num_args);
+  }
+}
+
+// call the method `name` of the object below the arguments, without
+// binding it first when it is a method of its class
+static void invoke(Token* name, int num_args) {
+  Value object = stack_top[-num_args - 1];
+  if (IS_INSTANCE(object) &&
+      hash_table_lookup_n(AS_INSTANCE(object)->fields, name->start,
+                          name->length) == NULL) {
+    Function* method = find_method(AS_INSTANCE(object)->class, name);
+    if (method != NULL) {
+      if (!begin_call(method, object, num_args)) {
+        finish_call(NIL_VAL, num_args);
+      }
+      return;
+    }
+  }
+  Value callee = get_property(object, name);
+  stack_top[-num_args - 1] = callee;
+  call_value(callee, num_args);
+}
+
+static uint16_t read_short(const uint8_t* at) {
+  uint16_t value;
+  memcpy(&value, at, sizeof(value));
+  return value;
+}
+
+static uint32_t read_int(const uint8_t* at) {
+  uint32_t value;
+  memcpy(&value, at, sizeof(value));
+  return value;
+}
+
+// pop every frame after a stack overflow
+static void unwind() {
+  while (frame_count > 0) {
+    CallFrame* frame = &frames[--frame_count];
+    if (frame->locals != NULL) {
+      pop_frame(frame->locals, frame->captured);
+    }
+    if (frame->this_env != NULL) {
+      pop_frame(frame->this_env, frame->captured);
+    }
+  }
+  stack_top = stack;
+  overflowed = false;
+}
+
+static void run() {
+  CallFrame* frame = &frames[frame_count - 1];
+  Chunk* chunk = frame->chunk;
+  uint8_t* ip = frame->ip;
+  Env* env = frame->env;
+  Value* sp = stack_top;
+
+#define READ_BYTE() (*ip++)
+#define READ_SHORT() (ip += 2, read_short(ip - 2))
+#define READ_INT() (ip += 4, read_int(ip - 4))
+#define PUSH(value) (*sp++ = (value))
+#define POP() (*--sp)
+#define PEEK(distance) (sp[-1 - (distance)])
+// the registers are stored around anything that may push or pop frames,
+// and loaded from the innermost frame after
+#define SAVE_FRAME() (frame->ip = ip, frame->env = env, stack_top = sp)
+#define LOAD_FRAME()                                            \
+  (frame = &frames[frame_count - 1], chunk = frame->chunk,      \
+   ip = frame->ip, env = frame->env, sp = stack_top)
+// numbers take the fast path, anything else the operator of the runtime
+#define BINARY(op, make, token)                          \
+  do {                                                   \
+    Value right = POP();                                 \
+    Value left = POP();                                  \
+    if (IS_NUMBER(left) && IS_NUMBER(right)) {           \
+      PUSH(make(AS_NUMBER(left) op AS_NUMBER(right)));   \
+    } else {                                             \
+      PUSH(binary_values(token, left, right));           \
+    }                                                    \
+  } while (0)
+
+#ifdef COMPUTED_GOTO
+#define LABEL_ADDRESS(op) &&do_##op,
+  static void* dispatch_table[] = {OPCODES(LABEL_ADDRESS)};
+#undef LABEL_ADDRESS
+#define DISPATCH() goto* dispatch_table[READ_BYTE()]
+#define CASE(op) do_##op
+#else
+#define DISPATCH() goto dispatch
+#define CASE(op) case op
+#endif
+
+  DISPATCH();
+#ifndef COMPUTED_GOTO
+dispatch:
+  switch (READ_BYTE()) {
+#endif
+  CASE(OP_CONSTANT) : {
+    PUSH(chunk->constants[READ_SHORT()]);
+    DISPATCH();
+  }
+  CASE(OP_NIL) : {
+    PUSH(NIL_VAL);
+    DISPATCH();
+  }
+  CASE(OP_TRUE) : {
+    PUSH(TRUE_VAL);
+    DISPATCH();
+  }
+  CASE(OP_FALSE) : {
+    PUSH(FALSE_VAL);
+    DISPATCH();
+  }
+  CASE(OP_POP) : {
+    sp--;
+    DISPATCH();
+  }
+  CASE(OP_GET_LOCAL) : {
+    PUSH(env->slots[READ_SHORT()]);
+    DISPATCH();
+  }
+  CASE(OP_SET_LOCAL) : {
+    env->slots[READ_SHORT()] = PEEK(0);
+    DISPATCH();
+  }
+  CASE(OP_GET_UPPER) : {
+    Env* upper = find_declare_env(env, READ_SHORT());
+    PUSH(upper->slots[READ_SHORT()]);
+    DISPATCH();
+  }
+  CASE(OP_SET_UPPER) : {
+    Env* upper = find_declare_env(env, READ_SHORT());
+    upper->slots[READ_SHORT()] = PEEK(0);
+    DISPATCH();
+  }
+  CASE(OP_DEFINE_LOCAL) : {
+    Value value = POP();
+    if (env->count < env->num_slots) {
+      env->slots[env->count++] = value;
+    }
+    DISPATCH();
+  }
+  CASE(OP_GET_GLOBAL) : {
+    Name* name = &chunk->names[READ_SHORT()];
+    PUSH(read_global(&name->slot, name->token->start, name->token->length));
+    DISPATCH();
+  }
+  CASE(OP_SET_GLOBAL) : {
+    Name* name = &chunk->names[READ_SHORT()];
+    assign_global(&name->slot, name->token->start, name->token->length,
+                  PEEK(0));
+    DISPATCH();
+  }
+  CASE(OP_DEFINE_GLOBAL) : {
+    Name* name = &chunk->names[READ_SHORT()];
+    define_global(&name->slot, name->token->start, name->token->length,
+                  POP());
+    DISPATCH();
+  }
+  CASE(OP_GET_PROPERTY) : {
+    Token* name = chunk->names[READ_SHORT()].token;
+    PEEK(0) = get_property(PEEK(0), name);
+    DISPATCH();
+  }
+  CASE(OP_CHECK_FIELDS) : {
+    uint32_t offset = READ_INT();
+    if (!IS_INSTANCE(PEEK(0))) {
+      log_error("Only instances have fields.");
+      PEEK(0) = NIL_VAL;
+      ip += offset;
+    }
+    DISPATCH();
+  }
+  CASE(OP_SET_PROPERTY) : {
+    Token* name = chunk->names[READ_SHORT()].token;
+    Value value = POP();
+    PEEK(0) = set_property(PEEK(0), name, value);
+    DISPATCH();
+  }
+  CASE(OP_GET_SUPER) : {
+    int depth = READ_SHORT();
+    Token* name = chunk->names[READ_SHORT()].token;
+    // the scope of 'this' is right inside the one of 'super'
+    Value superclass = find_declare_env(env, depth)->slots[0];
+    Value instance = find_declare_env(env, depth - 1)->slots[0];
+    PUSH(super_method(superclass, instance, name));
+    DISPATCH();
+  }
+  CASE(OP_EQUAL) : {
+    BINARY(==, BOOL_VAL, EQUAL_EQUAL);
+    DISPATCH();
+  }
+  CASE(OP_NOT_EQUAL) : {
+    BINARY(!=, BOOL_VAL, BANG_EQUAL);
+    DISPATCH();
+  }
+  CASE(OP_GREATER) : {
+    BINARY(>, BOOL_VAL, GREATER);
+    DISPATCH();
+  }
+  CASE(OP_GREATER_EQUAL) : {
+    BINARY(>=, BOOL_VAL, GREATER_EQUAL);
+    DISPATCH();
+  }
+  CASE(OP_LESS) : {
+    BINARY(<, BOOL_VAL, LESS);
+    DISPATCH();
+  }
+  CASE(OP_LESS_EQUAL) : {
+    BINARY(<=, BOOL_VAL, LESS_EQUAL);
+    DISPATCH();
+  }
+  CASE(OP_ADD) : {
+    BINARY(+, NUMBER_VAL, PLUS);
+    DISPATCH();
+  }
+  CASE(OP_SUBTRACT) : {
+    BINARY(-, NUMBER_VAL, MINUS);
+    DISPATCH();
+  }
+  CASE(OP_MULTIPLY) : {
+    BINARY(*, NUMBER_VAL, STAR);
+    DISPATCH();
+  }
+  CASE(OP_DIVIDE) : {
+    BINARY(/, NUMBER_VAL, SLASH);
+    DISPATCH();
+  }
+  CASE(OP_NOT) : {
+    PEEK(0) = BOOL_VAL(!is_truthy(PEEK(0)));
+    DISPATCH();
+  }
+  CASE(OP_NEGATE) : {
+    PEEK(0) = IS_NUMBER(PEEK(0)) ? NUMBER_VAL(-AS_NUMBER(PEEK(0)))
+                                 : negate_value(PEEK(0));
+    DISPATCH();
+  }
+  CASE(OP_PRINT) : {
+    print_value(POP());
+    DISPATCH();
+  }
+  CASE(OP_JUMP) : {
+    uint32_t offset = READ_INT();
+    ip += offset;
+    DISPATCH();
+  }
+  CASE(OP_JUMP_IF_FALSE) : {
+    uint32_t offset = READ_INT();
+    if (!is_truthy(POP()))
+      ip += offset;
+    DISPATCH();
+  }
+  CASE(OP_LOOP) : {
+    uint32_t offset = READ_INT();
+    ip -= offset;
+    DISPATCH();
+  }
+  CASE(OP_AND) : {
+    uint32_t offset = READ_INT();
+    if (!is_logical_truthy(PEEK(0))) {
+      ip += offset;
+    } else {
+      sp--;
+    }
+    DISPATCH();
+  }
+  CASE(OP_OR) : {
+    uint32_t offset = READ_INT();
+    if (is_logical_truthy(PEEK(0))) {
+      ip += offset;
+    } else {
+      sp--;
+    }
+    DISPATCH();
+  }
+  CASE(OP_CALL) : {
+    int num_args = READ_SHORT();
+    SAVE_FRAME();
+    call_value(PEEK(num_args), num_args);
+    if (overflowed) {
+      unwind();
+      return;
+    }
+    LOAD_FRAME();
+    DISPATCH();
+  }
+  CASE(OP_INVOKE) : {
+    Token* name = chunk->names[READ_SHORT()].token;
+    int num_args = READ_SHORT();
+    SAVE_FRAME();
+    invoke(name, num_args);
+    if (overflowed) {
+      unwind();
+      return;
+    }
+    LOAD_FRAME();
+    DISPATCH();
+  }
+  CASE(OP_CLOSURE) : {
+    Statement* declaration = chunk->declarations[READ_SHORT()];
+    PUSH(new_function_obj(&declaration->as.function, env, false));
+    DISPATCH();
+  }
+  CASE(OP_CLASS) : {
+    Statement* declaration = chunk->declarations[READ_SHORT()];
+    Value superclass = POP();
+    PUSH(new_class(&declaration->as.class, superclass, env));
+    DISPATCH();
+  }
+  CASE(OP_PUSH_SCOPE) : {
+    int num_slots = READ_SHORT();
+    env = push_frame(env, num_slots, READ_BYTE());
+    DISPATCH();
+  }
+  CASE(OP_POP_SCOPE) : {
+    Env* enclosing = env->enclosing;
+    pop_frame(env, READ_BYTE());
+    env = enclosing;
+    DISPATCH();
+  }
+  CASE(OP_RETURN) : {
+    Value result = POP();
+    if (frame->is_initializer) {
+      result = frame->closure->slots[0];
+    }
+    if (frame->locals != NULL) {
+      pop_frame(frame->locals, frame->captured);
+    }
+    if (frame->this_env != NULL) {
+      pop_frame(frame->this_env, frame->captured);
+    }
+    sp = frame->base;
+    frame_count--;
+    // the program is done
+    if (frame_count == 0) {
+      stack_top = sp;
+      return;
+    }
+    PUSH(result);
+    stack_top = sp;
+    LOAD_FRAME();
+    DISPATCH();
+  }
+#ifndef COMPUTED_GOTO
+  }
+#endif
+
+#undef READ_BYTE
+#undef READ_SHORT
+#undef READ_INT
+#undef PUSH
+#undef POP
+#undef PEEK
+#undef SAVE_FRAME
+#undef LOAD_FRAME
+#undef BINARY
+#undef DISPATCH
+#undef CASE
+}
+
+void interpret_bytecode(Statement** statements, Arena* arena) {
+  keep_arena(arena);
+  Chunk* chunk = compile_program(statements);
+  if (chunk == NULL)
+    return;
+  keep_chunk(chunk);
+  if (chunk->max_stack > STACK_MAX) {
+    log_error("Stack overflow.");
+    return;
+  }
+  if (stack == NULL) {
+    stack = malloc(sizeof(Value) * STACK_MAX);
+  }
+  stack_top = stack;
+  CallFrame* frame = &frames[frame_count++];
+  memset(frame, 0, sizeof(*frame));
+  frame->chunk = chunk;
+  frame->ip = chunk->code;
+  frame->env = global_environment();
+  frame->base = stack;
+  run();
+}
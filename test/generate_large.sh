@@ -0,0 +1,30 @@
+#!/bin/sh
+# Write a program large enough to be lexed and parsed on several threads:
+# functions and classes whose bodies hold strings spanning lines and
+# quotes in comments, where the lexer may cut it.
+count=${1:-2000}
+i=0
+while [ $i -lt $count ]; do
+  cat <<LOX
+// "f$i" is declared here, a quote in a comment is not a string
+fun f$i(a) {
+  var text = "a string
+spanning lines // with no comment in it";
+  if (a) return "f$i";
+  return text;
+}
+
+class C$i {
+  init(name) { this.name = name; }
+  get() { return this.name; }
+}
+
+LOX
+  i=$((i + 1))
+done
+i=0
+while [ $i -lt $count ]; do
+  echo "print f$i(true); // expect: f$i"
+  echo "print C$i(\"C$i\").get(); // expect: C$i"
+  i=$((i + 100))
+done